@@ -0,0 +1,47 @@
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <string>
+#include "scanner.h"
+#include "utility.h"
+#include "errors.h"
+#include "parser.h"
+#include "list.h"
+char *yytext;
+int yy_flex_debug;
+static std::string src; static size_t pos; static bool loaded;
+static int curLine=1, curCol=1;
+List<const char*> savedLines;
+static void load(){ if(loaded) return; loaded=true; int c; while((c=getchar())!=EOF) src+=(char)c;
+  size_t s=0; while(s<=src.size()){ size_t e=src.find('\n',s); if(e==std::string::npos){ savedLines.Append(strdup(src.substr(s).c_str())); break;} savedLines.Append(strdup(src.substr(s,e-s).c_str())); s=e+1;} }
+void InitScanner(){ }
+void yyrestart(FILE*){}
+const char *GetLineNumbered(int num){ if(num<=0||num>savedLines.NumElements()) return NULL; return savedLines.Nth(num-1);}
+static std::string tok;
+static int ret(int t, size_t len){ tok=src.substr(pos,len); yytext=(char*)tok.c_str(); yylloc.first_line=curLine; yylloc.first_column=curCol; yylloc.last_column=curCol+len-1; curCol+=len; pos+=len; return t;}
+struct KW{const char*s;int t;};
+static KW kws[]={{"void",T_Void},{"int",T_Int},{"double",T_Double},{"bool",T_Bool},{"string",T_String},{"null",T_Null},{"class",T_Class},{"extends",T_Extends},{"this",T_This},{"interface",T_Interface},{"implements",T_Implements},{"while",T_While},{"for",T_For},{"if",T_If},{"else",T_Else},{"return",T_Return},{"break",T_Break},{"New",T_New},{"NewArray",T_NewArray},{"Print",T_Print},{"ReadInteger",T_ReadInteger},{"ReadLine",T_ReadLine},{"switch",T_Switch},{"case",T_Case},{"default",T_Default},{0,0}};
+int yylex(){ load();
+ for(;;){ if(pos>=src.size()) return 0; char c=src[pos];
+  if(c=='\n'){curLine++;curCol=1;pos++;continue;}
+  if(c==' '||c=='\r'){curCol++;pos++;continue;}
+  if(c=='\t'){curCol+=8-curCol%8+1;pos++;continue;}
+  if(src.compare(pos,2,"/*")==0){ size_t e=src.find("*/",pos+2); if(e==std::string::npos){ReportError::UntermComment();return 0;} for(size_t i=pos;i<e+2;i++){ if(src[i]=='\n'){curLine++;curCol=1;} else curCol++;} pos=e+2; continue;}
+  if(src.compare(pos,2,"//")==0){ while(pos<src.size()&&src[pos]!='\n') pos++; continue;}
+  break; }
+ const char* two[]={"<=",">=","==","!=","&&","||","++","--","[]"}; int tt[]={T_LessEqual,T_GreaterEqual,T_Equal,T_NotEqual,T_And,T_Or,T_Incr,T_Decr,T_Dims};
+ char c=src[pos];
+ if(isalpha(c)){ size_t e=pos; while(e<src.size()&&(isalnum(src[e])||src[e]=='_')) e++; std::string w=src.substr(pos,e-pos);
+   for(int i=0;kws[i].s;i++) if(w==kws[i].s) return ret(kws[i].t,w.size());
+   if(w=="true"||w=="false"){ yylval.boolConstant=(w[0]=='t'); return ret(T_BoolConstant,w.size());}
+   strncpy(yylval.identifier,w.c_str(),MaxIdentLen); yylval.identifier[MaxIdentLen]=0; return ret(T_Identifier,w.size()); }
+ if(isdigit(c)){ size_t e=pos;
+   if(c=='0'&&pos+2<=src.size()&&(src[pos+1]=='x'||src[pos+1]=='X')&&isxdigit(src[pos+2])){ e=pos+2; while(e<src.size()&&isxdigit(src[e])) e++; yylval.integerConstant=strtol(src.substr(pos,e-pos).c_str(),NULL,16); return ret(T_IntConstant,e-pos);}
+   while(e<src.size()&&isdigit(src[e])) e++;
+   if(e<src.size()&&src[e]=='.'){ e++; while(e<src.size()&&isdigit(src[e])) e++; if(e<src.size()&&(src[e]=='e'||src[e]=='E')){ size_t f=e+1; if(f<src.size()&&(src[f]=='+'||src[f]=='-')) f++; if(f<src.size()&&isdigit(src[f])){ while(f<src.size()&&isdigit(src[f])) f++; e=f;}} yylval.doubleConstant=atof(src.substr(pos,e-pos).c_str()); return ret(T_DoubleConstant,e-pos);}
+   yylval.integerConstant=strtol(src.substr(pos,e-pos).c_str(),NULL,10); return ret(T_IntConstant,e-pos);}
+ if(c=='"'){ size_t e=pos+1; while(e<src.size()&&src[e]!='"'&&src[e]!='\n') e++; if(e<src.size()&&src[e]=='"'){ yylval.stringConstant=strdup(src.substr(pos,e+1-pos).c_str()); return ret(T_StringConstant,e+1-pos);} ret(0,e-pos); ReportError::UntermString(&yylloc,yytext); return yylex(); }
+ for(int i=0;i<9;i++) if(src.compare(pos,2,two[i])==0) return ret(tt[i],2);
+ if(strchr("-+/*%=.,:;!<>()[]{}",c)) return ret(c,1);
+ ret(0,1); ReportError::UnrecogChar(&yylloc,c); return yylex();
+}
@@ -15,11 +15,15 @@ CodeGenerator *CG = new CodeGenerator();
 Node::Node(yyltype loc) {
     location = new yyltype(loc);
     parent = NULL;
+    expr_type = NULL;
+    emit_loc = NULL;
 }
 
 Node::Node() {
     location = NULL;
     parent = NULL;
+    expr_type = NULL;
+    emit_loc = NULL;
 }
 
 /* The Print method is used to print the parse tree nodes.
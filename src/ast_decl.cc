@@ -96,6 +96,7 @@ ClassDecl::ClassDecl(Identifier *n, NamedType *ex, List<NamedType*> *imp, List<D
     (members=m)->SetParentAll(this);
     instance_size = 4;
     vtable_size = 0;
+    subclasses = new List<ClassDecl*>;
 }
 
 void ClassDecl::PrintChildren(int indentLevel) {
@@ -297,6 +298,10 @@ void ClassDecl::AssignOffset() {
     // add all parents' methods.
     var_members = new List<VarDecl*>;
     methods = new List<FnDecl*>;
+    if (extends) {
+        ClassDecl *p = dynamic_cast<ClassDecl*>(extends->GetId()->GetDecl());
+        if (p) p->subclasses->Append(this);
+    }
     ClassDecl *c = this;
     while (c) {
         c->AddMembersToList(var_members, methods);
@@ -351,6 +356,15 @@ void ClassDecl::AssignOffset() {
     }
 }
 
+FnDecl *ClassDecl::GetUniqueMethod(int offset) {
+    FnDecl *fn = methods->Nth(offset / 4);
+    for (int i = 0; i < subclasses->NumElements(); i++) {
+        if (subclasses->Nth(i)->GetUniqueMethod(offset) != fn)
+            return NULL;
+    }
+    return fn;
+}
+
 void ClassDecl::AddPrefixToMethods() {
     // add prefix to method names.
     for (int i = 0; i < members->NumElements(); i++) {
@@ -550,9 +564,12 @@ void FnDecl::Emit() {
     // BeginFunc will reset the FP offset counter.
     BeginFunc *f = CG->GenBeginFunc();
 
+    List<Location*> *params = new List<Location*>;
+
     // Add 4 to the offset of the 1st param for class member.
     if (d && d->IsClassDecl()) {
         CG->GetNextParamLoc();
+        params->Append(CG->ThisPtr);
     }
 
     // Generate all the Locations for formals.
@@ -566,7 +583,9 @@ void FnDecl::Emit() {
         Location *l = new Location(fpRelative, CG->GetNextParamLoc(),
                 v->GetId()->GetIdName());
         v->SetEmitLoc(l);
+        params->Append(l);
     }
+    f->SetParams(params);
 
     if (body) body->Emit();
 
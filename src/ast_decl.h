@@ -94,6 +94,7 @@ class ClassDecl : public Decl
     int vtable_size;
     List<VarDecl*> *var_members;
     List<FnDecl*> *methods;
+    List<ClassDecl*> *subclasses; // the classes extending this one
     void CheckDecl();
     void CheckInherit();
 
@@ -116,6 +117,10 @@ class ClassDecl : public Decl
     int GetVTableSize() { return vtable_size; }
     void AddMembersToList(List<VarDecl*> *vars, List<FnDecl*> *fns);
     void AddPrefixToMethods();
+    // The method in the vtable slot at offset of this class and of all
+    // its subclasses, or NULL if a subclass overrides it. Valid once
+    // AssignOffset was called for every class.
+    FnDecl *GetUniqueMethod(int offset);
 };
 
 class InterfaceDecl : public Decl
@@ -9,6 +9,38 @@
 #include <string.h>
 #include "errors.h"
 
+// The comparison testing the opposite of opStr
+static const char *NegatedOpStr(const char *opStr) {
+    static const char *negated[][2] = {
+        {"==", "!="}, {"!=", "=="}, {"<", ">="},
+        {"<=", ">"}, {">", "<="}, {">=", "<"}
+    };
+    for (size_t i = 0; i < sizeof(negated) / sizeof(negated[0]); i++)
+        if (!strcmp(negated[i][0], opStr)) return negated[i][1];
+    Failure("Unrecognized comparison: '%s'\n", opStr);
+    return NULL;
+}
+
+// Branches to label when the boolean t is value
+static void GenBranch(Location *t, const char *label, bool value) {
+    if (value) t = CG->GenBinaryOp("==", t, CG->GenLoadConstant(0));
+    CG->GenIfZ(t, label);
+}
+
+// Branches to label when l opStr r is value
+static void GenCompareBranch(const char *opStr, Location *l, Location *r,
+                             const char *label, bool value) {
+    // IfZ branches when the comparison fails, that is when its
+    // opposite holds
+    if (value) opStr = NegatedOpStr(opStr);
+    CG->GenIfZ(CG->GenBinaryOp(opStr, l, r), label);
+}
+
+void Expr::EmitBranch(const char *label, bool value) {
+    Emit();
+    GenBranch(GetEmitLocDeref(), label, value);
+}
+
 void EmptyExpr::PrintChildren(int indentLevel) {
     if (expr_type) std::cout << " <" << expr_type << ">";
     if (emit_loc) emit_loc->Print();
@@ -79,6 +111,10 @@ void BoolConstant::Emit() {
     emit_loc = CG->GenLoadConstant(value ? 1 : 0);
 }
 
+void BoolConstant::EmitBranch(const char *label, bool value) {
+    if (this->value == value) CG->GenGoto(label);
+}
+
 StringConstant::StringConstant(yyltype loc, const char *val) : Expr(loc) {
     Assert(val != NULL);
     value = strdup(val);
@@ -242,6 +278,14 @@ void RelationalExpr::Emit() {
             right->GetEmitLocDeref());
 }
 
+void RelationalExpr::EmitBranch(const char *label, bool value) {
+    left->Emit();
+    right->Emit();
+
+    GenCompareBranch(op->GetOpStr(), left->GetEmitLocDeref(),
+            right->GetEmitLocDeref(), label, value);
+}
+
 void EqualityExpr::CheckType() {
     left->Check(E_CheckType);
     op->Check(E_CheckType);
@@ -299,6 +343,24 @@ void EqualityExpr::Emit() {
     }
 }
 
+void EqualityExpr::EmitBranch(const char *label, bool value) {
+    left->Emit();
+    right->Emit();
+
+    Type *tl = left->GetType();
+    Type *tr = right->GetType();
+
+    if (tl == tr && tl == Type::stringType) {
+        // s1 != s2 is value when s1 == s2 is not.
+        Location *t = CG->GenBuiltInCall(StringEqual,
+                left->GetEmitLocDeref(), right->GetEmitLocDeref());
+        GenBranch(t, label, value == !strcmp(op->GetOpStr(), "=="));
+    } else {
+        GenCompareBranch(op->GetOpStr(), left->GetEmitLocDeref(),
+                right->GetEmitLocDeref(), label, value);
+    }
+}
+
 void LogicalExpr::CheckType() {
     if (left) left->Check(E_CheckType);
     op->Check(E_CheckType);
@@ -340,16 +402,41 @@ void LogicalExpr::Check(checkT c) {
 }
 
 void LogicalExpr::Emit() {
-    if (left) left->Emit();
-    right->Emit();
-
-    if (left) {
-        emit_loc = CG->GenBinaryOp(op->GetOpStr(), left->GetEmitLocDeref(),
-                right->GetEmitLocDeref());
-    } else {
+    if (!left) {
+        right->Emit();
         // use 0 == bool_var to compute !bool_var.
         emit_loc = CG->GenBinaryOp("==", CG->GenLoadConstant(0),
                 right->GetEmitLocDeref());
+        return;
+    }
+
+    // short-circuit: a && b is false, and a || b is true, without
+    // evaluating b when a is.
+    bool isOr = !strcmp(op->GetOpStr(), "||");
+    const char *l0 = CG->NewLabel();
+    emit_loc = CG->GenLoadConstant(isOr ? 1 : 0);
+    left->EmitBranch(l0, isOr);
+    right->Emit();
+    CG->GenAssign(emit_loc, right->GetEmitLocDeref());
+    CG->GenLabel(l0);
+}
+
+void LogicalExpr::EmitBranch(const char *label, bool value) {
+    if (!left) {
+        right->EmitBranch(label, !value);
+        return;
+    }
+
+    // a decides a && b when it is false, and a || b when it is true.
+    bool decides = !strcmp(op->GetOpStr(), "||");
+    if (value == decides) {
+        left->EmitBranch(label, value);
+        right->EmitBranch(label, value);
+    } else {
+        const char *l0 = CG->NewLabel();
+        left->EmitBranch(l0, decides);
+        right->EmitBranch(label, value);
+        CG->GenLabel(l0);
     }
 }
 
@@ -729,6 +816,19 @@ void Call::Check(checkT c) {
     }
 }
 
+// The class of the objects the method is called on: the static type of
+// the base, or the class of the method making the call without base
+ClassDecl *Call::ReceiverClass() {
+    if (!base) {
+        Node *n = this;
+        while (n && !dynamic_cast<ClassDecl*>(n))
+            n = n->GetParent();
+        return dynamic_cast<ClassDecl*>(n);
+    }
+    NamedType *t = dynamic_cast<NamedType*>(base->GetType());
+    return t ? dynamic_cast<ClassDecl*>(t->GetId()->GetDecl()) : NULL;
+}
+
 void Call::Emit() {
     PrintDebug("tac+", "Emit Call %s.", field->GetIdName());
     // TODO: in class scope, methon without base should be ACall.
@@ -758,24 +858,43 @@ void Call::Emit() {
         this_loc = CG->ThisPtr; // in a class scope.
     }
 
+    // Class hierarchy analysis: when no subclass of the class of the
+    // receiver overrides the method, the call needs no vtable.
+    FnDecl *method = NULL;
+    if (is_ACall && fn->IsClassMember()
+        && IsFlagOn("devirtualize", GetOptimizationLevel() >= 1)) {
+        ClassDecl *c = ReceiverClass();
+        if (c) method = c->GetUniqueMethod(fn->GetVTableOffset());
+    }
+
     Location *t;
-    if (is_ACall) {
+    if (is_ACall && !method) {
         t = CG->GenLoad(this_loc, 0);
         t = CG->GenLoad(t, fn->GetVTableOffset());
     }
 
+    // Dereference all the actuals first so that the PushParams of the
+    // call are contiguous.
+    List<Location*> args;
+    for (int i = 0; i < actuals->NumElements(); i++) {
+        args.Append(actuals->Nth(i)->GetEmitLocDeref());
+    }
+
     // PushParam
-    for (int i = actuals->NumElements() - 1; i >= 0; i--) {
-        Location *l = actuals->Nth(i)->GetEmitLocDeref();
-        CG->GenPushParam(l);
+    for (int i = args.NumElements() - 1; i >= 0; i--) {
+        CG->GenPushParam(args.Nth(i));
     }
 
     // generate call.
     if (is_ACall) {
         // Push this.
         CG->GenPushParam(this_loc);
-        // ACall
-        emit_loc = CG->GenACall(t, fn->HasReturnValue());
+        // ACall, or LCall of the only method the call can reach
+        if (method)
+            emit_loc = CG->GenLCall(method->GetId()->GetIdName(),
+                                    fn->HasReturnValue());
+        else
+            emit_loc = CG->GenACall(t, fn->HasReturnValue());
         // PopParams
         CG->GenPopParams(actuals->NumElements() * 4 + 4);
     } else {
@@ -25,6 +25,7 @@
 
 class NamedType; // for new
 class Type; // for NewArray
+class ClassDecl; // for Call
 
 
 class Expr : public Stmt
@@ -36,6 +37,9 @@ class Expr : public Stmt
     // code generation
     virtual Location * GetEmitLocDeref() { return GetEmitLoc(); }
     virtual bool IsArrayAccessRef() { return false; }
+    // jumping code: branches to label when the value is value, and
+    // falls through otherwise
+    virtual void EmitBranch(const char *label, bool value);
     virtual bool IsEmptyExpr() { return false; }
 };
 
@@ -67,6 +71,7 @@ class IntConstant : public Expr
 
     // code generation
     void Emit();
+    int GetValue() { return value; }
 };
 
 class DoubleConstant : public Expr
@@ -99,6 +104,7 @@ class BoolConstant : public Expr
 
     // code generation
     void Emit();
+    void EmitBranch(const char *label, bool value);
 };
 
 class StringConstant : public Expr
@@ -184,6 +190,7 @@ class RelationalExpr : public CompoundExpr
 
     // code generation
     void Emit();
+    void EmitBranch(const char *label, bool value);
 };
 
 class EqualityExpr : public CompoundExpr
@@ -198,6 +205,7 @@ class EqualityExpr : public CompoundExpr
 
     // code generation
     void Emit();
+    void EmitBranch(const char *label, bool value);
 };
 
 class LogicalExpr : public CompoundExpr
@@ -213,6 +221,7 @@ class LogicalExpr : public CompoundExpr
 
     // code generation
     void Emit();
+    void EmitBranch(const char *label, bool value);
 };
 
 class AssignExpr : public CompoundExpr
@@ -307,6 +316,7 @@ class Call : public Expr
     void CheckDecl();
     void CheckType();
     void CheckFuncArgs();
+    ClassDecl *ReceiverClass();
 
   public:
     Call(yyltype loc, Expr *base, Identifier *field, List<Expr*> *args);
@@ -191,11 +191,9 @@ void ForStmt::Emit() {
 
     const char *l0 = CG->NewLabel();
     CG->GenLabel(l0);
-    test->Emit();
-    Location *t0 = test->GetEmitLocDeref();
     const char *l1 = CG->NewLabel();
     end_loop_label = l1;
-    CG->GenIfZ(t0, l1);
+    test->EmitBranch(l1, false);
 
     body->Emit();
     step->Emit();
@@ -241,11 +239,9 @@ void WhileStmt::Emit() {
     const char *l0 = CG->NewLabel();
     CG->GenLabel(l0);
 
-    test->Emit();
-    Location *t0 = test->GetEmitLocDeref();
     const char *l1 = CG->NewLabel();
     end_loop_label = l1;
-    CG->GenIfZ(t0, l1);
+    test->EmitBranch(l1, false);
 
     body->Emit();
     CG->GenGoto(l0);
@@ -309,10 +305,8 @@ void IfStmt::Check(checkT c) {
 }
 
 void IfStmt::Emit() {
-    test->Emit();
-    Location *t0 = test->GetEmitLocDeref();
     const char *l0 = CG->NewLabel();
-    CG->GenIfZ(t0, l0);
+    test->EmitBranch(l0, false);
 
     body->Emit();
     const char *l1 = CG->NewLabel();
@@ -421,31 +415,21 @@ void SwitchStmt::Emit() {
 
     Location *switch_value = expr->GetEmitLocDeref();
 
-    // here use a series of if instead of an address table.
     // case statement is optional, default statement is optional.
-    // default statement is always at the end of the cases list.
+    // default statement is always at the end of the cases list; without
+    // it, a value matching no case skips the switch.
+    std::vector<SwitchCase> values;
+    const char *default_label = end_switch_label;
     for (int i = 0; i < cases->NumElements(); i++) {
         CaseStmt *c = cases->Nth(i);
-
-        // get case label.
         c->GenCaseLabel();
-        const char *cl = c->GetCaseLabel();
-
-        // get case value.
         IntConstant *cv = c->GetCaseValue();
-
-        // gen branches.
-        if (cv) {
-            // case
-            cv->Emit();
-            Location *cvl = cv->GetEmitLocDeref();
-            Location *t = CG->GenBinaryOp("!=", switch_value, cvl);
-            CG->GenIfZ(t, cl);
-        } else {
-            // default
-            CG->GenGoto(cl);
-        }
+        if (cv)
+            values.push_back(SwitchCase(cv->GetValue(), c->GetCaseLabel()));
+        else
+            default_label = c->GetCaseLabel();
     }
+    CG->GenSwitch(switch_value, values, default_label);
 
     // emit case statements.
     cases->EmitAll();
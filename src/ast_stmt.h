@@ -176,6 +176,7 @@ class CaseStmt : public Stmt
 
     void BuildST();
     void Check(checkT c);
+    bool IsCaseStmt() { return true; }
 
     // code generation
     void Emit();
@@ -0,0 +1,631 @@
+/* File: bce.cc
+ * ------------
+ * Implementation of bounds check elimination.
+ */
+
+#include <algorithm>
+#include <limits.h>
+#include <string.h>
+#include "bce.h"
+#include "codegen.h"
+#include "utility.h"
+
+static const int LengthOffset = -4;     // where NewArray stores the length
+static const int MaxRounds = 3;         // before weakening bounds are dropped
+
+typedef std::map<std::pair<Location*, Location*>, int> UpperMap;
+
+bool Ranges::operator!=(const Ranges &r) const {
+    return lower != r.lower || upper != r.upper || lengthOf != r.lengthOf
+        || copyOf != r.copyOf || stored != r.stored || fields != r.fields;
+}
+
+BoundsCheckEliminator::BoundsCheckEliminator(FlowGraph &g)
+  : graph(g), out(g.NumBlocks()), reached(g.NumBlocks(), false),
+    rounds(g.NumBlocks(), 0), numChecks(0), numRemoved(0) {}
+
+template <class Key>
+static void EraseMentions(std::map<Key, Location*> &m, Location *loc) {
+    typename std::map<Key, Location*>::iterator l = m.begin();
+    while (l != m.end()) {
+        if (l->second == loc)
+            m.erase(l++);
+        else
+            ++l;
+    }
+}
+
+// Forgets everything known about loc
+void BoundsCheckEliminator::Kill(Ranges &ranges, Location *loc) {
+    ranges.lower.erase(loc);
+    UpperMap::iterator u = ranges.upper.begin();
+    while (u != ranges.upper.end()) {
+        if (u->first.first == loc || u->first.second == loc)
+            ranges.upper.erase(u++);
+        else
+            ++u;
+    }
+    ranges.lengthOf.erase(loc);
+    ranges.copyOf.erase(loc);
+    ranges.stored.erase(loc);
+    EraseMentions(ranges.lengthOf, loc);
+    EraseMentions(ranges.copyOf, loc);
+    EraseMentions(ranges.stored, loc);
+    EraseMentions(ranges.fields, loc);
+}
+
+// The location x is known to be a copy of, or x itself
+static Location *Original(const Ranges &ranges, Location *x) {
+    std::map<Location*, Location*>::const_iterator c = ranges.copyOf.find(x);
+    return c == ranges.copyOf.end() ? x : c->second;
+}
+
+// Records that dst now holds the value of src
+static void Copy(Ranges &ranges, Location *dst, Location *src) {
+    if (Original(ranges, src) != dst)
+        ranges.copyOf[dst] = Original(ranges, src);
+}
+
+static void RaiseLower(Ranges &ranges, Location *x, long long c) {
+    if (c < INT_MIN || c > INT_MAX) return;
+    std::map<Location*, int>::iterator l = ranges.lower.find(x);
+    if (l == ranges.lower.end())
+        ranges.lower[x] = c;
+    else if (c > l->second)
+        l->second = c;
+}
+
+// Records x < y + k, keeping the tighter bound
+static void LowerUpper(Ranges &ranges, Location *x, Location *y,
+                       long long k) {
+    if (k < INT_MIN || k > INT_MAX) return;
+    std::pair<Location*, Location*> key(x, y);
+    UpperMap::iterator u = ranges.upper.find(key);
+    if (u == ranges.upper.end())
+        ranges.upper[key] = k;
+    else if (k < u->second)
+        u->second = k;
+}
+
+// Whether x + c is computed without overflow: x has a lower bound far
+// enough from INT_MIN when c < 0, and an upper bound when c > 0, either
+// x < y + k with k + c <= 1 (so x + c <= y) or x < k with k + c - 1 no
+// more than INT_MAX
+static bool AddsSafely(const Ranges &ranges, Location *x, int c) {
+    if (c == 0) return true;
+    if (c < 0) {
+        std::map<Location*, int>::const_iterator l = ranges.lower.find(x);
+        return l != ranges.lower.end() && (long long)l->second + c >= INT_MIN;
+    }
+    UpperMap::const_iterator u =
+        ranges.upper.lower_bound(std::make_pair(x, (Location*)NULL));
+    for (; u != ranges.upper.end() && u->first.first == x; ++u) {
+        long long most = u->first.second ? 1 : (long long)INT_MAX + 1;
+        if ((long long)u->second + c <= most) return true;
+    }
+    return false;
+}
+
+void BoundsCheckEliminator::Transfer(Instruction *instr, Ranges &ranges) {
+    // a Store may write through a copy of any pointer, this included, and
+    // a call may store anywhere unless it is built in
+    if (Store *st = dynamic_cast<Store*>(instr)) {
+        ranges.stored.clear();
+        ranges.fields.erase(st->GetOffset());
+        bool tracked = FlowGraph::IsTracked(st->GetValue());
+        if (tracked && st->GetOffset() == 0
+            && FlowGraph::IsTracked(st->GetReference()))
+            ranges.stored[st->GetReference()] = st->GetValue();
+        if (tracked && st->GetReference() == CodeGenerator::ThisPtr)
+            ranges.fields[st->GetOffset()] = st->GetValue();
+        return;
+    }
+    if (FlowGraph::IsCall(instr)) {
+        ranges.stored.clear();
+        LCall *call = dynamic_cast<LCall*>(instr);
+        if (!call || !CodeGenerator::IsBuiltIn(call->GetLabel()))
+            ranges.fields.clear();
+    }
+    Location *dst = instr->GetDst();
+    if (!FlowGraph::IsTracked(dst)) return;
+    Ranges before = ranges;
+    Kill(ranges, dst);
+    if (LoadConstant *lc = dynamic_cast<LoadConstant*>(instr)) {
+        ranges.lower[dst] = lc->GetValue();
+        LowerUpper(ranges, dst, NULL, (long long)lc->GetValue() + 1);
+        return;
+    }
+    if (Load *ld = dynamic_cast<Load*>(instr)) {
+        if (ld->GetReference() == CodeGenerator::ThisPtr
+            && ld->GetReference() != dst) {
+            std::map<int, Location*>::iterator f =
+                before.fields.find(ld->GetOffset());
+            if (f != before.fields.end() && f->second != dst)
+                Copy(ranges, dst, f->second);
+            else
+                ranges.fields[ld->GetOffset()] = dst;
+        }
+        if (ld->GetOffset() == LengthOffset
+            && FlowGraph::IsTracked(ld->GetReference())
+            && ld->GetReference() != dst) {
+            ranges.lengthOf[dst] = ld->GetReference();
+            ranges.lower[dst] = 1;
+        }
+        return;
+    }
+
+    // dst = src + c, with the bounds of src before the instruction
+    Location *src = NULL;
+    int c = 0;
+    if (Assign *a = dynamic_cast<Assign*>(instr)) {
+        src = a->GetSrc();
+    } else if (BinaryOp *b = dynamic_cast<BinaryOp*>(instr)) {
+        if (b->GetOp2() || (b->GetOpCode() != BinaryOp::Add
+                            && b->GetOpCode() != BinaryOp::Sub))
+            return;
+        src = b->GetOp1();
+        if (b->GetImmediate() == INT_MIN) return;
+        c = b->GetOpCode() == BinaryOp::Add ? b->GetImmediate()
+                                            : -b->GetImmediate();
+    }
+    if (!src) return;
+    // the array made by NewArray starts after the size it stores
+    if (c == 4 && before.stored.count(src) && before.stored[src] != dst)
+        ranges.lengthOf[before.stored[src]] = dst;
+    if (!AddsSafely(before, src, c)) return;
+    std::map<Location*, int>::iterator l = before.lower.find(src);
+    if (l != before.lower.end())
+        RaiseLower(ranges, dst, (long long)l->second + c);
+    UpperMap::iterator u =
+        before.upper.lower_bound(std::make_pair(src, (Location*)NULL));
+    for (; u != before.upper.end() && u->first.first == src; ++u)
+        if (u->first.second != dst)
+            LowerUpper(ranges, dst, u->first.second,
+                       (long long)u->second + c);
+    if (c == 0 && src != dst) {
+        Copy(ranges, dst, src);
+        if (before.lengthOf.count(src))
+            ranges.lengthOf[dst] = before.lengthOf[src];
+    }
+}
+
+template <class Key>
+static void MeetEqual(std::map<Key, Location*> &m,
+                      const std::map<Key, Location*> &other) {
+    typename std::map<Key, Location*>::iterator n = m.begin();
+    while (n != m.end()) {
+        typename std::map<Key, Location*>::const_iterator o =
+            other.find(n->first);
+        if (o == other.end() || o->second != n->second)
+            m.erase(n++);
+        else
+            ++n;
+    }
+}
+
+// Keeps in ranges what other also knows, at its weaker bound
+void BoundsCheckEliminator::Meet(Ranges &ranges, const Ranges &other) {
+    std::map<Location*, int>::iterator l = ranges.lower.begin();
+    while (l != ranges.lower.end()) {
+        std::map<Location*, int>::const_iterator o =
+            other.lower.find(l->first);
+        if (o == other.lower.end()) {
+            ranges.lower.erase(l++);
+            continue;
+        }
+        if (o->second < l->second) l->second = o->second;
+        ++l;
+    }
+    UpperMap::iterator u = ranges.upper.begin();
+    while (u != ranges.upper.end()) {
+        UpperMap::const_iterator o = other.upper.find(u->first);
+        if (o == other.upper.end()) {
+            ranges.upper.erase(u++);
+            continue;
+        }
+        if (o->second > u->second) u->second = o->second;
+        ++u;
+    }
+    MeetEqual(ranges.lengthOf, other.lengthOf);
+    MeetEqual(ranges.copyOf, other.copyOf);
+    MeetEqual(ranges.stored, other.stored);
+    MeetEqual(ranges.fields, other.fields);
+}
+
+// Drops the bounds of ranges weaker than they were in old, on the
+// locations written in the loop
+void BoundsCheckEliminator::Widen(Ranges &ranges, const Ranges &old,
+                                  const LocationSet &written) {
+    std::map<Location*, int>::iterator l = ranges.lower.begin();
+    while (l != ranges.lower.end()) {
+        std::map<Location*, int>::const_iterator o = old.lower.find(l->first);
+        if (o != old.lower.end() && l->second < o->second
+            && written.count(l->first))
+            ranges.lower.erase(l++);
+        else
+            ++l;
+    }
+    UpperMap::iterator u = ranges.upper.begin();
+    while (u != ranges.upper.end()) {
+        UpperMap::const_iterator o = old.upper.find(u->first);
+        if (o != old.upper.end() && u->second > o->second
+            && (written.count(u->first.first)
+                || written.count(u->first.second)))
+            ranges.upper.erase(u++);
+        else
+            ++u;
+    }
+}
+
+// The last instruction of b before its branch writing t, provided
+// nothing after it in b writes its operands; NULL if there is none
+static Instruction *DefiningInstruction(BasicBlock *b, Location *t) {
+    int end = b->code.size() - 1;
+    int d = end - 1;
+    while (d >= 0 && b->code[d]->GetDst() != t)
+        d--;
+    if (d < 0) return NULL;
+    std::vector<Location*> srcs;
+    b->code[d]->GetSrcs(srcs);
+    for (int i = d + 1; i < end; i++)
+        for (size_t s = 0; s < srcs.size(); s++)
+            if (b->code[i]->GetDst() == srcs[s]) return NULL;
+    return b->code[d];
+}
+
+static BinaryOp::OpCode Negate(BinaryOp::OpCode code) {
+    switch (code) {
+        case BinaryOp::Lt: return BinaryOp::Ge;
+        case BinaryOp::Le: return BinaryOp::Gt;
+        case BinaryOp::Gt: return BinaryOp::Le;
+        case BinaryOp::Ge: return BinaryOp::Lt;
+        default: return code;
+    }
+}
+
+// Adds to ranges what follows from t (computed in b) being value
+void BoundsCheckEliminator::Learn(BasicBlock *b, Location *t, bool value,
+                                  Ranges &ranges) {
+    BinaryOp *op = dynamic_cast<BinaryOp*>(DefiningInstruction(b, t));
+    if (!op) return;
+    BinaryOp::OpCode code = op->GetOpCode();
+    Location *x = op->GetOp1(), *y = op->GetOp2();
+    if (code == BinaryOp::Or || code == BinaryOp::And) {
+        if (value == (code == BinaryOp::And)) {
+            Learn(b, x, value, ranges);
+            Learn(b, y, value, ranges);
+        }
+        return;
+    }
+    if ((code == BinaryOp::Eq || code == BinaryOp::Ne) && !y
+        && op->GetImmediate() == 0) {
+        Learn(b, x, value != (code == BinaryOp::Eq), ranges);
+        return;
+    }
+    if (code < BinaryOp::Lt || code > BinaryOp::Ge) return;
+    if (!value) code = Negate(code);
+    if (!FlowGraph::IsTracked(x) || (y && !FlowGraph::IsTracked(y))) return;
+    if (!y) {
+        int c = op->GetImmediate();
+        if (code == BinaryOp::Ge) RaiseLower(ranges, x, c);
+        if (code == BinaryOp::Gt) RaiseLower(ranges, x, (long long)c + 1);
+        if (code == BinaryOp::Lt) LowerUpper(ranges, x, NULL, c);
+        if (code == BinaryOp::Le)
+            LowerUpper(ranges, x, NULL, (long long)c + 1);
+        return;
+    }
+    // x < y + k, with k 0 for < and 1 for <=
+    if (code == BinaryOp::Gt || code == BinaryOp::Ge) std::swap(x, y);
+    int k = code == BinaryOp::Lt || code == BinaryOp::Gt ? 0 : 1;
+    LowerUpper(ranges, x, y, k);
+    if (ranges.lower.count(x))
+        RaiseLower(ranges, y, (long long)ranges.lower[x] + 1 - k);
+}
+
+// Whether x and y hold the length of the same array
+static bool SameLength(const Ranges &ranges, Location *x, Location *y) {
+    if (x == y) return true;
+    std::map<Location*, Location*>::const_iterator a = ranges.lengthOf.find(x);
+    std::map<Location*, Location*>::const_iterator b = ranges.lengthOf.find(y);
+    return a != ranges.lengthOf.end() && b != ranges.lengthOf.end()
+        && Original(ranges, a->second) == Original(ranges, b->second);
+}
+
+// The best lower bound of y, taking the other locations holding the
+// same length into account; false if there is none
+static bool LowerOf(const Ranges &ranges, Location *y, long long &least) {
+    bool found = false;
+    std::map<Location*, int>::const_iterator l = ranges.lower.begin();
+    for (; l != ranges.lower.end(); ++l) {
+        if ((l->first == y || SameLength(ranges, l->first, y))
+            && (!found || l->second > least)) {
+            least = l->second;
+            found = true;
+        }
+    }
+    return found;
+}
+
+// Whether ranges make sure that t (computed in b) is value
+bool BoundsCheckEliminator::Prove(BasicBlock *b, Location *t, bool value,
+                                  const Ranges &ranges) {
+    BinaryOp *op = dynamic_cast<BinaryOp*>(DefiningInstruction(b, t));
+    if (!op) return false;
+    BinaryOp::OpCode code = op->GetOpCode();
+    Location *x = op->GetOp1(), *y = op->GetOp2();
+    if (code == BinaryOp::Or || code == BinaryOp::And) {
+        if (value == (code == BinaryOp::And))
+            return Prove(b, x, value, ranges) && Prove(b, y, value, ranges);
+        return Prove(b, x, value, ranges) || Prove(b, y, value, ranges);
+    }
+    if ((code == BinaryOp::Eq || code == BinaryOp::Ne) && !y
+        && op->GetImmediate() == 0)
+        return Prove(b, x, value != (code == BinaryOp::Eq), ranges);
+    if (code < BinaryOp::Lt || code > BinaryOp::Ge) return false;
+    if (!value) code = Negate(code);
+    int c = op->GetImmediate();
+    if (!y && (code == BinaryOp::Ge || code == BinaryOp::Gt)) {
+        std::map<Location*, int>::const_iterator l = ranges.lower.find(x);
+        return l != ranges.lower.end()
+            && (long long)l->second >= (long long)c + (code == BinaryOp::Gt);
+    }
+    // x < y + k, with k 0 for < and 1 for <= (and y NULL for a constant)
+    if (code == BinaryOp::Gt || code == BinaryOp::Ge) std::swap(x, y);
+    long long k = code == BinaryOp::Lt || code == BinaryOp::Gt ? 0 : 1;
+    if (!y) k += c;
+    long long least;
+    bool bounded = y && LowerOf(ranges, y, least);
+    UpperMap::const_iterator u =
+        ranges.upper.lower_bound(std::make_pair(x, (Location*)NULL));
+    for (; u != ranges.upper.end() && u->first.first == x; ++u) {
+        Location *z = u->first.second;
+        if ((z && y && u->second <= k && SameLength(ranges, z, y))
+            || (!z && !y && u->second <= k)
+            || (!z && bounded && u->second <= least + k))
+            return true;
+    }
+    return false;
+}
+
+// The IfZ ending b, if it has one
+static IfZ *BranchOf(BasicBlock *b) {
+    return dynamic_cast<IfZ*>(b->code.back());
+}
+
+// The ranges on the edge from -> to: those at the end of from, with
+// what its branch tells
+void BoundsCheckEliminator::Edge(BasicBlock *from, BasicBlock *to,
+                                 Ranges &ranges) {
+    ranges = out[from->id];
+    IfZ *ifz = BranchOf(from);
+    if (!ifz || from->succs.size() != 2 || from->succs[0] == from->succs[1])
+        return;
+    Learn(from, ifz->GetTest(), to != from->succs[0], ranges);
+}
+
+// Whether b reports a runtime error, ending with a call to _Halt
+static bool IsErrorPath(BasicBlock *b) {
+    for (size_t i = 0; i < b->code.size(); i++) {
+        LCall *call = dynamic_cast<LCall*>(b->code[i]);
+        if (call && !strcmp(call->GetLabel(), "_Halt")) return true;
+    }
+    return false;
+}
+
+// The ranges at the start of b: the meet of its edges in, leaving out
+// the error paths, which fall into the next block but never get there
+void BoundsCheckEliminator::In(BasicBlock *b, Ranges &ranges) {
+    ranges = Ranges();
+    bool first = true;
+    for (size_t p = 0; p < b->preds.size(); p++) {
+        BasicBlock *pred = b->preds[p];
+        if (!reached[pred->id] || IsErrorPath(pred)) continue;
+        Ranges edge;
+        Edge(pred, b, edge);
+        if (first)
+            ranges = edge;
+        else
+            Meet(ranges, edge);
+        first = false;
+    }
+}
+
+// Finds the loops and the locations written in each
+void BoundsCheckEliminator::FindLoops() {
+    graph.FindLoops(loops);
+    for (size_t l = 0; l < loops.size(); l++) {
+        LocationSet &written = loopWrites[loops[l].header];
+        std::set<BasicBlock*>::iterator b;
+        for (b = loops[l].body.begin(); b != loops[l].body.end(); ++b)
+            for (size_t i = 0; i < (*b)->code.size(); i++)
+                if ((*b)->code[i]->GetDst())
+                    written.insert((*b)->code[i]->GetDst());
+    }
+}
+
+void BoundsCheckEliminator::Solve() {
+    graph.ComputeDominators();
+    FindLoops();
+    const std::vector<BasicBlock*> &order = graph.ReversePostorder();
+    std::vector<Ranges> in(graph.NumBlocks());
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 0; i < order.size(); i++) {
+            BasicBlock *b = order[i];
+            Ranges ranges;
+            In(b, ranges);
+            if (reached[b->id] && rounds[b->id] >= MaxRounds
+                && loopWrites.count(b))
+                Widen(ranges, in[b->id], loopWrites[b]);
+            if (reached[b->id] && !(ranges != in[b->id])) continue;
+            in[b->id] = ranges;
+            for (size_t j = 0; j < b->code.size(); j++)
+                Transfer(b->code[j], ranges);
+            reached[b->id] = true;
+            rounds[b->id]++;
+            out[b->id] = ranges;
+            changed = true;
+        }
+    }
+}
+
+// The ranges on the edges entering loop, met
+void BoundsCheckEliminator::Entering(const Loop &loop, Ranges &ranges) {
+    ranges = Ranges();
+    bool first = true;
+    BasicBlock *h = loop.header;
+    for (size_t p = 0; p < h->preds.size(); p++) {
+        BasicBlock *pred = h->preds[p];
+        if (loop.body.count(pred) || !reached[pred->id] || IsErrorPath(pred))
+            continue;
+        Ranges edge;
+        Edge(pred, h, edge);
+        if (first)
+            ranges = edge;
+        else
+            Meet(ranges, edge);
+        first = false;
+    }
+}
+
+// The BinaryOp computing t in b with the given operation and second
+// operand (the immediate imm if op2 is NULL); NULL if there is none
+static BinaryOp *Computing(BasicBlock *b, Location *t, BinaryOp::OpCode code,
+                           Location *op2, int imm) {
+    BinaryOp *op = dynamic_cast<BinaryOp*>(DefiningInstruction(b, t));
+    if (!op || op->GetOpCode() != code || op->GetOp2() != op2
+        || (!op2 && op->GetImmediate() != imm))
+        return NULL;
+    return op;
+}
+
+// Plans the guard of the check ending b, which ranges do not prove. The
+// check has the form ArrayAccess::Emit gives it,
+//     t1 = i < 0 ; n = *(a + -4) ; t2 = i < n ; t3 = t2 == 0 ;
+//     t4 = t1 || t3 ; IfZ t4 Goto ok
+// where the Load may have been replaced by a copy of an earlier one; the
+// ranges prove i >= 0 and bound i above by a constant or a location the
+// loop around b does not write, and the length of a, which the loop does
+// not write either, is known where the loop is entered.
+bool BoundsCheckEliminator::PlanGuard(BasicBlock *b, const Ranges &ranges,
+                                      Guard &guard) {
+    Location *test = BranchOf(b)->GetTest();
+    BinaryOp *any = dynamic_cast<BinaryOp*>(DefiningInstruction(b, test));
+    if (!any || any->GetOpCode() != BinaryOp::Or) return false;
+    BinaryOp *below = Computing(b, any->GetOp1(), BinaryOp::Lt, NULL, 0);
+    BinaryOp *above = Computing(b, any->GetOp2(), BinaryOp::Eq, NULL, 0);
+    if (!below || !above || !Prove(b, any->GetOp1(), false, ranges))
+        return false;
+    Location *i = below->GetOp1();
+    BinaryOp *within = dynamic_cast<BinaryOp*>(
+        DefiningInstruction(b, above->GetOp1()));
+    if (!within || within->GetOpCode() != BinaryOp::Lt
+        || within->GetOp1() != i || !within->GetOp2())
+        return false;
+    std::map<Location*, Location*>::const_iterator lengthOf =
+        ranges.lengthOf.find(within->GetOp2());
+    if (lengthOf == ranges.lengthOf.end()) return false;
+    Location *array = lengthOf->second;
+
+    for (size_t l = 0; l < loops.size(); l++) {
+        const Loop &loop = loops[l];
+        LocationSet &written = loopWrites[loop.header];
+        if (!loop.body.count(b) || written.count(array)) continue;
+        if (!graph.CanInsertPreheader(loop)) return false;
+        Ranges entering;
+        Entering(loop, entering);
+        guard.length = NULL;
+        std::map<Location*, Location*>::iterator n;
+        for (n = entering.lengthOf.begin(); n != entering.lengthOf.end(); ++n)
+            if (Original(entering, n->second) == Original(entering, array))
+                guard.length = n->first;
+        if (!guard.length) return false;
+
+        // i < bound + k, so the check cannot fail unless
+        // length < bound + k, that is length < bound for k <= 0 and
+        // length <= bound for k = 1
+        UpperMap::const_iterator u =
+            ranges.upper.lower_bound(std::make_pair(i, (Location*)NULL));
+        for (; u != ranges.upper.end() && u->first.first == i; ++u) {
+            Location *bound = u->first.second;
+            if (bound && (written.count(bound) || u->second > 1)) continue;
+            UpperMap::const_iterator most =
+                entering.upper.find(std::make_pair(guard.length, bound));
+            if (!bound && most != entering.upper.end()
+                && most->second <= u->second)
+                continue;       // the guard would always be 1
+            guard.check = b;
+            guard.start = std::find(b->code.begin(), b->code.end(), below)
+                - b->code.begin();
+            guard.loop = l;
+            guard.bound = bound;
+            guard.code = bound && u->second == 1 ? BinaryOp::Le : BinaryOp::Lt;
+            guard.imm = u->second;
+            return true;
+        }
+        return false;
+    }
+    return false;
+}
+
+// Computes the guards in the preheaders of their loops, and has each
+// check branch past its comparisons when its guard is 0
+void BoundsCheckEliminator::InsertGuards() {
+    BeginFunc *begin = dynamic_cast<BeginFunc*>(graph.GetEntry()->code[1]);
+    std::map<int, BasicBlock*> preheaders;
+    for (size_t g = 0; g < guards.size(); g++) {
+        Guard &guard = guards[g];
+        if (!preheaders.count(guard.loop))
+            preheaders[guard.loop] = graph.InsertPreheader(loops[guard.loop]);
+        BasicBlock *pre = preheaders[guard.loop];
+        Location *mayFail = CodeGenerator::NewTempVar(begin);
+        if (guard.bound)
+            pre->code.push_back(new BinaryOp(guard.code, mayFail,
+                                             guard.length, guard.bound));
+        else
+            pre->code.push_back(new BinaryOp(guard.code, mayFail,
+                                             guard.length, guard.imm));
+
+        BasicBlock *check = guard.check, *ok = check->succs[0];
+        const char *label = BranchOf(check)->branch_label();
+        BasicBlock *test = graph.SplitBlock(check, guard.start);
+        test->code.push_back(new IfZ(mayFail, label));
+        graph.AddEdge(test, ok);
+        graph.AddEdge(test, check);
+    }
+}
+
+void BoundsCheckEliminator::Rewrite() {
+    for (int i = 0; i < graph.NumBlocks(); i++) {
+        BasicBlock *b = graph.GetBlock(i);
+        IfZ *ifz = BranchOf(b);
+        if (!reached[i] || !ifz || b->succs.size() != 2
+            || !IsErrorPath(b->succs[1]) || b->succs[0] == b->succs[1])
+            continue;
+        numChecks++;
+        if (!Prove(b, ifz->GetTest(), false, out[i])) {
+            Guard guard;
+            if (PlanGuard(b, out[i], guard)) guards.push_back(guard);
+            continue;
+        }
+        b->code.back() = new Goto(ifz->branch_label());
+        delete ifz;
+        graph.RemoveEdge(b, b->succs[1]);
+        numRemoved++;
+    }
+    InsertGuards();
+    graph.RemoveUnreachableBlocks();
+    PrintDebug("bce", "%s: %d checks, %d removed, %d guarded",
+               graph.GetName(), numChecks, numRemoved, (int)guards.size());
+}
+
+void EliminateBoundsChecks(std::list<Instruction*> &code,
+                           std::list<Instruction*>::iterator begin,
+                           std::list<Instruction*>::iterator end) {
+    FlowGraph graph(begin, end);
+    BoundsCheckEliminator eliminator(graph);
+    eliminator.Solve();
+    eliminator.Rewrite();
+    graph.WriteBack(code, begin, end);
+}
@@ -0,0 +1,126 @@
+/* File: bce.h
+ * -----------
+ * Bounds check elimination on the flow graph of one function.
+ *
+ * ArrayAccess::Emit checks each subscript before using it, and branches
+ * to a block reporting the error (and calling _Halt) when the subscript
+ * is negative or not below the length of the array; NewArray checks its
+ * size the same way. A check is removed when the values it compares are
+ * known to keep it from failing: it becomes a Goto past the error block,
+ * which is then deleted, and the comparisons feeding it are left to dead
+ * code elimination (see dce.h).
+ *
+ * What is known is found by a forward dataflow analysis over ranges:
+ * at each point, a constant lower bound for some tracked locations
+ * (x >= c), upper bounds relating two of them or one to a constant
+ * (x < y + k, x < k), the locations holding the length of an array,
+ * which is at least 1 and never changes (see NewArray), and the copies
+ * of a location, so that a.length() loaded twice, or a field of this
+ * loaded again after nothing could have stored to it, is known to be
+ * the same value. The bounds come from the constants loaded, from adding
+ * a constant to a location with known bounds (as long as that cannot
+ * overflow), from the length Loads (offset -4) and the size NewArray
+ * stores in front of a new array, and from the branches: each edge out
+ * of an IfZ knows whether its test, and the comparisons, &&, || and !
+ * computed into it in the same block, held. A loop such as
+ * for (i = 0; i < a.length(); i = i + 1) thus knows 0 <= i < a.length()
+ * in its body, and a check that passed knows the same of its subscript
+ * for the checks that follow. The error blocks are left out of the
+ * joins, as they never reach the block they fall into. Meeting at a
+ * join keeps the weaker bound of each kind; after a few rounds at a loop
+ * header a bound on a location the loop writes that is still weakening
+ * is dropped, so that a loop counting down forever does not keep the
+ * analysis going.
+ *
+ * A check in a loop that cannot be removed gets a guard instead when
+ * its subscript is known not to be negative and to be below a bound the
+ * loop does not write (such as the n of i < n, or a constant), and the
+ * length of an array the loop does not write is known where the loop is
+ * entered: the preheader of the loop compares the two once, telling
+ * whether the check can fail at all. The check itself is not moved out
+ * of the loop, since the error must still be reported at the iteration
+ * where it occurs; instead a branch on the guard skips its comparisons
+ * when it cannot fail.
+ */
+
+#ifndef _H_bce
+#define _H_bce
+
+#include <list>
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+#include "tac.h"
+#include "cfg.h"
+
+// What is known of the values of the tracked locations at a point
+struct Ranges {
+    std::map<Location*, int> lower;     // x >= lower[x]
+    std::map<std::pair<Location*, Location*>, int> upper;  // x < y + k
+                                                // (x < k if y is NULL)
+    std::map<Location*, Location*> lengthOf;   // x = the length of array y
+    std::map<Location*, Location*> copyOf;     // x = y
+    std::map<Location*, Location*> stored;     // *(x) = y
+    std::map<int, Location*> fields;           // *(this + k) = y
+
+    bool operator!=(const Ranges &r) const;
+};
+
+class BoundsCheckEliminator
+{
+  private:
+    FlowGraph &graph;
+    std::vector<Ranges> out;            // the ranges at the end of a block
+    std::vector<bool> reached;
+    std::vector<int> rounds;            // the times a block has changed
+    std::map<BasicBlock*, LocationSet> loopWrites;  // for each loop header
+    std::vector<Loop> loops;
+    int numChecks, numRemoved;
+
+    // A check that may fail inside a loop, and the comparison before the
+    // loop telling whether it can (length code bound, with bound NULL
+    // for the constant imm)
+    struct Guard {
+        BasicBlock *check;
+        size_t start;           // the first instruction of the check
+        int loop;
+        Location *length, *bound;
+        BinaryOp::OpCode code;
+        int imm;
+    };
+    std::vector<Guard> guards;
+
+    void FindLoops();
+    void In(BasicBlock *b, Ranges &ranges);
+    void Entering(const Loop &loop, Ranges &ranges);
+    void Edge(BasicBlock *from, BasicBlock *to, Ranges &ranges);
+    void Learn(BasicBlock *b, Location *t, bool value, Ranges &ranges);
+    bool Prove(BasicBlock *b, Location *t, bool value, const Ranges &ranges);
+    bool PlanGuard(BasicBlock *b, const Ranges &ranges, Guard &guard);
+    void InsertGuards();
+
+    static void Kill(Ranges &ranges, Location *loc);
+    static void Transfer(Instruction *instr, Ranges &ranges);
+    static void Meet(Ranges &ranges, const Ranges &other);
+    static void Widen(Ranges &ranges, const Ranges &old,
+                      const LocationSet &written);
+
+  public:
+    BoundsCheckEliminator(FlowGraph &graph);
+
+    // Computes the ranges at the end of every block
+    void Solve();
+
+    // Removes the checks that cannot fail, and hoists the others
+    // when possible
+    void Rewrite();
+};
+
+// The function pass: removes the bounds checks of the function
+// [begin, end) that cannot fail
+void EliminateBoundsChecks(std::list<Instruction*> &code,
+                           std::list<Instruction*>::iterator begin,
+                           std::list<Instruction*>::iterator end);
+
+#endif
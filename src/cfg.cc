@@ -0,0 +1,421 @@
+/* File: cfg.cc
+ * ------------
+ * Implementation of the FlowGraph class.
+ */
+
+#include <algorithm>
+#include <string.h>
+#include "cfg.h"
+#include "codegen.h"
+#include "isel.h"
+#include "utility.h"
+
+FlowGraph::FlowGraph(std::list<Instruction*>::iterator begin,
+                     std::list<Instruction*>::iterator end) {
+    Label *first = dynamic_cast<Label*>(*begin);
+    Assert(first != NULL);
+    name = first->text();
+
+    // split into blocks, remembering which block each label starts
+    BasicBlock *cur = NULL;
+    bool endsBlock = false;
+    for (std::list<Instruction*>::iterator p = begin; p != end; ++p) {
+        Instruction *instr = *p;
+        Label *label = dynamic_cast<Label*>(instr);
+        if (cur == NULL || endsBlock || label) {
+            cur = new BasicBlock(blocks.size());
+            blocks.push_back(cur);
+        }
+        if (label) blockForLabel[label->text()] = cur;
+        cur->code.push_back(instr);
+        Instruction *root = TreeInstruction::RootOf(instr);
+        endsBlock = dynamic_cast<Goto*>(root) || dynamic_cast<IfZ*>(root)
+            || dynamic_cast<IfCmp*>(root) || dynamic_cast<JumpTable*>(root)
+            || dynamic_cast<Return*>(root) || dynamic_cast<TailCall*>(root);
+    }
+
+    // link blocks to their successors
+    for (size_t i = 0; i < blocks.size(); i++) {
+        BasicBlock *b = blocks[i];
+        Instruction *last = TreeInstruction::RootOf(b->code.back());
+        BasicBlock *next = i + 1 < blocks.size() ? blocks[i+1] : NULL;
+        if (Goto *g = dynamic_cast<Goto*>(last)) {
+            AddEdge(b, blockForLabel[g->branch_label()]);
+        } else if (IfZ *ifz = dynamic_cast<IfZ*>(last)) {
+            AddEdge(b, blockForLabel[ifz->branch_label()]);
+            if (next) AddEdge(b, next);
+        } else if (IfCmp *ifc = dynamic_cast<IfCmp*>(last)) {
+            AddEdge(b, blockForLabel[ifc->branch_label()]);
+            if (next) AddEdge(b, next);
+        } else if (JumpTable *jt = dynamic_cast<JumpTable*>(last)) {
+            List<const char*> *labels = jt->GetLabels();
+            for (int l = 0; l < labels->NumElements(); l++) {
+                BasicBlock *to = blockForLabel[labels->Nth(l)];
+                if (std::find(b->succs.begin(), b->succs.end(), to)
+                    == b->succs.end())
+                    AddEdge(b, to);
+            }
+        } else if (!dynamic_cast<Return*>(last)
+                   && !dynamic_cast<TailCall*>(last) && next) {
+            AddEdge(b, next);
+        }
+    }
+}
+
+FlowGraph::~FlowGraph() {
+    for (size_t i = 0; i < blocks.size(); i++)
+        delete blocks[i];
+}
+
+void FlowGraph::AddEdge(BasicBlock *from, BasicBlock *to) {
+    Assert(to != NULL);
+    from->succs.push_back(to);
+    to->preds.push_back(from);
+}
+
+BasicBlock *FlowGraph::GetBlockForLabel(const char *label) {
+    Assert(blockForLabel.count(label));
+    return blockForLabel[label];
+}
+
+void FlowGraph::RemoveEdge(BasicBlock *from, BasicBlock *to) {
+    std::vector<BasicBlock*>::iterator s =
+        std::find(from->succs.begin(), from->succs.end(), to);
+    std::vector<BasicBlock*>::iterator p =
+        std::find(to->preds.begin(), to->preds.end(), from);
+    Assert(s != from->succs.end() && p != to->preds.end());
+    from->succs.erase(s);
+    to->preds.erase(p);
+}
+
+void FlowGraph::RedirectEdge(BasicBlock *from, BasicBlock *to,
+                             BasicBlock *newTo) {
+    std::vector<BasicBlock*>::iterator s =
+        std::find(from->succs.begin(), from->succs.end(), to);
+    std::vector<BasicBlock*>::iterator p =
+        std::find(to->preds.begin(), to->preds.end(), from);
+    Assert(s != from->succs.end() && p != to->preds.end());
+    *s = newTo;
+    to->preds.erase(p);
+    newTo->preds.push_back(from);
+}
+
+BasicBlock *FlowGraph::InsertBlockBefore(BasicBlock *b, Label *label) {
+    BasicBlock *block = new BasicBlock(b->id);
+    if (label) {
+        block->code.push_back(label);
+        blockForLabel[label->text()] = block;
+    }
+    blocks.insert(blocks.begin() + b->id, block);
+    for (size_t i = b->id; i < blocks.size(); i++)
+        blocks[i]->id = i;
+    return block;
+}
+
+// Returns a branch like instr to label to instead of from
+static Instruction *Retarget(Instruction *instr, const char *from,
+                             const char *to) {
+    if (dynamic_cast<Goto*>(instr))
+        return new Goto(to);
+    if (IfZ *ifz = dynamic_cast<IfZ*>(instr))
+        return new IfZ(ifz->GetTest(), to);
+    if (JumpTable *jt = dynamic_cast<JumpTable*>(instr)) {
+        List<const char*> *labels = new List<const char*>(*jt->GetLabels());
+        JumpTable *retargeted =
+            new JumpTable(jt->GetIndex(), jt->GetFirst(), labels);
+        retargeted->ReplaceLabel(from, to);
+        return retargeted;
+    }
+    IfCmp *ifc = dynamic_cast<IfCmp*>(instr);
+    Assert(ifc != NULL);
+    return new IfCmp(ifc->GetOpCode(), ifc->GetOp1(), ifc->GetOp2(),
+                     ifc->GetImmediate(), to);
+}
+
+// Whether instr branches to label
+static bool BranchesTo(Instruction *instr, const char *label) {
+    if (JumpTable *jt = dynamic_cast<JumpTable*>(instr)) {
+        List<const char*> *labels = jt->GetLabels();
+        for (int i = 0; i < labels->NumElements(); i++)
+            if (!strcmp(labels->Nth(i), label)) return true;
+        return false;
+    }
+    const char *target = NULL;
+    if (Goto *g = dynamic_cast<Goto*>(instr)) target = g->branch_label();
+    if (IfZ *ifz = dynamic_cast<IfZ*>(instr)) target = ifz->branch_label();
+    if (IfCmp *ifc = dynamic_cast<IfCmp*>(instr)) target = ifc->branch_label();
+    return target && !strcmp(target, label);
+}
+
+// Whether control falls from the end of b into the block laid out next
+static bool FallsThrough(BasicBlock *b) {
+    Instruction *last = b->code.back();
+    return !dynamic_cast<Goto*>(last) && !dynamic_cast<JumpTable*>(last)
+        && !dynamic_cast<Return*>(last) && !dynamic_cast<TailCall*>(last);
+}
+
+BasicBlock *FlowGraph::SplitBlock(BasicBlock *b, int i) {
+    Label *label = i > 0 ? dynamic_cast<Label*>(b->code[0]) : NULL;
+    BasicBlock *first = InsertBlockBefore(b, label);
+    first->code.insert(first->code.end(), b->code.begin() + (label ? 1 : 0),
+                       b->code.begin() + i);
+    b->code.erase(b->code.begin(), b->code.begin() + i);
+    std::vector<BasicBlock*> preds = b->preds;
+    for (size_t p = 0; p < preds.size(); p++)
+        RedirectEdge(preds[p], b, first);
+    return first;
+}
+
+bool FlowGraph::CanInsertPreheader(const Loop &loop) const {
+    BasicBlock *h = loop.header;
+    return h != blocks[0] && !(loop.body.count(blocks[h->id - 1])
+                               && FallsThrough(blocks[h->id - 1]));
+}
+
+BasicBlock *FlowGraph::InsertPreheader(const Loop &loop) {
+    Assert(CanInsertPreheader(loop));
+    BasicBlock *h = loop.header;
+    Label *hl = dynamic_cast<Label*>(h->code[0]);
+    std::vector<BasicBlock*> entering;
+    std::vector<bool> branches;     // whether it branches to the header
+    bool branchedTo = false;
+    for (size_t p = 0; p < h->preds.size(); p++) {
+        BasicBlock *b = h->preds[p];
+        if (loop.body.count(b)) continue;
+        entering.push_back(b);
+        branches.push_back(hl && BranchesTo(b->code.back(), hl->text()));
+        branchedTo = branchedTo || branches.back();
+    }
+    Label *label = NULL;
+    if (branchedTo) label = new Label(CodeGenerator::NewLabel());
+    BasicBlock *pre = InsertBlockBefore(h, label);
+    for (size_t p = 0; p < entering.size(); p++) {
+        Instruction *&branch = entering[p]->code.back();
+        if (branches[p]) {
+            Instruction *retargeted =
+                Retarget(branch, hl->text(), label->text());
+            delete branch;
+            branch = retargeted;
+        }
+        RedirectEdge(entering[p], h, pre);
+    }
+    AddEdge(pre, h);
+    return pre;
+}
+
+void FlowGraph::RemoveUnreachableBlocks() {
+    ComputeDominators();
+    Instruction *endFunc = NULL;
+    std::vector<BasicBlock*> kept, dead;
+    for (size_t i = 0; i < blocks.size(); i++)
+        (blocks[i]->IsReachable() ? kept : dead).push_back(blocks[i]);
+
+    // a dead block may branch to another dead block, so the edges into
+    // the blocks kept are unlinked before any block is deleted
+    for (size_t i = 0; i < dead.size(); i++) {
+        BasicBlock *b = dead[i];
+        for (size_t s = 0; s < b->succs.size(); s++) {
+            std::vector<BasicBlock*> &preds = b->succs[s]->preds;
+            if (b->succs[s]->IsReachable())
+                preds.erase(std::find(preds.begin(), preds.end(), b));
+        }
+    }
+    for (size_t i = 0; i < dead.size(); i++) {
+        BasicBlock *b = dead[i];
+        Label *label = dynamic_cast<Label*>(b->code[0]);
+        if (label) blockForLabel.erase(label->text());
+        for (size_t j = 0; j < b->code.size(); j++) {
+            if (dynamic_cast<EndFunc*>(b->code[j]))
+                endFunc = b->code[j];
+            else
+                delete b->code[j];
+        }
+        delete b;
+    }
+    if (endFunc) kept.back()->code.push_back(endFunc);
+    blocks = kept;
+    for (size_t i = 0; i < blocks.size(); i++)
+        blocks[i]->id = i;
+    ComputeDominators();
+}
+
+void FlowGraph::WriteBack(std::list<Instruction*> &code,
+                          std::list<Instruction*>::iterator begin,
+                          std::list<Instruction*>::iterator end) {
+    Assert(*begin == blocks[0]->code[0]);
+    std::list<Instruction*>::iterator p = begin;
+    code.erase(++p, end);
+    for (size_t i = 0; i < blocks.size(); i++) {
+        BasicBlock *b = blocks[i];
+        code.insert(end, b->code.begin() + (i == 0 ? 1 : 0), b->code.end());
+    }
+}
+
+bool FlowGraph::IsTracked(Location *loc) {
+    return loc != NULL && loc->GetSegment() == fpRelative
+        && loc->GetBase() == NULL;
+}
+
+bool FlowGraph::IsCall(Instruction *instr) {
+    return dynamic_cast<LCall*>(instr) || dynamic_cast<ACall*>(instr);
+}
+
+void FlowGraph::TransferLive(Instruction *instr, LocationSet &live) {
+    Location *dst = instr->GetDst();
+    if (dst) live.erase(dst);
+    std::vector<Location*> srcs;
+    instr->GetSrcs(srcs);
+    for (size_t i = 0; i < srcs.size(); i++)
+        if (IsTracked(srcs[i])) live.insert(srcs[i]);
+}
+
+void FlowGraph::ComputeLiveness() {
+    for (size_t i = 0; i < blocks.size(); i++) {
+        blocks[i]->liveIn.clear();
+        blocks[i]->liveOut.clear();
+    }
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int i = blocks.size() - 1; i >= 0; i--) {
+            BasicBlock *b = blocks[i];
+            LocationSet live;
+            for (size_t s = 0; s < b->succs.size(); s++)
+                live.insert(b->succs[s]->liveIn.begin(),
+                            b->succs[s]->liveIn.end());
+            b->liveOut = live;
+            for (int j = b->code.size() - 1; j >= 0; j--)
+                TransferLive(b->code[j], live);
+            if (live != b->liveIn) {
+                b->liveIn = live;
+                changed = true;
+            }
+        }
+    }
+}
+
+void FlowGraph::ComputeLoopDepth() {
+    for (size_t i = 0; i < blocks.size(); i++)
+        blocks[i]->loopDepth = 0;
+    for (size_t i = 0; i < blocks.size(); i++) {
+        BasicBlock *b = blocks[i];
+        for (size_t s = 0; s < b->succs.size(); s++) {
+            int head = b->succs[s]->id;
+            if (head <= b->id)
+                for (int j = head; j <= b->id; j++)
+                    blocks[j]->loopDepth++;
+        }
+    }
+}
+
+void FlowGraph::NumberPostorder(BasicBlock *b,
+                                std::vector<BasicBlock*> &order) {
+    b->rpo = 0;     // visited
+    for (size_t s = 0; s < b->succs.size(); s++)
+        if (b->succs[s]->rpo < 0)
+            NumberPostorder(b->succs[s], order);
+    order.push_back(b);
+}
+
+// Walks up from a and b to their closest common dominator
+BasicBlock *FlowGraph::Intersect(BasicBlock *a, BasicBlock *b) {
+    while (a != b) {
+        while (a->rpo > b->rpo) a = a->idom;
+        while (b->rpo > a->rpo) b = b->idom;
+    }
+    return a;
+}
+
+void FlowGraph::ComputeDominators() {
+    for (size_t i = 0; i < blocks.size(); i++) {
+        blocks[i]->rpo = -1;
+        blocks[i]->idom = NULL;
+        blocks[i]->domChildren.clear();
+    }
+    std::vector<BasicBlock*> post;
+    NumberPostorder(GetEntry(), post);
+    rpoOrder.assign(post.rbegin(), post.rend());
+    for (size_t i = 0; i < rpoOrder.size(); i++)
+        rpoOrder[i]->rpo = i;
+
+    BasicBlock *entry = GetEntry();
+    entry->idom = entry;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 1; i < rpoOrder.size(); i++) {
+            BasicBlock *b = rpoOrder[i], *idom = NULL;
+            for (size_t p = 0; p < b->preds.size(); p++) {
+                BasicBlock *pred = b->preds[p];
+                if (pred->idom == NULL) continue;   // not processed yet
+                idom = idom ? Intersect(pred, idom) : pred;
+            }
+            if (idom != b->idom) {
+                b->idom = idom;
+                changed = true;
+            }
+        }
+    }
+    entry->idom = NULL;
+    for (size_t i = 1; i < rpoOrder.size(); i++)
+        rpoOrder[i]->idom->domChildren.push_back(rpoOrder[i]);
+}
+
+static bool BySize(const Loop &a,
+                   const Loop &b) {
+    return a.body.size() < b.body.size();
+}
+
+void FlowGraph::FindLoops(std::vector<Loop> &loops) {
+    loops.clear();
+    std::map<BasicBlock*, int> loopFor;     // the loop of each header
+    for (int i = 0; i < NumBlocks(); i++) {
+        BasicBlock *b = blocks[i];
+        for (size_t s = 0; s < b->succs.size(); s++) {
+            BasicBlock *h = b->succs[s];
+            if (!Dominates(h, b)) continue;
+            if (!loopFor.count(h)) {
+                loopFor[h] = loops.size();
+                loops.push_back(Loop());
+                loops.back().header = h;
+                loops.back().body.insert(h);
+            }
+            std::set<BasicBlock*> &body = loops[loopFor[h]].body;
+            std::vector<BasicBlock*> stack(1, b);
+            while (!stack.empty()) {
+                BasicBlock *x = stack.back();
+                stack.pop_back();
+                if (!x->IsReachable() || !body.insert(x).second) continue;
+                stack.insert(stack.end(), x->preds.begin(), x->preds.end());
+            }
+        }
+    }
+    std::stable_sort(loops.begin(), loops.end(), BySize);
+}
+
+
+bool FlowGraph::Dominates(BasicBlock *a, BasicBlock *b) {
+    if (!a->IsReachable() || !b->IsReachable()) return false;
+    while (b != NULL && b->rpo >= a->rpo) {
+        if (b == a) return true;
+        b = b->idom;
+    }
+    return false;
+}
+
+void FlowGraph::Print() {
+    printf("+++ (cfg): %s\n", name);
+    for (size_t i = 0; i < blocks.size(); i++) {
+        BasicBlock *b = blocks[i];
+        printf("  B%d (%d instructions, loop depth %d)", b->id,
+               (int)b->code.size(), b->loopDepth);
+        if (!b->IsReachable())
+            printf(" unreachable");
+        else if (b->idom)
+            printf(" idom B%d", b->idom->id);
+        printf(" ->");
+        for (size_t s = 0; s < b->succs.size(); s++)
+            printf(" B%d", b->succs[s]->id);
+        printf("\n");
+    }
+}
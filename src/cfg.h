@@ -0,0 +1,173 @@
+/* File: cfg.h
+ * -----------
+ * The FlowGraph class divides the Tac instructions of one function
+ * into basic blocks and links each block to its successors and
+ * predecessors. It is the starting point for the analyses done by
+ * the back end on a whole function, such as the liveness analysis
+ * needed for global register allocation.
+ *
+ * A function is the sequence of instructions from the Label naming
+ * it up to (and including) its EndFunc. The first block starts with
+ * that Label and the BeginFunc. A new block starts at each Label and
+ * after each Goto, IfZ, IfCmp, JumpTable, Return and TailCall. Other
+ * calls do not end a block.
+ * A TreeInstruction (see isel.h) ends a block when its root does.
+ *
+ * The dominator tree is computed on demand with the iterative algorithm
+ * of Cooper, Harvey and Kennedy ("A Simple, Fast Dominance Algorithm"):
+ * the immediate dominators are refined in reverse postorder until they
+ * no longer change. Blocks that cannot be reached from the entry have
+ * no immediate dominator and are not in the tree.
+ *
+ * A pass that changes the code of the blocks, or adds and removes
+ * edges and blocks, writes the graph back into the instruction list with
+ * WriteBack, which lays the blocks out in their current order.
+ */
+
+#ifndef _H_cfg
+#define _H_cfg
+
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "tac.h"
+
+typedef std::set<Location*> LocationSet;
+
+class BasicBlock
+{
+  public:
+    int id;
+    std::vector<Instruction*> code;
+    std::vector<BasicBlock*> succs, preds;
+
+    // filled in by FlowGraph::ComputeLiveness
+    LocationSet liveIn, liveOut;
+
+    // filled in by FlowGraph::ComputeLoopDepth
+    int loopDepth;
+
+    // filled in by FlowGraph::ComputeDominators: the immediate dominator
+    // (NULL for the entry and unreachable blocks), the blocks it
+    // immediately dominates and the position in reverse postorder (-1
+    // if unreachable)
+    BasicBlock *idom;
+    std::vector<BasicBlock*> domChildren;
+    int rpo;
+
+    BasicBlock(int n) : id(n), loopDepth(0), idom(NULL), rpo(-1) {}
+
+    bool IsReachable() const { return rpo >= 0; }
+};
+
+// A natural loop: the header h of the back edges b -> h, where h
+// dominates b, and the blocks reaching some such b backward without
+// going through h
+struct Loop {
+    BasicBlock *header;
+    std::set<BasicBlock*> body;
+};
+
+class FlowGraph
+{
+  private:
+    const char *name;
+    std::vector<BasicBlock*> blocks;
+    std::vector<BasicBlock*> rpoOrder;
+    std::map<std::string, BasicBlock*> blockForLabel;
+
+    void NumberPostorder(BasicBlock *b, std::vector<BasicBlock*> &order);
+    BasicBlock *Intersect(BasicBlock *a, BasicBlock *b);
+
+  public:
+    // Builds the graph from the instructions [begin, end) of one function
+    FlowGraph(std::list<Instruction*>::iterator begin,
+              std::list<Instruction*>::iterator end);
+    ~FlowGraph();
+
+    const char *GetName() const                { return name; }
+    int NumBlocks() const                      { return blocks.size(); }
+    BasicBlock *GetBlock(int i) const          { return blocks[i]; }
+    BasicBlock *GetEntry() const               { return blocks[0]; }
+    BasicBlock *GetBlockForLabel(const char *label);
+
+    // Adds the edge from -> to, or removes it (it must exist)
+    void AddEdge(BasicBlock *from, BasicBlock *to);
+    void RemoveEdge(BasicBlock *from, BasicBlock *to);
+
+    // Makes the edge from -> to go to newTo instead, keeping its place
+    // among the successors of from
+    void RedirectEdge(BasicBlock *from, BasicBlock *to, BasicBlock *newTo);
+
+    // Inserts a new block without edges before b in the layout, starting
+    // with label unless it is NULL. Renumbers the blocks.
+    BasicBlock *InsertBlockBefore(BasicBlock *b, Label *label);
+
+    // Moves the instructions of b before the i-th (and its Label) into
+    // a new block laid out before b, which takes over the edges into b.
+    // The new block has no edges out: the caller ends it and adds them.
+    BasicBlock *SplitBlock(BasicBlock *b, int i);
+
+    // Inserts the preheader of loop before its header: a block the edges
+    // entering the loop go through, with a new label if some of them are
+    // branches, which are retargeted to it. It cannot be inserted when
+    // the header is the entry, or the block laid out before the header
+    // is in the loop and falls into it.
+    bool CanInsertPreheader(const Loop &loop) const;
+    BasicBlock *InsertPreheader(const Loop &loop);
+
+    // Deletes the blocks that cannot be reached from the entry, with
+    // their instructions except for the EndFunc, which moves to the end
+    // of the last block left. Renumbers the blocks.
+    void RemoveUnreachableBlocks();
+
+    // Replaces the instructions [begin, end) the graph was built from
+    // with the code of its blocks in order. The Label at begin stays.
+    void WriteBack(std::list<Instruction*> &code,
+                   std::list<Instruction*>::iterator begin,
+                   std::list<Instruction*>::iterator end);
+
+    // Computes liveIn/liveOut of every block by iterating the backward
+    // dataflow equations to a fixed point.
+    void ComputeLiveness();
+
+    // Computes the loop nesting depth of every block. A branch back to
+    // an earlier block closes a loop that contains all the blocks laid
+    // out from the branch target to the branch, which is exact for the
+    // structured loops generated for Decaf.
+    void ComputeLoopDepth();
+
+    // Computes the immediate dominator of every block, and the reachable
+    // blocks in reverse postorder (a block comes before its successors
+    // except along back edges).
+    void ComputeDominators();
+    const std::vector<BasicBlock*> &ReversePostorder() const
+        { return rpoOrder; }
+
+    // Finds the natural loops, taking the loops sharing a header as one,
+    // and sorts them innermost (smallest) first. Needs ComputeDominators.
+    void FindLoops(std::vector<Loop> &loops);
+
+    // Whether every path from the entry to b goes through a (a block
+    // dominates itself). Needs ComputeDominators.
+    static bool Dominates(BasicBlock *a, BasicBlock *b);
+
+    // Prints the blocks with their successors and immediate dominators,
+    // for the debug key "cfg"
+    void Print();
+
+    // Only fp-relative locations (params, locals and temps) take part in
+    // the dataflow analyses. Globals may be read or written by any call,
+    // so they always stay in memory.
+    static bool IsTracked(Location *loc);
+
+    // Updates live (the set of locations live after instr) to the set
+    // live before it.
+    static void TransferLive(Instruction *instr, LocationSet &live);
+
+    static bool IsCall(Instruction *instr);
+};
+
+#endif
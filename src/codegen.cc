@@ -7,8 +7,14 @@
 
 #include "codegen.h"
 #include <string.h>
+#include <limits.h>
+#include <algorithm>
+#include <map>
 #include "tac.h"
 #include "mips.h"
+#include "cfg.h"
+#include "regalloc.h"
+#include "passes.h"
 
 Location* CodeGenerator::ThisPtr = new Location(fpRelative, 4, "this");
 
@@ -52,8 +58,9 @@ char *CodeGenerator::NewLabel() {
     return strdup(temp);
 }
 
+static int nextTempNum;
+
 Location *CodeGenerator::GenTempVar() {
-    static int nextTempNum;
     char temp[10];
     Location *result = NULL;
     sprintf(temp, "_tmp%d", nextTempNum++);
@@ -66,6 +73,18 @@ Location *CodeGenerator::GenTempVar() {
     return result;
 }
 
+Location *CodeGenerator::NewTempVar(BeginFunc *begin) {
+    char temp[10];
+    sprintf(temp, "_tmp%d", nextTempNum++);
+    return NewLocalVar(begin, temp);
+}
+
+Location *CodeGenerator::NewLocalVar(BeginFunc *begin, const char *name) {
+    int frameSize = begin->GetFrameSize();
+    begin->SetFrameSize(frameSize + VarSize);
+    return new Location(fpRelative, OffsetToFirstLocal - frameSize, name);
+}
+
 Location *CodeGenerator::GenLoadConstant(int value) {
     Location *result = GenTempVar();
     code.push_back(new LoadConstant(result, value));
@@ -120,6 +139,123 @@ void CodeGenerator::GenGoto(const char *label) {
     code.push_back(new Goto(label));
 }
 
+// The ways to find the case of a switch value among a range of cases
+typedef enum { SearchLinear, SearchBinary, SearchTable } SwitchPlan;
+
+// The costs in instructions: comparing the value with a constant takes a
+// slti or li and a branch (only the branch for 0), and a JumpTable a sll,
+// a lw and a jr, after a comparison for each bound of its range that is
+// not already known
+static int CompareCost(int value) {
+    return value == 0 ? 1 : 2;
+}
+static const int TableCost = 3;
+static const int MaxLinearCases = 3;
+static const int MaxEntriesPerCase = 4;     // the sparsest table
+
+static bool CaseBefore(const SwitchCase &a, const SwitchCase &b) {
+    return a.first < b.first;
+}
+
+static bool SameCase(const SwitchCase &a, const SwitchCase &b) {
+    return a.first == b.first;
+}
+
+// The average cost of finding the case of a value known to be in
+// [low, high] among cases [lo, hi), and the plan reaching it
+static double SwitchCost(const std::vector<SwitchCase> &cases, int lo,
+                         int hi, long long low, long long high,
+                         SwitchPlan *plan) {
+    int n = hi - lo;
+    long long first = cases[lo].first, last = cases[hi - 1].first;
+    double best = -1;
+    if (n <= MaxLinearCases) {
+        int cost = 0, sum = 0;
+        for (int i = lo; i < hi; i++) {
+            cost += CompareCost(cases[i].first);
+            sum += cost;
+        }
+        best = (double)sum / n;
+        *plan = SearchLinear;
+    }
+    if (n > 1 && last - first < (long long)MaxEntriesPerCase * n
+        && first >= INT_MIN / 4 && first <= INT_MAX / 4) {
+        double cost = TableCost + (low < first ? CompareCost(first) : 0)
+            + (high > last ? CompareCost(last) : 0);
+        if (best < 0 || cost < best) {
+            best = cost;
+            *plan = SearchTable;
+        }
+    }
+    if (n > 1) {
+        int mid = lo + n / 2;
+        SwitchPlan kid;
+        double cost = CompareCost(cases[mid].first)
+            + ((mid - lo) * SwitchCost(cases, lo, mid, low,
+                                       cases[mid].first - 1LL, &kid)
+               + (hi - mid) * SwitchCost(cases, mid, hi, cases[mid].first,
+                                         high, &kid)) / n;
+        if (best < 0 || cost < best) {
+            best = cost;
+            *plan = SearchBinary;
+        }
+    }
+    return best;
+}
+
+void CodeGenerator::GenSwitch(Location *value, std::vector<SwitchCase> &cases,
+                              const char *defaultLabel) {
+    std::stable_sort(cases.begin(), cases.end(), CaseBefore);
+    cases.erase(std::unique(cases.begin(), cases.end(), SameCase),
+                cases.end());
+    if (cases.empty())
+        GenGoto(defaultLabel);
+    else
+        GenDispatch(value, cases, 0, cases.size(), INT_MIN, INT_MAX,
+                    defaultLabel);
+}
+
+// Branches to the case of value among cases [lo, hi), value being known
+// to be in [low, high]
+void CodeGenerator::GenDispatch(Location *value,
+                                const std::vector<SwitchCase> &cases,
+                                int lo, int hi, long long low, long long high,
+                                const char *defaultLabel) {
+    SwitchPlan plan;
+    SwitchCost(cases, lo, hi, low, high, &plan);
+    if (plan == SearchLinear) {
+        for (int i = lo; i < hi; i++) {
+            Location *t = GenBinaryOp("!=", value,
+                                      GenLoadConstant(cases[i].first));
+            GenIfZ(t, cases[i].second);
+        }
+        GenGoto(defaultLabel);
+    } else if (plan == SearchBinary) {
+        int mid = lo + (hi - lo) / 2;
+        int pivot = cases[mid].first;
+        const char *upper = NewLabel();
+        GenIfZ(GenBinaryOp("<", value, GenLoadConstant(pivot)), upper);
+        GenDispatch(value, cases, lo, mid, low, pivot - 1LL, defaultLabel);
+        GenLabel(upper);
+        GenDispatch(value, cases, mid, hi, pivot, high, defaultLabel);
+    } else {
+        int first = cases[lo].first, last = cases[hi - 1].first;
+        if (low < first)
+            GenIfZ(GenBinaryOp(">=", value, GenLoadConstant(first)),
+                   defaultLabel);
+        if (high > last)
+            GenIfZ(GenBinaryOp("<=", value, GenLoadConstant(last)),
+                   defaultLabel);
+        List<const char*> *labels = new List<const char*>;
+        for (int i = lo; i < hi; i++) {
+            while (first + labels->NumElements() < cases[i].first)
+                labels->Append(defaultLabel);
+            labels->Append(cases[i].second);
+        }
+        code.push_back(new JumpTable(value, first, labels));
+    }
+}
+
 void CodeGenerator::GenReturn(Location *val) {
     code.push_back(new Return(val));
 }
@@ -146,31 +282,51 @@ void CodeGenerator::GenPopParams(int numBytesOfParams) {
         code.push_back(new PopParams(numBytesOfParams));
 }
 
+// Records in the PushParam instructions just generated for a call
+// their position among the arguments (the last one pushed is the first
+// argument), which is used by the register calling convention.
+void CodeGenerator::NumberParams() {
+    std::list<Instruction*>::reverse_iterator p = code.rbegin();
+    int numArgs = 0;
+    while (p != code.rend() && dynamic_cast<PushParam*>(*p)) {
+        numArgs++;
+        ++p;
+    }
+    p = code.rbegin();
+    for (int i = 0; i < numArgs; i++, ++p)
+        dynamic_cast<PushParam*>(*p)->SetPosition(i, numArgs);
+}
+
 Location *CodeGenerator::GenLCall(const char *label, bool fnHasReturnValue) {
     Location *result = fnHasReturnValue ? GenTempVar() : NULL;
+    NumberParams();
     code.push_back(new LCall(label, result));
     return result;
 }
 
 Location *CodeGenerator::GenACall(Location *fnAddr, bool fnHasReturnValue) {
     Location *result = fnHasReturnValue ? GenTempVar() : NULL;
+    NumberParams();
     code.push_back(new ACall(fnAddr, result));
     return result;
 }
 
+// regLabel is the entry point in defs.asm taking the arguments in
+// registers, used with the register calling convention (-fregparams)
 static struct _builtin {
     const char *label;
+    const char *regLabel;
     int numArgs;
     bool hasReturn;
 } builtins[] = {
-    {"_Alloc", 1, true},
-    {"_ReadLine", 0, true},
-    {"_ReadInteger", 0, true},
-    {"_StringEqual", 2, true},
-    {"_PrintInt", 1, false},
-    {"_PrintString", 1, false},
-    {"_PrintBool", 1, false},
-    {"_Halt", 0, false}
+    {"_Alloc", "__Alloc", 1, true},
+    {"_ReadLine", "_ReadLine", 0, true},
+    {"_ReadInteger", "_ReadInteger", 0, true},
+    {"_StringEqual", "__StringEqual", 2, true},
+    {"_PrintInt", "__PrintInt", 1, false},
+    {"_PrintString", "__PrintString", 1, false},
+    {"_PrintBool", "__PrintBool", 1, false},
+    {"_Halt", "_Halt", 0, false}
 };
 
 Location *CodeGenerator::GenBuiltInCall(BuiltIn bn,Location *arg1,
@@ -187,18 +343,229 @@ Location *CodeGenerator::GenBuiltInCall(BuiltIn bn,Location *arg1,
             || (b->numArgs == 2 && arg1 && arg2));
     if (arg2) code.push_back(new PushParam(arg2));
     if (arg1) code.push_back(new PushParam(arg1));
-    code.push_back(new LCall(b->label, result));
+    NumberParams();
+    code.push_back(new LCall(IsFlagOn("regparams", false) ? b->regLabel
+                                                          : b->label, result));
     GenPopParams(VarSize*b->numArgs);
     return result;
 }
 
+bool CodeGenerator::IsBuiltIn(const char *label) {
+    for (int i = 0; i < NumBuiltIns; i++)
+        if (!strcmp(label, builtins[i].label)
+            || !strcmp(label, builtins[i].regLabel))
+            return true;
+    return false;
+}
+
 void CodeGenerator::GenVTable(const char *className,
         List<const char *> *methodLabels)
 {
     code.push_back(new VTable(className, methodLabels));
 }
 
+// Finds the operator to use if the operands of code are swapped
+static bool SwapOperands(BinaryOp::OpCode code, BinaryOp::OpCode *swapped) {
+    switch (code) {
+      case BinaryOp::Add: case BinaryOp::Mul: case BinaryOp::Eq:
+      case BinaryOp::Ne: case BinaryOp::And: case BinaryOp::Or:
+        *swapped = code; return true;
+      case BinaryOp::Lt: *swapped = BinaryOp::Gt; return true;
+      case BinaryOp::Gt: *swapped = BinaryOp::Lt; return true;
+      case BinaryOp::Le: *swapped = BinaryOp::Ge; return true;
+      case BinaryOp::Ge: *swapped = BinaryOp::Le; return true;
+      default: return false;
+    }
+}
+
+/* Instruction selection for the constants of the function [begin, end).
+ * A temp loaded once with a constant is folded into the conditional
+ * branches using it, and into the binary operations using it when Mips
+ * has an immediate form for them, and a binary operation on two such
+ * constants is computed here. An address computed by adding a
+ * constant to a reference and used only by the next Load or Store in
+ * the block becomes the offset of that Load or Store. The constants
+ * left without uses are then removed.
+ */
+void CodeGenerator::SelectImmediates(std::list<Instruction*> &code,
+                                     std::list<Instruction*>::iterator begin,
+                                     std::list<Instruction*>::iterator end) {
+    std::map<Location*, int> numDefs, numUses;
+    std::map<Location*, LoadConstant*> constants;
+    std::list<Instruction*>::iterator p;
+    for (p = begin; p != end; ++p) {
+        Location *dst = (*p)->GetDst();
+        if (dst) numDefs[dst]++;
+        if (LoadConstant *lc = dynamic_cast<LoadConstant*>(*p))
+            constants[dst] = lc;
+        std::vector<Location*> srcs;
+        (*p)->GetSrcs(srcs);
+        for (size_t i = 0; i < srcs.size(); i++) numUses[srcs[i]]++;
+    }
+    std::map<Location*, LoadConstant*>::iterator c = constants.begin();
+    while (c != constants.end()) {
+        if (numDefs[c->first] != 1 || !c->first->IsTemp())
+            constants.erase(c++);
+        else
+            ++c;
+    }
+
+    p = begin;
+    while (p != end) {
+        IfCmp *ifc = dynamic_cast<IfCmp*>(*p);
+        if (ifc && ifc->GetOp2()) {
+            BinaryOp::OpCode op = ifc->GetOpCode();
+            Location *op1 = ifc->GetOp1(), *op2 = ifc->GetOp2();
+            if (!constants.count(op2) && constants.count(op1)) {
+                SwapOperands(op, &op);
+                std::swap(op1, op2);
+            }
+            if (constants.count(op2)) {
+                numUses[op2]--;
+                *p = new IfCmp(op, op1, NULL, constants[op2]->GetValue(),
+                               ifc->branch_label());
+                delete ifc;
+            }
+        }
+        BinaryOp *b = dynamic_cast<BinaryOp*>(*p);
+        if (!b || !b->GetOp2()) { ++p; continue; }
+        BinaryOp::OpCode op = b->GetOpCode(), swapped;
+        Location *dst = b->GetDst(), *op1 = b->GetOp1(), *op2 = b->GetOp2();
+        int result;
+        if (constants.count(op1) && constants.count(op2)
+            && BinaryOp::Fold(op, constants[op1]->GetValue(),
+                              constants[op2]->GetValue(), &result)) {
+            numUses[op1]--;
+            numUses[op2]--;
+            LoadConstant *lc = new LoadConstant(dst, result);
+            if (numDefs[dst] == 1 && dst->IsTemp()) constants[dst] = lc;
+            *p++ = lc;
+            delete b;
+            continue;
+        }
+        if (!constants.count(op2)
+            || !Mips::CanUseImmediate(op, constants[op2]->GetValue())) {
+            if (!constants.count(op1) || !SwapOperands(op, &swapped)
+                || !Mips::CanUseImmediate(swapped,
+                                          constants[op1]->GetValue())) {
+                ++p;
+                continue;
+            }
+            std::swap(op1, op2);
+            op = swapped;
+        }
+        numUses[op2]--;
+        int imm = constants[op2]->GetValue();
+        *p = new BinaryOp(op, dst, op1, imm);
+        delete b;
+
+        if (op != BinaryOp::Add || !dst->IsTemp() || numDefs[dst] != 1
+            || numUses[dst] != 1) {
+            ++p;
+            continue;
+        }
+        bool folded = false;
+        for (std::list<Instruction*>::iterator q = p; !folded && ++q != end;) {
+            if (dynamic_cast<Label*>(*q) || dynamic_cast<Goto*>(*q)
+                || dynamic_cast<IfZ*>(*q) || dynamic_cast<Return*>(*q)
+                || (*q)->GetDst() == op1)
+                break;
+            Load *ld = dynamic_cast<Load*>(*q);
+            Store *st = dynamic_cast<Store*>(*q);
+            if (ld && ld->GetReference() == dst
+                && Mips::CanUseImmediate(BinaryOp::Add,
+                                         ld->GetOffset() + imm)) {
+                *q = new Load(ld->GetDst(), op1, ld->GetOffset() + imm);
+                delete ld;
+                folded = true;
+            } else if (st && st->GetReference() == dst
+                       && st->GetValue() != dst
+                       && Mips::CanUseImmediate(BinaryOp::Add,
+                                                st->GetOffset() + imm)) {
+                *q = new Store(op1, st->GetValue(), st->GetOffset() + imm);
+                delete st;
+                folded = true;
+            } else {
+                std::vector<Location*> srcs;
+                (*q)->GetSrcs(srcs);
+                if (std::find(srcs.begin(), srcs.end(), dst) != srcs.end())
+                    break;
+            }
+        }
+        if (folded) {
+            delete *p;
+            p = code.erase(p);
+        } else
+            ++p;
+    }
+
+    p = begin;
+    while (p != end) {
+        LoadConstant *lc = dynamic_cast<LoadConstant*>(*p);
+        if (lc && constants.count(lc->GetDst())
+            && numUses[lc->GetDst()] == 0) {
+            delete lc;
+            p = code.erase(p);
+        } else
+            ++p;
+    }
+}
+
+// Finds the relational operator testing the opposite of code
+static bool NegateComparison(BinaryOp::OpCode code,
+                             BinaryOp::OpCode *negated) {
+    switch (code) {
+      case BinaryOp::Eq: *negated = BinaryOp::Ne; return true;
+      case BinaryOp::Ne: *negated = BinaryOp::Eq; return true;
+      case BinaryOp::Lt: *negated = BinaryOp::Ge; return true;
+      case BinaryOp::Le: *negated = BinaryOp::Gt; return true;
+      case BinaryOp::Gt: *negated = BinaryOp::Le; return true;
+      case BinaryOp::Ge: *negated = BinaryOp::Lt; return true;
+      default: return false;
+    }
+}
+
+/* Fuses a comparison into the IfZ right after it when the IfZ is the
+ * only use of its result, so the function [begin, end) branches on the
+ * comparison itself instead of materializing a boolean first.
+ */
+void CodeGenerator::FuseBranches(std::list<Instruction*> &code,
+                                 std::list<Instruction*>::iterator begin,
+                                 std::list<Instruction*>::iterator end) {
+    std::map<Location*, int> numUses;
+    std::list<Instruction*>::iterator p;
+    for (p = begin; p != end; ++p) {
+        std::vector<Location*> srcs;
+        (*p)->GetSrcs(srcs);
+        for (size_t i = 0; i < srcs.size(); i++) numUses[srcs[i]]++;
+    }
+
+    p = begin;
+    while (p != end) {
+        BinaryOp *b = dynamic_cast<BinaryOp*>(*p);
+        std::list<Instruction*>::iterator next = p;
+        ++next;
+        IfZ *ifz = next != end ? dynamic_cast<IfZ*>(*next) : NULL;
+        BinaryOp::OpCode negated;
+        std::vector<Location*> test;
+        if (ifz) ifz->GetSrcs(test);
+        if (!b || !ifz || test[0] != b->GetDst() || !b->GetDst()->IsTemp()
+            || numUses[b->GetDst()] != 1
+            || !NegateComparison(b->GetOpCode(), &negated)) {
+            ++p;
+            continue;
+        }
+        *next = new IfCmp(negated, b->GetOp1(), b->GetOp2(),
+                          b->GetImmediate(), ifz->branch_label());
+        delete ifz;
+        delete b;
+        p = code.erase(p);
+    }
+}
+
 void CodeGenerator::DoFinalCodeGen() {
+    PassManager passes(code);
+    passes.Run();
     if (IsDebugOn("tac")) { // if debug don't translate to mips, just print Tac
         std::list<Instruction*>::iterator p;
         for (p= code.begin(); p != code.end(); ++p) {
@@ -208,10 +575,97 @@ void CodeGenerator::DoFinalCodeGen() {
         Mips mips;
         mips.EmitPreamble();
 
-        std::list<Instruction*>::iterator p;
-        for (p= code.begin(); p != code.end(); ++p) {
-            (*p)->Emit(&mips);
+        std::list<Instruction*>::iterator p = code.begin();
+        while (p != code.end()) {
+            std::list<Instruction*>::iterator end = FunctionEnd(code, p);
+            if (end != p) {
+                EmitFunction(&mips, p, end);
+                p = end;
+            } else {
+                (*p)->Emit(&mips);
+                ++p;
+            }
         }
+        mips.FlushOutput();
+    }
+}
+
+// A leaf function makes no calls, so it does not need to save $ra. A
+// tail call counts as a call: it needs the frame to copy its arguments.
+static bool IsLeafFunction(std::list<Instruction*>::iterator begin,
+                           std::list<Instruction*>::iterator end) {
+    for (std::list<Instruction*>::iterator p = begin; p != end; ++p)
+        if (FlowGraph::IsCall(*p) || dynamic_cast<TailCall*>(*p))
+            return false;
+    return true;
+}
+
+// A function needs a stack frame if a local or temp lives in memory or
+// it has callee-saved registers to save
+static bool NeedsStackFrame(std::list<Instruction*>::iterator begin,
+                            std::list<Instruction*>::iterator end,
+                            RegisterAllocator *allocator) {
+    if (allocator && !allocator->GetCalleeSavedUsed().empty())
+        return true;
+    for (std::list<Instruction*>::iterator p = begin; p != end; ++p) {
+        std::vector<Location*> locs;
+        (*p)->GetSrcs(locs);
+        if ((*p)->GetDst()) locs.push_back((*p)->GetDst());
+        for (size_t i = 0; i < locs.size(); i++)
+            if (locs[i]->GetSegment() == fpRelative && locs[i]->GetOffset() < 0
+                && (!allocator || !allocator->GetRegister(locs[i])))
+                return true;
     }
+    return false;
+}
+
+/* Translates the function [begin, end) to MIPS. At level 2 and above,
+ * registers are allocated for the whole function first. At level 1 and
+ * above, leaf functions do not save $ra and get no stack frame at all
+ * when their locals and temps are all kept in registers.
+ */
+void CodeGenerator::EmitFunction(Mips *mips,
+                                 std::list<Instruction*>::iterator begin,
+                                 std::list<Instruction*>::iterator end) {
+    FlowGraph *graph = NULL;
+    RegisterAllocator *allocator = NULL;
+    if (GetOptimizationLevel() >= 2) {
+        graph = new FlowGraph(begin, end);
+        if (GetOptimizationLevel() >= 3)
+            allocator = new GraphColoringAllocator(graph);
+        else
+            allocator = new LinearScanAllocator(graph);
+        allocator->Allocate();
+    }
+    mips->SetAllocation(allocator);
+    if (GetOptimizationLevel() >= 1) {
+        bool leaf = IsLeafFunction(begin, end);
+        mips->SetFrameInfo(leaf,
+                           !leaf || NeedsStackFrame(begin, end, allocator));
+    } else
+        mips->SetFrameInfo(false, true);
+
+    for (std::list<Instruction*>::iterator p = begin; p != end; ++p)
+        (*p)->Emit(mips);
+
+    mips->SetAllocation(NULL);
+    delete allocator;
+    delete graph;
+}
+
+/* If the instruction at p is the Label starting a function (it is
+ * immediately followed by BeginFunc), returns the position after the
+ * function's EndFunc, otherwise returns p.
+ */
+std::list<Instruction*>::iterator
+CodeGenerator::FunctionEnd(std::list<Instruction*> &code,
+                           std::list<Instruction*>::iterator p) {
+    std::list<Instruction*>::iterator q = p;
+    if (!dynamic_cast<Label*>(*p) || ++q == code.end()
+        || !dynamic_cast<BeginFunc*>(*q))
+        return p;
+    while (!dynamic_cast<EndFunc*>(*q))
+        ++q;
+    return ++q;
 }
 
@@ -16,12 +16,19 @@
 
 #include <cstdlib>
 #include <list>
+#include <utility>
+#include <vector>
 #include "tac.h"
 
+class Mips;
+
 // These codes are used to identify the built-in functions
 typedef enum { Alloc, ReadLine, ReadInteger, StringEqual,
                PrintInt, PrintString, PrintBool, Halt, NumBuiltIns } BuiltIn;
 
+// A case of a switch: its value and the label of its statements
+typedef std::pair<int, const char*> SwitchCase;
+
 class CodeGenerator {
   private:
     std::list<Instruction*> code;
@@ -29,7 +36,28 @@ class CodeGenerator {
     int param_loc;
     int globl_loc;
 
+    void NumberParams();
+    void GenDispatch(Location *value, const std::vector<SwitchCase> &cases,
+                     int lo, int hi, long long low, long long high,
+                     const char *defaultLabel);
+    void EmitFunction(Mips *mips, std::list<Instruction*>::iterator begin,
+                      std::list<Instruction*>::iterator end);
+
   public:
+    // Returns the position just past the function starting at p in
+    // code (see DoFinalCodeGen), or p if no function starts there.
+    static std::list<Instruction*>::iterator FunctionEnd(
+            std::list<Instruction*> &code,
+            std::list<Instruction*>::iterator p);
+
+    // The passes over the Tac of one function (see passes.h)
+    static void SelectImmediates(std::list<Instruction*> &code,
+                                 std::list<Instruction*>::iterator begin,
+                                 std::list<Instruction*>::iterator end);
+    static void FuseBranches(std::list<Instruction*> &code,
+                             std::list<Instruction*>::iterator begin,
+                             std::list<Instruction*>::iterator end);
+
     // Here are some class constants to remind you of the offsets
     // used for globals, locals, and parameters. You will be
     // responsible for using these when assigning Locations.
@@ -58,12 +86,20 @@ class CodeGenerator {
 
     // Assigns a new unique label name and returns it. Does not
     // generate any Tac instructions (see GenLabel below if needed)
-    char *NewLabel();
+    static char *NewLabel();
 
     // Creates and returns a Location for a new uniquely named
     // temp variable. Does not generate any Tac instructions
     Location *GenTempVar();
 
+    // Creates a new temp for a pass adding code to the function starting
+    // with begin, whose frame grows to hold it
+    static Location *NewTempVar(BeginFunc *begin);
+
+    // Creates a new variable named name in the same way, for a pass
+    // adding a location that may be written more than once
+    static Location *NewLocalVar(BeginFunc *begin, const char *name);
+
     // Generates Tac instructions to load a constant value. Creates
     // a new temp var to hold the result. The constant
     // value is passed as an integer, it can be 0 for integer zero,
@@ -140,6 +176,10 @@ class CodeGenerator {
     Location *GenBuiltInCall(BuiltIn b, Location *arg1 = NULL,
             Location *arg2 = NULL);
 
+    // Whether label is the entry point of a built-in function. None of
+    // them writes memory the program can read (_Alloc returns new memory)
+    static bool IsBuiltIn(const char *label);
+
     // These methods generate the Tac instructions for various
     // control flow (branches, jumps, returns, labels)
     // One minor detail to mention is that you can pass NULL
@@ -150,6 +190,15 @@ class CodeGenerator {
     void GenReturn(Location *val = NULL);
     void GenLabel(const char *label);
 
+    // Generates the branch of a switch on value to the label of the case
+    // with that value (the first one if several have it), or to
+    // defaultLabel. Each range of the sorted case values is dispatched by
+    // a series of comparisons, a binary search splitting it in two, or a
+    // JumpTable after checking its bounds, whichever costs the fewest
+    // instructions on average.
+    void GenSwitch(Location *value, std::vector<SwitchCase> &cases,
+                   const char *defaultLabel);
+
     // These methods generate the Tac instructions that mark the start
     // and end of a function/method definition.
     BeginFunc *GenBeginFunc();
@@ -0,0 +1,153 @@
+/* File: copyprop.cc
+ * -----------------
+ * Implementation of global copy propagation.
+ */
+
+#include <algorithm>
+#include "copyprop.h"
+#include "utility.h"
+
+CopyPropagator::CopyPropagator(FlowGraph &g)
+  : graph(g), out(g.NumBlocks()), reached(g.NumBlocks(), false),
+    numReplaced(0), numCoalesced(0) {}
+
+void CopyPropagator::Transfer(Instruction *instr, CopyMap &copies) {
+    Location *dst = instr->GetDst();
+    if (!dst) return;
+    CopyMap::iterator c = copies.begin();
+    while (c != copies.end()) {
+        if (c->first == dst || c->second == dst)
+            copies.erase(c++);
+        else
+            ++c;
+    }
+    Assign *a = dynamic_cast<Assign*>(instr);
+    if (a && dst->IsTemp() && FlowGraph::IsTracked(dst)
+        && FlowGraph::IsTracked(a->GetSrc()) && a->GetSrc() != dst)
+        copies[dst] = a->GetSrc();
+}
+
+// The copies at the start of b: those available at the end of all of
+// its predecessors reached so far
+void CopyPropagator::In(BasicBlock *b, CopyMap &copies) {
+    copies.clear();
+    bool first = true;
+    for (size_t p = 0; p < b->preds.size(); p++) {
+        BasicBlock *pred = b->preds[p];
+        if (!reached[pred->id]) continue;
+        if (first) {
+            copies = out[pred->id];
+            first = false;
+            continue;
+        }
+        CopyMap::iterator c = copies.begin();
+        while (c != copies.end()) {
+            CopyMap::iterator other = out[pred->id].find(c->first);
+            if (other != out[pred->id].end() && other->second == c->second)
+                ++c;
+            else
+                copies.erase(c++);
+        }
+    }
+}
+
+void CopyPropagator::Solve() {
+    graph.ComputeDominators();
+    const std::vector<BasicBlock*> &order = graph.ReversePostorder();
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 0; i < order.size(); i++) {
+            BasicBlock *b = order[i];
+            CopyMap copies;
+            In(b, copies);
+            for (size_t j = 0; j < b->code.size(); j++)
+                Transfer(b->code[j], copies);
+            if (!reached[b->id] || copies != out[b->id]) {
+                reached[b->id] = true;
+                out[b->id] = copies;
+                changed = true;
+            }
+        }
+    }
+}
+
+void CopyPropagator::Rewrite(BasicBlock *b) {
+    CopyMap copies;
+    In(b, copies);
+    for (size_t i = 0; i < b->code.size(); i++) {
+        Instruction *instr = b->code[i];
+        std::vector<Location*> srcs;
+        instr->GetSrcs(srcs);
+        for (size_t s = 0; s < srcs.size(); s++) {
+            Location *src = srcs[s];
+            while (copies.count(src))
+                src = copies[src];
+            if (src != srcs[s]) {
+                instr->ReplaceSrc(srcs[s], src);
+                numReplaced++;
+            }
+        }
+        Transfer(instr, copies);
+    }
+}
+
+void CopyPropagator::Rewrite() {
+    for (int i = 0; i < graph.NumBlocks(); i++)
+        if (reached[i]) Rewrite(graph.GetBlock(i));
+}
+
+// Whether instr reads or writes loc
+static bool Touches(Instruction *instr, Location *loc) {
+    std::vector<Location*> srcs;
+    instr->GetSrcs(srcs);
+    return instr->GetDst() == loc
+        || std::find(srcs.begin(), srcs.end(), loc) != srcs.end();
+}
+
+void CopyPropagator::Coalesce() {
+    std::map<Location*, int> numDefs, numUses;
+    for (int i = 0; i < graph.NumBlocks(); i++) {
+        BasicBlock *b = graph.GetBlock(i);
+        for (size_t j = 0; j < b->code.size(); j++) {
+            if (b->code[j]->GetDst()) numDefs[b->code[j]->GetDst()]++;
+            std::vector<Location*> srcs;
+            b->code[j]->GetSrcs(srcs);
+            for (size_t s = 0; s < srcs.size(); s++) numUses[srcs[s]]++;
+        }
+    }
+
+    for (int i = 0; i < graph.NumBlocks(); i++) {
+        BasicBlock *b = graph.GetBlock(i);
+        for (size_t k = 0; k < b->code.size(); k++) {
+            Assign *a = dynamic_cast<Assign*>(b->code[k]);
+            if (!a) continue;
+            Location *t = a->GetSrc(), *x = a->GetDst();
+            if (!t->IsTemp() || !FlowGraph::IsTracked(t) || t == x
+                || numDefs[t] != 1 || numUses[t] != 1)
+                continue;
+            int d = k - 1;
+            while (d >= 0 && b->code[d]->GetDst() != t
+                   && FlowGraph::IsTracked(x) && !Touches(b->code[d], x))
+                d--;
+            if (d < 0 || b->code[d]->GetDst() != t) continue;
+            b->code[d]->ReplaceDst(x);
+            b->code.erase(b->code.begin() + k--);
+            delete a;
+            numCoalesced++;
+        }
+    }
+    PrintDebug("copyprop", "%s: %d reads replaced, %d copies coalesced",
+               graph.GetName(), numReplaced, numCoalesced);
+}
+
+void PropagateCopies(std::list<Instruction*> &code,
+                     std::list<Instruction*>::iterator begin,
+                     std::list<Instruction*>::iterator end) {
+    FlowGraph graph(begin, end);
+    CopyPropagator propagator(graph);
+    propagator.Solve();
+    propagator.Rewrite();
+    propagator.Coalesce();
+    graph.WriteBack(code, begin, end);
+}
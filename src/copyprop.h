@@ -0,0 +1,72 @@
+/* File: copyprop.h
+ * ----------------
+ * Global copy propagation on the flow graph of one function.
+ *
+ * The code generator stores most values through a copy: the value of
+ * an expression is computed into a temp, which an assignment statement
+ * then copies into the variable, and a postfix expression saves the old
+ * value of its variable into a temp. Two kinds of copies are removed.
+ *
+ * After a copy t = x into a temp, a read of t can read x instead as long
+ * as neither has been written since, which leaves the copy itself dead
+ * (see dce.h) once all its reads are gone. The copies available at the
+ * start of a block are those available at the end of all of its
+ * predecessors (a forward dataflow problem solved iteratively, starting
+ * from all copies on the blocks not yet reached so that copies made
+ * before a loop survive its back edge). Copies into variables are not
+ * propagated forward: replacing a variable by the temp it was assigned
+ * from would only lengthen the life of the temp.
+ *
+ * A copy x = t of a temp defined once and read only there is instead
+ * removed backward: the instruction defining t, earlier in the same
+ * block, writes x directly, provided nothing in between reads or writes
+ * x (and nothing is in between at all when x is a global, which a call
+ * may read).
+ */
+
+#ifndef _H_copyprop
+#define _H_copyprop
+
+#include <list>
+#include <map>
+#include <vector>
+#include "tac.h"
+#include "cfg.h"
+
+// The copies available at a point: each temp to the location it holds
+// a copy of
+typedef std::map<Location*, Location*> CopyMap;
+
+class CopyPropagator
+{
+  private:
+    FlowGraph &graph;
+    std::vector<CopyMap> out;           // the copies at the end of a block
+    std::vector<bool> reached;
+    int numReplaced, numCoalesced;
+
+    void In(BasicBlock *b, CopyMap &copies);
+    void Rewrite(BasicBlock *b);
+
+    static void Transfer(Instruction *instr, CopyMap &copies);
+
+  public:
+    CopyPropagator(FlowGraph &graph);
+
+    // Finds the copies available at the end of each block
+    void Solve();
+
+    // Replaces the reads of the copies available with their sources
+    void Rewrite();
+
+    // Removes the copies of temps into variables by writing the variables
+    // where the temps are defined
+    void Coalesce();
+};
+
+// The function pass: propagates the copies of the function [begin, end)
+void PropagateCopies(std::list<Instruction*> &code,
+                     std::list<Instruction*>::iterator begin,
+                     std::list<Instruction*>::iterator end);
+
+#endif
@@ -0,0 +1,134 @@
+/* File: dce.cc
+ * ------------
+ * Implementation of dead code elimination.
+ */
+
+#include <map>
+#include <set>
+#include <string>
+#include "dce.h"
+#include "codegen.h"
+#include "utility.h"
+
+// Whether instr has no effect other than writing its destination. A
+// Load has none either: Decaf does not check for null references, so a
+// Load only faults in a program that is already wrong.
+static bool IsPure(Instruction *instr) {
+    if (BinaryOp *b = dynamic_cast<BinaryOp*>(instr)) {
+        BinaryOp::OpCode op = b->GetOpCode();
+        return (op != BinaryOp::Div && op != BinaryOp::Mod)
+            || (!b->GetOp2() && b->GetImmediate() != 0);
+    }
+    return dynamic_cast<LoadConstant*>(instr)
+        || dynamic_cast<LoadStringConstant*>(instr)
+        || dynamic_cast<LoadLabel*>(instr) || dynamic_cast<Assign*>(instr)
+        || dynamic_cast<Load*>(instr);
+}
+
+int RemoveDeadInstructions(FlowGraph &graph) {
+    int numRemoved = 0;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        graph.ComputeLiveness();
+        for (int i = 0; i < graph.NumBlocks(); i++) {
+            BasicBlock *b = graph.GetBlock(i);
+            LocationSet live = b->liveOut;
+            for (int j = b->code.size() - 1; j >= 0; j--) {
+                Instruction *instr = b->code[j];
+                Location *dst = instr->GetDst();
+                if (FlowGraph::IsTracked(dst) && !live.count(dst)
+                    && IsPure(instr)) {
+                    b->code.erase(b->code.begin() + j);
+                    delete instr;
+                    numRemoved++;
+                    changed = true;
+                } else
+                    FlowGraph::TransferLive(instr, live);
+            }
+        }
+    }
+    return numRemoved;
+}
+
+void EliminateDeadCode(std::list<Instruction*> &code,
+                       std::list<Instruction*>::iterator begin,
+                       std::list<Instruction*>::iterator end) {
+    FlowGraph graph(begin, end);
+    int numBlocks = graph.NumBlocks();
+    graph.RemoveUnreachableBlocks();
+    int numRemoved = RemoveDeadInstructions(graph);
+    PrintDebug("dce", "%s: %d unreachable blocks, %d instructions removed",
+               graph.GetName(), numBlocks - graph.NumBlocks(), numRemoved);
+    graph.WriteBack(code, begin, end);
+}
+
+typedef std::pair<std::list<Instruction*>::iterator,
+                  std::list<Instruction*>::iterator> Range;
+
+void RemoveUnusedFunctions(std::list<Instruction*> &code) {
+    std::map<std::string, Range> functions;
+    std::map<std::string, std::list<Instruction*>::iterator> vtables;
+    std::list<Instruction*>::iterator p = code.begin();
+    while (p != code.end()) {
+        std::list<Instruction*>::iterator end =
+            CodeGenerator::FunctionEnd(code, p);
+        if (end != p) {
+            functions[dynamic_cast<Label*>(*p)->text()] = Range(p, end);
+            p = end;
+            continue;
+        }
+        if (VTable *vt = dynamic_cast<VTable*>(*p))
+            vtables[vt->GetLabel()] = p;
+        ++p;
+    }
+    if (!functions.count("main")) return;
+
+    std::set<std::string> live, liveVTables;
+    std::vector<std::string> worklist(1, "main");
+    live.insert("main");
+    while (!worklist.empty()) {
+        Range range = functions[worklist.back()];
+        worklist.pop_back();
+        for (p = range.first; p != range.second; ++p) {
+            std::vector<const char*> used;
+            if (LCall *call = dynamic_cast<LCall*>(*p))
+                used.push_back(call->GetLabel());
+            LoadLabel *ll = dynamic_cast<LoadLabel*>(*p);
+            if (ll && vtables.count(ll->GetLabel())
+                && liveVTables.insert(ll->GetLabel()).second) {
+                VTable *vt = dynamic_cast<VTable*>(*vtables[ll->GetLabel()]);
+                List<const char*> *methods = vt->GetMethodLabels();
+                for (int i = 0; i < methods->NumElements(); i++)
+                    used.push_back(methods->Nth(i));
+            }
+            for (size_t i = 0; i < used.size(); i++)
+                if (functions.count(used[i]) && live.insert(used[i]).second)
+                    worklist.push_back(used[i]);
+        }
+    }
+
+    int numFunctions = 0, numVTables = 0;
+    p = code.begin();
+    while (p != code.end()) {
+        std::list<Instruction*>::iterator end =
+            CodeGenerator::FunctionEnd(code, p);
+        bool function = end != p;
+        VTable *vt = dynamic_cast<VTable*>(*p);
+        bool dead = function ? !live.count(dynamic_cast<Label*>(*p)->text())
+                             : vt && !liveVTables.count(vt->GetLabel());
+        if (!function) ++end;
+        if (!dead) {
+            p = end;
+            continue;
+        }
+        if (function) numFunctions++;
+        else numVTables++;
+        while (p != end) {
+            delete *p;
+            p = code.erase(p);
+        }
+    }
+    PrintDebug("dce", "%d functions and %d vtables removed", numFunctions,
+               numVTables);
+}
@@ -0,0 +1,45 @@
+/* File: dce.h
+ * -----------
+ * Dead code elimination: the dead blocks and instructions of one
+ * function, and the functions of the program that are never called.
+ *
+ * The blocks that cannot be reached from the entry of the function are
+ * deleted first: the code the generator places after a Return or after
+ * the Goto of a break, in an IfStmt branch or a CaseStmt body. Then an
+ * instruction is dead when it only computes a value into a tracked
+ * location (see FlowGraph::IsTracked) that is not live after it: the
+ * value of a postfix expression used as a statement, the reload of an
+ * assigned field or array element, or a copy whose reads were all
+ * propagated (see copyprop.h). Calls, stores and divisions that could
+ * trap are never dead. Removing an instruction can leave the
+ * instructions computing its operands dead, so the liveness is
+ * recomputed until no more instructions are removed.
+ *
+ * RemoveUnusedFunctions works on the whole program: the live functions
+ * are those reached from main through the LCalls of live functions and
+ * the vtables of the classes they instantiate (a method is only called
+ * through a vtable, so every method in a live vtable is live). The other
+ * functions and vtables are deleted.
+ */
+
+#ifndef _H_dce
+#define _H_dce
+
+#include <list>
+#include "tac.h"
+#include "cfg.h"
+
+// Removes the dead instructions of graph, without its dead blocks, and
+// returns how many there were. Leaves the liveness of the last round.
+int RemoveDeadInstructions(FlowGraph &graph);
+
+// The function pass: removes the dead instructions of the function
+// [begin, end)
+void EliminateDeadCode(std::list<Instruction*> &code,
+                       std::list<Instruction*>::iterator begin,
+                       std::list<Instruction*>::iterator end);
+
+// The program pass: removes the functions and vtables never used
+void RemoveUnusedFunctions(std::list<Instruction*> &code);
+
+#endif
@@ -12,6 +12,12 @@ _PrintInt:
         jr      $ra
 
 
+__PrintInt:                     # argument in $a0 (-fregparams)
+        li      $v0, 1
+        syscall
+        jr      $ra
+
+
 _PrintString:
         subu    $sp, $sp, 8
         sw      $fp, 8($sp)
@@ -26,6 +32,12 @@ _PrintString:
         jr      $ra
 
 
+__PrintString:                  # argument in $a0 (-fregparams)
+        li      $v0, 4
+        syscall
+        jr      $ra
+
+
 _PrintBool:
         subu    $sp, $sp, 8
         sw      $fp, 8($sp)
@@ -48,6 +60,18 @@ end:    move    $sp, $fp
         jr      $ra
 
 
+__PrintBool:                    # argument in $a0 (-fregparams)
+        li      $v0, 4          # system call for print_str
+        blez    $a0, fbr2
+        la      $a0, TRUE       # address of str to print
+        syscall
+        jr      $ra
+
+fbr2:   la      $a0, FALSE      # address of str to print
+        syscall
+        jr      $ra
+
+
 _Alloc:
         subu    $sp, $sp, 8
         sw      $fp, 8($sp)
@@ -62,6 +86,12 @@ _Alloc:
         jr      $ra
 
 
+__Alloc:                        # argument in $a0 (-fregparams)
+        li      $v0, 9
+        syscall
+        jr      $ra
+
+
 _StringEqual:
         subu    $sp, $sp, 8     # decrement sp to make space to save ra, fp
         sw      $fp, 8($sp)     # save fp
@@ -114,6 +144,47 @@ end1:   move    $sp, $fp        # pop callee frame off stack
         jr      $ra             # return from function
 
 
+__StringEqual:                  # arguments in $a0, $a1 (-fregparams)
+        li      $v0, 0
+
+        #Determine length string 1
+        move    $t0, $a0
+        li      $t3, 0
+
+bloop5: lb      $t5, ($t0)
+        beqz    $t5, eloop5
+        addi    $t0, 1
+        addi    $t3, 1
+        b       bloop5
+
+eloop5: # Determine length string 2
+        move    $t1, $a1
+        li      $t4, 0
+
+bloop6: lb      $t5, ($t1)
+        beqz    $t5, eloop6
+        addi    $t1, 1
+        addi    $t4, 1
+        b       bloop6
+
+eloop6: bne     $t3,$t4,end2    # Check String Lengths Same
+
+        move    $t0, $a0
+        move    $t1, $a1
+
+bloop7: lb      $t5, ($t0)
+        lb      $t6, ($t1)
+        bne     $t5, $t6, end2
+        beqz    $t5, eloop7     # if zero, then we hit the end of both strings
+        addi    $t0, 1
+        addi    $t1, 1
+        b       bloop7
+
+eloop7: li      $v0, 1
+
+end2:   jr      $ra             # return from function
+
+
 _Halt:
         li      $v0, 10
         syscall
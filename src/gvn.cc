@@ -0,0 +1,172 @@
+/* File: gvn.cc
+ * ------------
+ * Implementation of dominator-based value numbering.
+ */
+
+#include <algorithm>
+#include <set>
+#include "gvn.h"
+#include "utility.h"
+
+typedef enum { KindBinary, KindLoad } KeyKind;
+
+static const int LengthOffset = -4;     // where NewArray stores the length
+
+bool ValueNumbering::Key::operator<(const Key &k) const {
+    if (kind != k.kind) return kind < k.kind;
+    if (op != k.op) return op < k.op;
+    if (a != k.a) return a < k.a;
+    return b < k.b;
+}
+
+// Comparisons are cheaper to compute again than to keep: a comparison
+// used only by a branch is fused into it (see FuseBranches)
+static bool IsReused(Instruction *instr) {
+    BinaryOp *b = dynamic_cast<BinaryOp*>(instr);
+    return !b || b->GetOpCode() < BinaryOp::Eq;
+}
+
+static bool IsCommutative(BinaryOp::OpCode code) {
+    return code == BinaryOp::Add || code == BinaryOp::Mul
+        || code == BinaryOp::Eq || code == BinaryOp::Ne
+        || code == BinaryOp::And || code == BinaryOp::Or;
+}
+
+ValueNumbering::ValueNumbering(FlowGraph &g)
+  : graph(g), nextNumber(0), defs(g.NumBlocks()),
+    writesMemory(g.NumBlocks(), false), numReused(0) {
+    for (int i = 0; i < graph.NumBlocks(); i++) {
+        BasicBlock *b = graph.GetBlock(i);
+        for (size_t j = 0; j < b->code.size(); j++) {
+            Instruction *instr = b->code[j];
+            if (instr->GetDst()) defs[i].insert(instr->GetDst());
+            if (dynamic_cast<Store*>(instr) || FlowGraph::IsCall(instr))
+                writesMemory[i] = true;
+        }
+    }
+}
+
+int ValueNumbering::NumberOf(Table &table, Location *loc) {
+    if (!FlowGraph::IsTracked(loc)) return nextNumber++;
+    std::map<Location*, int>::iterator n = table.numbers.find(loc);
+    if (n != table.numbers.end()) return n->second;
+    return table.numbers[loc] = nextNumber++;
+}
+
+int ValueNumbering::NumberOfConstant(int value) {
+    std::map<int, int>::iterator n = constants.find(value);
+    if (n != constants.end()) return n->second;
+    return constants[value] = nextNumber++;
+}
+
+ValueNumbering::Key ValueNumbering::KeyOf(Table &table, Instruction *instr) {
+    if (Load *ld = dynamic_cast<Load*>(instr))
+        return Key(KindLoad, 0, NumberOf(table, ld->GetReference()),
+                   ld->GetOffset());
+    BinaryOp *b = dynamic_cast<BinaryOp*>(instr);
+    Assert(b != NULL);
+    int a = NumberOf(table, b->GetOp1());
+    int c = b->GetOp2() ? NumberOf(table, b->GetOp2())
+                        : NumberOfConstant(b->GetImmediate());
+    if (IsCommutative(b->GetOpCode()) && a > c) std::swap(a, c);
+    return Key(KindBinary, b->GetOpCode(), a, c);
+}
+
+// Forgets the Loads that store could change (all but the lengths when
+// store is NULL, for a call)
+void ValueNumbering::KillLoads(Table &table, Store *store) {
+    int base = store ? NumberOf(table, store->GetReference()) : -1;
+    std::map<Key, Value>::iterator v = table.values.begin();
+    while (v != table.values.end()) {
+        const Key &k = v->first;
+        if (k.kind != KindLoad || k.b == LengthOffset
+            || (store && k.a == base && k.b != store->GetOffset()))
+            ++v;
+        else
+            table.values.erase(v++);
+    }
+}
+
+// Updates the table inherited from the immediate dominator of b with
+// what the blocks on the paths from the dominator to b may write: the
+// blocks reaching b backward without going through the dominator
+void ValueNumbering::EnterBlock(BasicBlock *b, Table &table) {
+    std::set<BasicBlock*> between;
+    std::vector<BasicBlock*> stack(b->preds.begin(), b->preds.end());
+    while (!stack.empty()) {
+        BasicBlock *x = stack.back();
+        stack.pop_back();
+        if (x == b->idom || !between.insert(x).second) continue;
+        stack.insert(stack.end(), x->preds.begin(), x->preds.end());
+    }
+    bool memory = false;
+    for (std::set<BasicBlock*>::iterator x = between.begin();
+         x != between.end(); ++x) {
+        const LocationSet &written = defs[(*x)->id];
+        for (LocationSet::const_iterator l = written.begin();
+             l != written.end(); ++l)
+            table.numbers.erase(*l);
+        memory = memory || writesMemory[(*x)->id];
+    }
+    if (memory) KillLoads(table, NULL);
+}
+
+void ValueNumbering::Visit(BasicBlock *b, Table table) {
+    if (b != graph.GetEntry()) EnterBlock(b, table);
+    for (size_t i = 0; i < b->code.size(); i++) {
+        Instruction *instr = b->code[i];
+        Location *dst = instr->GetDst();
+        bool tracked = FlowGraph::IsTracked(dst);
+        if (dynamic_cast<BinaryOp*>(instr) || dynamic_cast<Load*>(instr)) {
+            Key key = KeyOf(table, instr);
+            std::map<Key, Value>::iterator v = table.values.find(key);
+            if (v != table.values.end() && IsReused(instr)
+                && table.numbers.count(v->second.holder)
+                && table.numbers[v->second.holder] == v->second.number) {
+                Value value = v->second;
+                if (value.holder == dst)
+                    b->code.erase(b->code.begin() + i--);
+                else
+                    b->code[i] = new Assign(dst, value.holder);
+                delete instr;
+                numReused++;
+                if (tracked) table.numbers[dst] = value.number;
+                continue;
+            }
+            if (tracked) {
+                Value value = { nextNumber++, dst };
+                table.numbers[dst] = value.number;
+                table.values[key] = value;
+            }
+            continue;
+        }
+        if (Store *st = dynamic_cast<Store*>(instr))
+            KillLoads(table, st);
+        else if (FlowGraph::IsCall(instr))
+            KillLoads(table, NULL);
+        if (!tracked) continue;
+        if (LoadConstant *lc = dynamic_cast<LoadConstant*>(instr))
+            table.numbers[dst] = NumberOfConstant(lc->GetValue());
+        else if (Assign *a = dynamic_cast<Assign*>(instr))
+            table.numbers[dst] = NumberOf(table, a->GetSrc());
+        else
+            table.numbers[dst] = nextNumber++;
+    }
+    for (size_t c = 0; c < b->domChildren.size(); c++)
+        Visit(b->domChildren[c], table);
+}
+
+void ValueNumbering::Run() {
+    graph.ComputeDominators();
+    Visit(graph.GetEntry(), Table());
+    PrintDebug("gvn", "%s: %d values reused", graph.GetName(), numReused);
+}
+
+void NumberValues(std::list<Instruction*> &code,
+                  std::list<Instruction*>::iterator begin,
+                  std::list<Instruction*>::iterator end) {
+    FlowGraph graph(begin, end);
+    ValueNumbering numbering(graph);
+    numbering.Run();
+    graph.WriteBack(code, begin, end);
+}
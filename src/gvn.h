@@ -0,0 +1,87 @@
+/* File: gvn.h
+ * -----------
+ * Dominator-based value numbering (Briggs, Cooper and Simpson, "Value
+ * Numbering") on the flow graph of one function.
+ *
+ * Every value computed by the function gets a number, so that two
+ * locations with the same number hold the same value. A BinaryOp or a
+ * Load is looked up in a table by its operator and the numbers of its
+ * operands (its base and offset for a Load); if the table has it and
+ * the location that holds it was not written since, the instruction is
+ * replaced by a copy of that location, which copy propagation and dead
+ * code elimination (copyprop.h, dce.h) then take away. The operands of
+ * commutative operators are ordered, and constants are numbered by
+ * their value, so a + 4 and 4 + a are found equal even when the two 4s
+ * are loaded into different temps. Comparisons are numbered but not
+ * reused, since one used only by a branch is fused into it.
+ *
+ * Within a block this is local value numbering. Each block then starts
+ * from the table at the end of its immediate dominator, as the blocks
+ * are visited down the dominator tree: a value computed in a dominator
+ * was computed on every path to the block. The Tac is not in SSA form,
+ * so the variables written on some path from the dominator to the block
+ * get new numbers at the start of the block.
+ *
+ * A Store or a call ends the Loads it could change: a Store keeps only
+ * the Loads from the same base at another offset, a call keeps none.
+ * The length of an array (offset -4) is never written after NewArray,
+ * so its Loads are kept. Globals may be written by any call and are
+ * given a new number each time they are read.
+ */
+
+#ifndef _H_gvn
+#define _H_gvn
+
+#include <list>
+#include <map>
+#include <vector>
+#include "tac.h"
+#include "cfg.h"
+
+class ValueNumbering
+{
+  private:
+    // The key of a value in the table: the kind of instruction computing
+    // it, its operator and its operands
+    struct Key {
+        int kind, op, a, b;
+        Key(int k, int o, int x, int y) : kind(k), op(o), a(x), b(y) {}
+        bool operator<(const Key &k) const;
+    };
+    // A value in the table and the location that holds it
+    struct Value {
+        int number;
+        Location *holder;
+    };
+    struct Table {
+        std::map<Location*, int> numbers;
+        std::map<Key, Value> values;
+    };
+
+    FlowGraph &graph;
+    int nextNumber;
+    std::map<int, int> constants;       // the number of each constant
+    std::vector<LocationSet> defs;      // the locations written in a block
+    std::vector<bool> writesMemory;     // whether a block has a Store or call
+    int numReused;
+
+    int NumberOf(Table &table, Location *loc);
+    int NumberOfConstant(int value);
+    Key KeyOf(Table &table, Instruction *instr);
+    void KillLoads(Table &table, Store *store);
+    void EnterBlock(BasicBlock *b, Table &table);
+    void Visit(BasicBlock *b, Table table);
+
+  public:
+    ValueNumbering(FlowGraph &graph);
+
+    // Replaces the redundant BinaryOps and Loads by copies
+    void Run();
+};
+
+// The function pass: numbers the values of the function [begin, end)
+void NumberValues(std::list<Instruction*> &code,
+                  std::list<Instruction*>::iterator begin,
+                  std::list<Instruction*>::iterator end);
+
+#endif
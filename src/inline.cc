@@ -0,0 +1,326 @@
+/* File: inline.cc
+ * ---------------
+ * Implementation of the inliner.
+ */
+
+#include <string.h>
+#include "inline.h"
+#include "cfg.h"
+#include "codegen.h"
+#include "utility.h"
+
+static const int MaxCalleeSize = 16;    // instructions in the body
+static const int MaxGrowthPercent = 20;
+
+Inliner::Inliner(std::list<Instruction*> &c)
+  : code(c), budget(c.size() * MaxGrowthPercent / 100) {}
+
+// The position past the EndFunc of the function starting at function
+Inliner::Iterator Inliner::End(Iterator function) {
+    return CodeGenerator::FunctionEnd(code, function);
+}
+
+// The number of instructions between the BeginFunc and the EndFunc,
+// counted up to MaxCalleeSize + 1 only
+int Inliner::BodySize(Iterator function) {
+    int size = 0;
+    Iterator p = function;
+    for (++p; !dynamic_cast<EndFunc*>(*++p) && size <= MaxCalleeSize; )
+        size++;
+    return size;
+}
+
+// The label of the function the call at call in function always
+// reaches, or NULL if the call is not to a function of the program or
+// its target is not unique
+const char *Inliner::Target(Iterator function, Iterator call) {
+    const char *target = NULL;
+    if (LCall *lcall = dynamic_cast<LCall*>(*call))
+        target = lcall->GetLabel();
+    if (ACall *acall = dynamic_cast<ACall*>(*call)) {
+        std::vector<Location*> srcs;
+        acall->GetSrcs(srcs);
+        Iterator p = call;
+        while (p != function && (*p)->GetDst() != srcs[0])
+            --p;
+        Load *load = dynamic_cast<Load*>(*p);
+        if (!load || load->GetOffset() < 0
+            || load->GetOffset() % CodeGenerator::VarSize != 0)
+            return NULL;
+        int slot = load->GetOffset() / CodeGenerator::VarSize;
+        for (size_t i = 0; i < vtables.size(); i++) {
+            List<const char*> *methods = vtables[i]->GetMethodLabels();
+            if (slot >= methods->NumElements()) continue;
+            if (target && strcmp(target, methods->Nth(slot))) return NULL;
+            target = methods->Nth(slot);
+        }
+    }
+    return target && functions.count(target) ? target : NULL;
+}
+
+// Copies an instruction that names no label
+static Instruction *Copy(Instruction *instr) {
+    if (LoadConstant *i = dynamic_cast<LoadConstant*>(instr))
+        return new LoadConstant(*i);
+    if (LoadStringConstant *i = dynamic_cast<LoadStringConstant*>(instr))
+        return new LoadStringConstant(*i);
+    if (LoadLabel *i = dynamic_cast<LoadLabel*>(instr))
+        return new LoadLabel(*i);
+    if (Assign *i = dynamic_cast<Assign*>(instr)) return new Assign(*i);
+    if (Load *i = dynamic_cast<Load*>(instr)) return new Load(*i);
+    if (Store *i = dynamic_cast<Store*>(instr)) return new Store(*i);
+    if (BinaryOp *i = dynamic_cast<BinaryOp*>(instr))
+        return new BinaryOp(*i);
+    if (PushParam *i = dynamic_cast<PushParam*>(instr))
+        return new PushParam(*i);
+    if (PopParams *i = dynamic_cast<PopParams*>(instr))
+        return new PopParams(*i);
+    if (LCall *i = dynamic_cast<LCall*>(instr)) return new LCall(*i);
+    if (ACall *i = dynamic_cast<ACall*>(instr)) return new ACall(*i);
+    Assert(0);
+    return NULL;
+}
+
+// The copy of the body of a callee at a call site, in the frame of the
+// caller
+class InlinedBody
+{
+  private:
+    BeginFunc *caller;
+    LocationSet written, params;
+    std::map<Location*, Location*> renamed;
+    std::map<std::string, const char*> labels;
+
+  public:
+    InlinedBody(BeginFunc *caller, BeginFunc *callee,
+                std::list<Instruction*>::iterator begin,
+                std::list<Instruction*>::iterator end);
+
+    // The variable of the caller standing for loc, a location of the
+    // callee. A parameter the callee never writes has one definition
+    // (the copy of the argument), so it is renamed to a temp, as are
+    // the temps of the callee.
+    Location *Rename(Location *loc);
+    const char *Relabel(const char *label);
+};
+
+InlinedBody::InlinedBody(BeginFunc *c, BeginFunc *callee,
+                         std::list<Instruction*>::iterator begin,
+                         std::list<Instruction*>::iterator end)
+  : caller(c) {
+    for (int i = 0; i < callee->GetParams()->NumElements(); i++)
+        params.insert(callee->GetParams()->Nth(i));
+    for (std::list<Instruction*>::iterator p = begin; p != end; ++p) {
+        if ((*p)->GetDst()) written.insert((*p)->GetDst());
+        if (Label *label = dynamic_cast<Label*>(*p))
+            labels[label->text()] = CodeGenerator::NewLabel();
+    }
+}
+
+Location *InlinedBody::Rename(Location *loc) {
+    if (loc == NULL || loc->GetSegment() != fpRelative) return loc;
+    Assert(loc->GetBase() == NULL);
+    std::map<Location*, Location*>::iterator r = renamed.find(loc);
+    if (r != renamed.end()) return r->second;
+    Location *to;
+    if (loc->IsTemp() || (params.count(loc) && !written.count(loc)))
+        to = CodeGenerator::NewTempVar(caller);
+    else
+        to = CodeGenerator::NewLocalVar(caller, loc->GetName());
+    renamed[loc] = to;
+    return to;
+}
+
+const char *InlinedBody::Relabel(const char *label) {
+    std::map<std::string, const char*>::iterator l = labels.find(label);
+    return l != labels.end() ? l->second : label;
+}
+
+/* Inlines the call at call in function to target if its body is small
+ * enough and the budget allows it. The PushParams before the call
+ * become copies of the arguments, and the call and its PopParams are
+ * replaced with the renamed body. On success, call is moved past the
+ * inlined code.
+ */
+bool Inliner::InlineCall(Iterator function, Iterator &call,
+                         const char *target) {
+    Iterator callee = functions[target];
+    int size = BodySize(callee);
+    if (size > MaxCalleeSize) return false;
+
+    Iterator first = call;
+    int numArgs = 0;
+    while (first != function) {
+        Iterator prev = first;
+        if (!dynamic_cast<PushParam*>(*--prev)) break;
+        first = prev;
+        numArgs++;
+    }
+    Iterator pop = call;
+    ++pop;
+    Iterator body = callee;
+    BeginFunc *begin = dynamic_cast<BeginFunc*>(*++body);
+    ++body;
+    if (pop == code.end() || !dynamic_cast<PopParams*>(*pop)
+        || numArgs != begin->GetParams()->NumElements())
+        return false;
+
+    // the call sequence: the arguments, the call and the PopParams, and
+    // for a method the loads of its address
+    int growth = size - numArgs - 2;
+    if (dynamic_cast<ACall*>(*call)) growth -= 2;
+    if (growth > budget) return false;
+    if (growth > 0) budget -= growth;
+
+    Iterator endFunc = End(callee);
+    --endFunc;
+    Iterator caller = function;
+    InlinedBody renaming(dynamic_cast<BeginFunc*>(*++caller), begin, body,
+                         endFunc);
+
+    // the last argument pushed is the first parameter
+    Iterator p = call;
+    for (int i = 0; i < numArgs; i++) {
+        --p;
+        std::vector<Location*> arg;
+        (*p)->GetSrcs(arg);
+        delete *p;
+        *p = new Assign(renaming.Rename(begin->GetParams()->Nth(i)), arg[0]);
+    }
+
+    Location *result = (*call)->GetDst();
+    const char *after = NULL;
+    for (p = body; p != endFunc; ++p) {
+        Instruction *instr = *p, *copy;
+        if (Label *label = dynamic_cast<Label*>(instr)) {
+            copy = new Label(renaming.Relabel(label->text()));
+        } else if (Goto *g = dynamic_cast<Goto*>(instr)) {
+            copy = new Goto(renaming.Relabel(g->branch_label()));
+        } else if (IfZ *ifz = dynamic_cast<IfZ*>(instr)) {
+            copy = new IfZ(renaming.Rename(ifz->GetTest()),
+                           renaming.Relabel(ifz->branch_label()));
+        } else if (IfCmp *ifc = dynamic_cast<IfCmp*>(instr)) {
+            copy = new IfCmp(ifc->GetOpCode(),
+                             renaming.Rename(ifc->GetOp1()),
+                             renaming.Rename(ifc->GetOp2()),
+                             ifc->GetImmediate(),
+                             renaming.Relabel(ifc->branch_label()));
+        } else if (JumpTable *jt = dynamic_cast<JumpTable*>(instr)) {
+            List<const char*> *targets = new List<const char*>;
+            for (int i = 0; i < jt->GetLabels()->NumElements(); i++)
+                targets->Append(renaming.Relabel(jt->GetLabels()->Nth(i)));
+            copy = new JumpTable(renaming.Rename(jt->GetIndex()),
+                                 jt->GetFirst(), targets);
+        } else if (dynamic_cast<Return*>(instr)) {
+            std::vector<Location*> val;
+            instr->GetSrcs(val);
+            if (result && !val.empty())
+                code.insert(call,
+                            new Assign(result, renaming.Rename(val[0])));
+            Iterator next = p;
+            if (++next == endFunc) continue;
+            if (!after) after = CodeGenerator::NewLabel();
+            copy = new Goto(after);
+        } else {
+            copy = Copy(instr);
+            std::vector<Location*> srcs;
+            copy->GetSrcs(srcs);
+            for (size_t i = 0; i < srcs.size(); i++)
+                if (renaming.Rename(srcs[i]) != srcs[i])
+                    copy->ReplaceSrc(srcs[i], renaming.Rename(srcs[i]));
+            if (copy->GetDst())
+                copy->ReplaceDst(renaming.Rename(copy->GetDst()));
+        }
+        code.insert(call, copy);
+    }
+    if (after) code.insert(call, new Label(after));
+
+    delete *call;
+    delete *pop;
+    code.erase(call);
+    call = code.erase(pop);
+    inlined.insert(target);
+    return true;
+}
+
+// Handles the functions name calls, then the calls of name itself
+void Inliner::Visit(const std::string &name) {
+    if (done.count(name) || visiting.count(name)) return;
+    visiting.insert(name);
+    Iterator function = functions[name], end = End(function);
+    for (Iterator p = function; p != end; ++p) {
+        const char *target =
+            FlowGraph::IsCall(*p) ? Target(function, p) : NULL;
+        if (target) Visit(target);
+    }
+
+    int numInlined = 0;
+    Iterator p = function;
+    while (p != end) {
+        const char *target =
+            FlowGraph::IsCall(*p) ? Target(function, p) : NULL;
+        if (target && name != target && done.count(target)
+            && InlineCall(function, p, target))
+            numInlined++;
+        else
+            ++p;
+    }
+    if (numInlined)
+        PrintDebug("inline", "%s: %d calls inlined", name.c_str(),
+                   numInlined);
+    visiting.erase(name);
+    done.insert(name);
+}
+
+// Deletes the functions inlined that are no longer called anywhere
+void Inliner::RemoveUncalled() {
+    std::set<std::string> used;
+    for (Iterator p = code.begin(); p != code.end(); ++p)
+        if (LCall *call = dynamic_cast<LCall*>(*p))
+            used.insert(call->GetLabel());
+    for (size_t i = 0; i < vtables.size(); i++) {
+        List<const char*> *methods = vtables[i]->GetMethodLabels();
+        for (int j = 0; j < methods->NumElements(); j++)
+            used.insert(methods->Nth(j));
+    }
+    int numRemoved = 0;
+    std::set<std::string>::iterator f;
+    for (f = inlined.begin(); f != inlined.end(); ++f) {
+        if (used.count(*f) || *f == "main") continue;
+        Iterator p = functions[*f], end = End(p);
+        while (p != end) {
+            delete *p;
+            p = code.erase(p);
+        }
+        numRemoved++;
+    }
+    PrintDebug("inline", "%d functions removed, %d instructions of budget "
+               "left", numRemoved, budget);
+}
+
+void Inliner::Run() {
+    std::vector<std::string> order;
+    Iterator p = code.begin();
+    while (p != code.end()) {
+        Iterator end = End(p);
+        if (end != p) {
+            const char *name = dynamic_cast<Label*>(*p)->text();
+            functions[name] = p;
+            order.push_back(name);
+            p = end;
+            continue;
+        }
+        if (VTable *vt = dynamic_cast<VTable*>(*p))
+            vtables.push_back(vt);
+        ++p;
+    }
+    if (functions.count("main")) Visit("main");
+    for (size_t i = 0; i < order.size(); i++)
+        Visit(order[i]);
+    RemoveUncalled();
+}
+
+void InlineCalls(std::list<Instruction*> &code) {
+    Inliner inliner(code);
+    inliner.Run();
+}
@@ -0,0 +1,75 @@
+/* File: inline.h
+ * --------------
+ * Inlining of small functions and methods into their callers.
+ *
+ * The call graph has an edge from a function to each function it calls
+ * through an LCall, and to the method an ACall reaches when its target
+ * is unique. Call::Emit loads the address of a method from the slot
+ * of the vtable of the object, and the target is unique when every
+ * vtable of the program having that slot holds the same method there:
+ * whatever the class of the object, that method is called.
+ *
+ * The functions are handled bottom-up, callees before their callers,
+ * so a function is inlined with the calls of its own body already
+ * inlined. A call to a function whose handling has not finished (a
+ * recursive call) is never inlined.
+ *
+ * A call is inlined when the body of the callee (its instructions from
+ * the BeginFunc to the EndFunc) has at most MaxCalleeSize instructions.
+ * The PushParams of the arguments become copies into new variables of
+ * the caller standing for the parameters, and the body is copied in
+ * place of the call with each local, parameter and temp of the callee
+ * renamed to a new variable in the frame of the caller (see
+ * CodeGenerator::NewLocalVar) and each of its labels to a new label. A
+ * Return becomes a copy into the result of the call and a Goto to the
+ * code after the body. The copies and the vtable loads left unused are
+ * left to the passes that follow (see copyprop.h and dce.h).
+ *
+ * An inlined body larger than the call sequence it replaces makes the
+ * program grow. The growth of the whole program is bounded by a budget
+ * of MaxGrowthPercent percent of its size, spent on the calls in the
+ * order they are met. A function that is no longer called after its
+ * calls were inlined, and is not a method in a vtable, is deleted.
+ *
+ * The debug key "inline" reports the calls inlined in each function.
+ */
+
+#ifndef _H_inline
+#define _H_inline
+
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "tac.h"
+
+class Inliner
+{
+  private:
+    typedef std::list<Instruction*>::iterator Iterator;
+
+    std::list<Instruction*> &code;
+    std::map<std::string, Iterator> functions;   // label -> first Label
+    std::vector<VTable*> vtables;
+    std::set<std::string> done, visiting, inlined;
+    int budget;
+
+    Iterator End(Iterator function);
+    int BodySize(Iterator function);
+    const char *Target(Iterator function, Iterator call);
+    void Visit(const std::string &name);
+    bool InlineCall(Iterator function, Iterator &call, const char *target);
+    void RemoveUncalled();
+
+  public:
+    Inliner(std::list<Instruction*> &code);
+
+    // Inlines the small callees of every function, within the budget
+    void Run();
+};
+
+// The program pass: inlines the calls to small functions and methods
+void InlineCalls(std::list<Instruction*> &code);
+
+#endif
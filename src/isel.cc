@@ -0,0 +1,649 @@
+/* File: isel.cc
+ * -------------
+ * Implementation of the tree instruction selector: the rule table, the
+ * labeler and reducer of TreeInstruction, and SelectTrees.
+ */
+
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <set>
+#include "isel.h"
+#include "utility.h"
+
+static const int Chain = -1;           // the op of a chain rule
+static const int Infinity = 1 << 20;
+
+/* A rule reduces a node with operator op, whose operands are reduced to
+ * the nonterminals kids, to the nonterminal lhs. A chain rule reduces
+ * the nonterminal kids[0] of a node to lhs. The templates may use %r
+ * for the register of the result, %0 and %1 for the operands, %v for
+ * the value of a constant, %l for the branch target and %c for the
+ * branch instruction of an IfCmp. The instructions of code are emitted
+ * (one per line) and value is how the result is then written as an
+ * operand; value defaults to %r.
+ */
+struct Rule {
+    int lhs;
+    int op;
+    int kids[2];
+    int cost;
+    const char *code;
+    const char *value;
+    bool (*fits)(int);      // for OpConst, whether the constant matches
+    int (*adjust)(int);     // for OpConst, the value written for %v
+};
+
+static bool FitsImm(int v)     { return v >= -32768 && v <= 32767; }
+static bool FitsImmNext(int v) { return FitsImm(v) && FitsImm(v + 1); }
+static bool FitsNegImm(int v)  { return v != (int)0x80000000 && FitsImm(-v); }
+static bool FitsUImm(int v)    { return v >= 0 && v <= 65535; }
+static bool IsPowerOf2(int v)  { return v > 0 && (v & (v - 1)) == 0; }
+static bool IsZero(int v)      { return v == 0; }
+static int Next(int v)         { return v + 1; }
+static int Negate(int v)       { return -v; }
+static int Log2(int v) {
+    int s = 0;
+    while ((1 << s) != v) s++;
+    return s;
+}
+
+// The costs count the machine instructions, including the ones SPIM
+// expands the pseudo-instructions to.
+static const Rule rules[] = {
+    // leaves
+    {NtReg, OpLeaf, {}, 0, NULL, NULL, NULL, NULL},
+    {NtReg, OpConst, {}, 1, "li %r, %v", NULL, NULL, NULL},
+    {NtImm, OpConst, {}, 0, NULL, "%v", FitsImm, NULL},
+    {NtImmNext, OpConst, {}, 0, NULL, "%v", FitsImmNext, Next},
+    {NtNegImm, OpConst, {}, 0, NULL, "%v", FitsNegImm, Negate},
+    {NtUImm, OpConst, {}, 0, NULL, "%v", FitsUImm, NULL},
+    {NtShift, OpConst, {}, 0, NULL, "%v", IsPowerOf2, Log2},
+    {NtZero, OpConst, {}, 0, NULL, "$zero", IsZero, NULL},
+
+    // addressing modes (an address add cannot overflow, so no trap)
+    {NtAddr, Chain, {NtReg}, 0, NULL, "0(%0)", NULL, NULL},
+    {NtAddr, BinaryOp::Add, {NtReg, NtImm}, 0, NULL, "%1(%0)", NULL, NULL},
+    {NtAddr, BinaryOp::Add, {NtReg, NtReg}, 1, "addu %r, %0, %1", "0(%r)",
+     NULL, NULL},
+
+    // arithmetic
+    {NtReg, BinaryOp::Add, {NtReg, NtReg}, 1, "add %r, %0, %1", NULL, NULL, NULL},
+    {NtReg, BinaryOp::Add, {NtReg, NtImm}, 1, "addi %r, %0, %1", NULL, NULL, NULL},
+    {NtReg, BinaryOp::Add, {NtImm, NtReg}, 1, "addi %r, %1, %0", NULL, NULL, NULL},
+    {NtReg, BinaryOp::Sub, {NtReg, NtReg}, 1, "sub %r, %0, %1", NULL, NULL, NULL},
+    {NtReg, BinaryOp::Sub, {NtReg, NtNegImm}, 1, "addi %r, %0, %1", NULL, NULL, NULL},
+    {NtReg, BinaryOp::Sub, {NtZero, NtReg}, 1, "sub %r, $zero, %1", NULL, NULL, NULL},
+    {NtReg, BinaryOp::Mul, {NtReg, NtReg}, 2, "mul %r, %0, %1", NULL, NULL, NULL},
+    {NtReg, BinaryOp::Mul, {NtReg, NtShift}, 1, "sll %r, %0, %1", NULL, NULL, NULL},
+    {NtReg, BinaryOp::Mul, {NtShift, NtReg}, 1, "sll %r, %1, %0", NULL, NULL, NULL},
+    {NtReg, BinaryOp::Div, {NtReg, NtReg}, 4, "div %r, %0, %1", NULL, NULL, NULL},
+    {NtReg, BinaryOp::Mod, {NtReg, NtReg}, 4, "rem %r, %0, %1", NULL, NULL, NULL},
+    {NtReg, BinaryOp::And, {NtReg, NtReg}, 1, "and %r, %0, %1", NULL, NULL, NULL},
+    {NtReg, BinaryOp::And, {NtReg, NtUImm}, 1, "andi %r, %0, %1", NULL, NULL, NULL},
+    {NtReg, BinaryOp::Or, {NtReg, NtReg}, 1, "or %r, %0, %1", NULL, NULL, NULL},
+    {NtReg, BinaryOp::Or, {NtReg, NtUImm}, 1, "ori %r, %0, %1", NULL, NULL, NULL},
+
+    // comparisons
+    {NtReg, BinaryOp::Eq, {NtReg, NtReg}, 3, "seq %r, %0, %1", NULL, NULL, NULL},
+    {NtReg, BinaryOp::Eq, {NtReg, NtZero}, 1, "sltiu %r, %0, 1", NULL, NULL, NULL},
+    {NtReg, BinaryOp::Ne, {NtReg, NtReg}, 3, "sne %r, %0, %1", NULL, NULL, NULL},
+    {NtReg, BinaryOp::Ne, {NtReg, NtZero}, 1, "sltu %r, $zero, %0", NULL, NULL, NULL},
+    {NtReg, BinaryOp::Lt, {NtReg, NtReg}, 1, "slt %r, %0, %1", NULL, NULL, NULL},
+    {NtReg, BinaryOp::Lt, {NtReg, NtImm}, 1, "slti %r, %0, %1", NULL, NULL, NULL},
+    {NtReg, BinaryOp::Le, {NtReg, NtReg}, 2, "sle %r, %0, %1", NULL, NULL, NULL},
+    {NtReg, BinaryOp::Le, {NtReg, NtImmNext}, 1, "slti %r, %0, %1", NULL, NULL, NULL},
+    {NtReg, BinaryOp::Gt, {NtReg, NtReg}, 1, "sgt %r, %0, %1", NULL, NULL, NULL},
+    {NtReg, BinaryOp::Gt, {NtReg, NtImmNext}, 2, "slti %r, %0, %1\nxori %r, %r, 1",
+     NULL, NULL, NULL},
+    {NtReg, BinaryOp::Ge, {NtReg, NtReg}, 2, "sge %r, %0, %1", NULL, NULL, NULL},
+    {NtReg, BinaryOp::Ge, {NtReg, NtImm}, 2, "slti %r, %0, %1\nxori %r, %r, 1",
+     NULL, NULL, NULL},
+
+    // memory
+    {NtReg, OpLoad, {NtAddr}, 1, "lw %r, %0", NULL, NULL, NULL},
+    {NtStmt, OpStore, {NtAddr, NtReg}, 1, "sw %1, %0", NULL, NULL, NULL},
+
+    // branches
+    {NtStmt, OpIfZ, {NtReg}, 1, "beqz %0, %l", NULL, NULL, NULL},
+    {NtStmt, OpIfCmp, {NtReg, NtReg}, 1, "%c %0, %1, %l", NULL, NULL, NULL},
+    {NtStmt, OpIfCmp, {NtReg, NtZero}, 1, "%cz %0, %l", NULL, NULL, NULL},
+    {NtStmt, OpIfCmp, {NtReg, NtImm}, 2, "%c %0, %1, %l", NULL, NULL, NULL},
+};
+static const int NumRules = sizeof(rules) / sizeof(rules[0]);
+
+TreeNode::TreeNode(int o)
+  : op(o), code(BinaryOp::Add), var(NULL), value(0), numKids(0) {
+    kids[0] = kids[1] = NULL;
+}
+
+TreeNode::~TreeNode() {
+    for (int i = 0; i < numKids; i++)
+        delete kids[i];
+}
+
+/* The labeler: computes bottom-up the cheapest rule reducing each node
+ * to each nonterminal, then closes the costs under the chain rules.
+ */
+static void LabelTree(TreeNode *n) {
+    for (int i = 0; i < n->numKids; i++)
+        LabelTree(n->kids[i]);
+    for (int nt = 0; nt < NumNonterms; nt++) {
+        n->cost[nt] = Infinity;
+        n->rule[nt] = -1;
+    }
+    for (int r = 0; r < NumRules; r++) {
+        const Rule &rule = rules[r];
+        if (rule.op != n->op || (rule.fits && !rule.fits(n->value)))
+            continue;
+        int cost = rule.cost;
+        for (int i = 0; i < n->numKids; i++)
+            cost += n->kids[i]->cost[rule.kids[i]];
+        if (cost < n->cost[rule.lhs]) {
+            n->cost[rule.lhs] = cost;
+            n->rule[rule.lhs] = r;
+        }
+    }
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int r = 0; r < NumRules; r++) {
+            const Rule &rule = rules[r];
+            if (rule.op != Chain) continue;
+            int cost = rule.cost + n->cost[rule.kids[0]];
+            if (cost < n->cost[rule.lhs]) {
+                n->cost[rule.lhs] = cost;
+                n->rule[rule.lhs] = r;
+                changed = true;
+            }
+        }
+    }
+}
+
+// Whether the reduction to nt leaves a register to hold for the parent
+static int Held(int nt) {
+    return nt == NtReg || nt == NtAddr;
+}
+
+static int Need(TreeNode *n, int nt);
+
+// The operands are evaluated in decreasing order of their register need
+// (Sethi-Ullman order), which is the order that needs the fewest.
+static void EvaluationOrder(TreeNode *n, const Rule &rule, int order[2]) {
+    order[0] = 0;
+    order[1] = 1;
+    if (n->numKids == 2 && Need(n->kids[1], rule.kids[1])
+                           > Need(n->kids[0], rule.kids[0]))
+        std::swap(order[0], order[1]);
+}
+
+// The number of registers reserved at the same time to reduce n to nt
+static int Need(TreeNode *n, int nt) {
+    Assert(n->rule[nt] != -1);
+    const Rule &rule = rules[n->rule[nt]];
+    if (rule.op == Chain)
+        return std::max(Need(n, rule.kids[0]), Held(nt));
+    if (n->op == OpLeaf)
+        return 1;
+    int order[2], held = 0, need = 0;
+    EvaluationOrder(n, rule, order);
+    for (int i = 0; i < n->numKids; i++) {
+        int k = order[i];
+        need = std::max(need, held + Need(n->kids[k], rule.kids[k]));
+        held += Held(rule.kids[k]);
+    }
+    if (rule.code && Held(rule.lhs))
+        need = std::max(need, 1);
+    return need;
+}
+
+static const char *branchName[] = { "beq", "bne", "blt", "ble", "bgt", "bge" };
+
+static std::string Describe(TreeNode *n, bool top = false) {
+    char buf[32];
+    switch (n->op) {
+      case OpLeaf:
+        return n->var->GetName();
+      case OpConst:
+        sprintf(buf, "%d", n->value);
+        return buf;
+      case OpLoad:
+        return "*(" + Describe(n->kids[0], true) + ")";
+      case OpStore:
+        return "*(" + Describe(n->kids[0], true) + ") = "
+            + Describe(n->kids[1], true);
+      case OpIfZ:
+        return "IfZ " + Describe(n->kids[0], true);
+      case OpIfCmp:
+        return "If " + Describe(n->kids[0]) + " "
+            + BinaryOp::opName[n->code] + " " + Describe(n->kids[1]);
+      default: {
+        std::string s = Describe(n->kids[0]) + " " + BinaryOp::opName[n->op]
+            + " " + Describe(n->kids[1]);
+        return top ? s : "(" + s + ")";
+      }
+    }
+}
+
+TreeInstruction::TreeInstruction(Instruction *r, TreeNode *t, Location *d)
+  : root(r), tree(t), dst(d), label(NULL) {
+    std::string s = Describe(tree, true);
+    if (IfZ *ifz = dynamic_cast<IfZ*>(root))
+        label = ifz->branch_label();
+    else if (IfCmp *ifc = dynamic_cast<IfCmp*>(root))
+        label = ifc->branch_label();
+    if (dst)
+        s = std::string(dst->GetName()) + " = " + s;
+    if (label)
+        s += std::string(" Goto ") + label;
+    snprintf(printed, sizeof(printed), "%s", s.c_str());
+}
+
+TreeInstruction::~TreeInstruction() {
+    delete tree;
+    delete root;
+}
+
+static void AddLeaves(TreeNode *n, std::vector<Location*> &srcs) {
+    if (n->op == OpLeaf)
+        srcs.push_back(n->var);
+    for (int i = 0; i < n->numKids; i++)
+        AddLeaves(n->kids[i], srcs);
+}
+
+void TreeInstruction::GetSrcs(std::vector<Location*> &srcs) {
+    AddLeaves(tree, srcs);
+}
+
+Instruction *TreeInstruction::RootOf(Instruction *instr) {
+    TreeInstruction *t = dynamic_cast<TreeInstruction*>(instr);
+    return t ? t->root : instr;
+}
+
+// Fills in the template of rule for node n
+static std::string Expand(const char *tmpl, const Rule &rule, TreeNode *n,
+                          const std::string &result, std::string kids[2],
+                          const char *label) {
+    std::string s;
+    char buf[32];
+    for (const char *c = tmpl; *c; c++) {
+        if (*c != '%') {
+            s += *c;
+            continue;
+        }
+        switch (*++c) {
+          case 'r': s += result; break;
+          case '0': s += kids[0]; break;
+          case '1': s += kids[1]; break;
+          case 'l': s += label; break;
+          case 'c': s += branchName[n->code - BinaryOp::Eq]; break;
+          case 'v':
+            sprintf(buf, "%d", rule.adjust ? rule.adjust(n->value) : n->value);
+            s += buf;
+            break;
+          default:
+            Failure("Bad template %s", tmpl);
+        }
+    }
+    return s;
+}
+
+/* The reducer: emits the instructions of the cheapest cover of n as nt
+ * and returns the resulting operand. The operand registers are reserved
+ * while they are needed; the result goes to a scratch register, reusing
+ * one of an operand when possible, except at the root of a tree with a
+ * destination, where it goes to the register of the destination.
+ */
+TreeInstruction::Operand TreeInstruction::Reduce(Mips *mips, TreeNode *n,
+                                                 int nt, bool isRoot) {
+    Assert(n->rule[nt] != -1);
+    const Rule &rule = rules[n->rule[nt]];
+    Operand kids[2], result;
+    for (int i = 0; i < 2; i++) {
+        kids[i].reg = Mips::zero;
+        kids[i].isScratch = false;
+    }
+    result = kids[0];
+
+    if (rule.op == Chain) {
+        kids[0] = Reduce(mips, n, rule.kids[0], false);
+    } else if (n->op == OpLeaf) {
+        result.reg = mips->ReserveOperand(n->var);
+        result.text = mips->NameOf(result.reg);
+        return result;
+    } else {
+        int order[2];
+        EvaluationOrder(n, rule, order);
+        for (int i = 0; i < n->numKids; i++)
+            kids[order[i]] = Reduce(mips, n->kids[order[i]],
+                                    rule.kids[order[i]], false);
+    }
+
+    // the operands keep their registers only if the result is written
+    // with them (an addressing mode)
+    bool writesResult = rule.code && strstr(rule.code, "%r");
+    if (!writesResult) {
+        result.reg = kids[0].reg;
+        result.isScratch = kids[0].isScratch;
+        if (kids[1].reg) mips->ReleaseRegister(kids[1].reg);
+    } else if (isRoot && dst) {
+        for (int i = 0; i < 2; i++)
+            if (kids[i].reg) mips->ReleaseRegister(kids[i].reg);
+        result.reg = mips->GetResultRegister(dst, kids[0].reg, kids[1].reg);
+    } else {
+        for (int i = 0; i < 2; i++) {
+            if (kids[i].isScratch && !result.reg)
+                result.reg = kids[i].reg;
+            else if (kids[i].reg)
+                mips->ReleaseRegister(kids[i].reg);
+        }
+        if (!result.reg)
+            result.reg = mips->ReserveScratch(kids[0].reg, kids[1].reg);
+        result.isScratch = true;
+    }
+
+    std::string reg = result.reg ? mips->NameOf(result.reg) : "";
+    std::string texts[2] = { kids[0].text, kids[1].text };
+    if (rule.code) {
+        if (n->op == OpIfZ || n->op == OpIfCmp)
+            mips->SpillBeforeBranch();
+        std::string code = Expand(rule.code, rule, n, reg, texts, label);
+        size_t start = 0, end;
+        do {
+            end = code.find('\n', start);
+            Mips::Emit("%s", code.substr(start, end - start).c_str());
+            start = end + 1;
+        } while (end != std::string::npos);
+    }
+    result.text = Expand(rule.value ? rule.value : "%r", rule, n, reg, texts,
+                         label);
+    return result;
+}
+
+void TreeInstruction::EmitSpecific(Mips *mips) {
+    Reduce(mips, tree, dst ? NtReg : NtStmt, true);
+}
+
+/* SelectTrees
+ * -----------
+ * Walks the function in order. The instructions computing a temp that
+ * has one definition and one use are kept pending instead of being
+ * placed: a later instruction reading the temp takes its tree as an
+ * operand. A pending tree is placed at its own position (which is
+ * always correct) when it cannot be moved further: at the end of the
+ * block or at a call, when one of its leaves is written, or when memory
+ * is written if it loads from memory. A tree is only folded into
+ * another if the result can be evaluated within the registers Mips has
+ * to spare for it.
+ */
+
+namespace {
+
+struct Pending {
+    std::list<Instruction*>::iterator pos;
+    TreeNode *node;
+    // the positions of the instructions folded into node
+    std::vector<std::list<Instruction*>::iterator> folded;
+    std::set<Location*> leaves;
+    bool readsMemory;
+};
+
+class TreeBuilder
+{
+    std::list<Instruction*> &code;
+    std::map<Location*, int> numDefs, numUses;
+    std::map<Location*, Pending> pending;
+    int budget;
+
+    // the operand slots of the node being built filled with a pending tree
+    std::vector<std::pair<TreeNode**, Location*> > slots;
+    std::vector<Location*> leaves;
+
+    TreeNode *Leaf(Location *loc);
+    TreeNode *Const(int value);
+    void SetKid(TreeNode *n, int i, Location *loc);
+    void SetKid(TreeNode *n, int i, int value);
+    void SetAddress(TreeNode *n, int i, Location *ref, int offset);
+    void BuildNode(Instruction *instr, TreeNode **top);
+    void FitBudget(TreeNode *&top, int goal);
+    void Commit(Pending &entry);
+    void Place(Pending &entry);
+    void Materialize(Location *temp);
+
+  public:
+    TreeBuilder(std::list<Instruction*> &c,
+                std::list<Instruction*>::iterator begin,
+                std::list<Instruction*>::iterator end);
+    void Run(std::list<Instruction*>::iterator begin,
+             std::list<Instruction*>::iterator end);
+};
+
+}
+
+TreeBuilder::TreeBuilder(std::list<Instruction*> &c,
+                         std::list<Instruction*>::iterator begin,
+                         std::list<Instruction*>::iterator end) : code(c) {
+    for (std::list<Instruction*>::iterator p = begin; p != end; ++p) {
+        if (Location *dst = (*p)->GetDst()) numDefs[dst]++;
+        std::vector<Location*> srcs;
+        (*p)->GetSrcs(srcs);
+        for (size_t i = 0; i < srcs.size(); i++) numUses[srcs[i]]++;
+    }
+    // with a register allocation, Mips only has $v0 and $v1 to spare,
+    // and without caching (-O0) only its three scratch registers
+    int level = GetOptimizationLevel();
+    budget = level >= 2 ? 2 : level == 1 ? 4 : 3;
+}
+
+TreeNode *TreeBuilder::Leaf(Location *loc) {
+    TreeNode *n = new TreeNode(OpLeaf);
+    n->var = loc;
+    leaves.push_back(loc);
+    return n;
+}
+
+TreeNode *TreeBuilder::Const(int value) {
+    TreeNode *n = new TreeNode(OpConst);
+    n->value = value;
+    return n;
+}
+
+// Makes loc operand i of n, taking its pending tree if it has one
+void TreeBuilder::SetKid(TreeNode *n, int i, Location *loc) {
+    std::map<Location*, Pending>::iterator it = pending.find(loc);
+    if (it != pending.end()) {
+        n->kids[i] = it->second.node;
+        slots.push_back(std::make_pair(&n->kids[i], loc));
+    } else {
+        n->kids[i] = Leaf(loc);
+    }
+}
+
+void TreeBuilder::SetKid(TreeNode *n, int i, int value) {
+    n->kids[i] = Const(value);
+}
+
+// Makes the address ref + offset operand i of n
+void TreeBuilder::SetAddress(TreeNode *n, int i, Location *ref, int offset) {
+    if (offset == 0) {
+        SetKid(n, i, ref);
+        return;
+    }
+    TreeNode *add = new TreeNode(BinaryOp::Add);
+    add->numKids = 2;
+    SetKid(add, 0, ref);
+    SetKid(add, 1, offset);
+    n->kids[i] = add;
+}
+
+/* Builds in top the tree of instr, with the pending trees of its
+ * operands, or sets it to NULL if instr is not an expression or a
+ * statement handled by the selector. For an Assign, the tree is that of
+ * its source, if it is pending.
+ */
+void TreeBuilder::BuildNode(Instruction *instr, TreeNode **top) {
+    TreeNode *n = NULL;
+    slots.clear();
+    leaves.clear();
+    if (LoadConstant *lc = dynamic_cast<LoadConstant*>(instr)) {
+        n = Const(lc->GetValue());
+    } else if (BinaryOp *b = dynamic_cast<BinaryOp*>(instr)) {
+        n = new TreeNode(b->GetOpCode());
+        n->numKids = 2;
+        SetKid(n, 0, b->GetOp1());
+        if (b->GetOp2())
+            SetKid(n, 1, b->GetOp2());
+        else
+            SetKid(n, 1, b->GetImmediate());
+    } else if (Load *ld = dynamic_cast<Load*>(instr)) {
+        n = new TreeNode(OpLoad);
+        n->numKids = 1;
+        SetAddress(n, 0, ld->GetReference(), ld->GetOffset());
+    } else if (Store *st = dynamic_cast<Store*>(instr)) {
+        n = new TreeNode(OpStore);
+        n->numKids = 2;
+        SetAddress(n, 0, st->GetReference(), st->GetOffset());
+        SetKid(n, 1, st->GetValue());
+    } else if (IfZ *ifz = dynamic_cast<IfZ*>(instr)) {
+        std::vector<Location*> test;
+        ifz->GetSrcs(test);
+        n = new TreeNode(OpIfZ);
+        n->numKids = 1;
+        SetKid(n, 0, test[0]);
+    } else if (IfCmp *ifc = dynamic_cast<IfCmp*>(instr)) {
+        std::vector<Location*> ops;
+        ifc->GetSrcs(ops);
+        n = new TreeNode(OpIfCmp);
+        n->code = ifc->GetOpCode();
+        n->numKids = 2;
+        SetKid(n, 0, ops[0]);
+        if (ops.size() > 1)
+            SetKid(n, 1, ops[1]);
+        else
+            SetKid(n, 1, ifc->GetImmediate());
+    } else if (Assign *a = dynamic_cast<Assign*>(instr)) {
+        std::vector<Location*> src;
+        a->GetSrcs(src);
+        std::map<Location*, Pending>::iterator it = pending.find(src[0]);
+        if (it == pending.end()) {
+            *top = NULL;
+            return;
+        }
+        slots.push_back(std::make_pair(top, src[0]));
+        n = it->second.node;
+    }
+    *top = n;
+}
+
+/* Makes sure the tree can be evaluated within the budget of registers,
+ * putting back the pending trees of the operands (as plain variables)
+ * one at a time until it can. A tree without pending operands is left
+ * as it is, since Mips can always translate its instruction alone.
+ */
+void TreeBuilder::FitBudget(TreeNode *&top, int goal) {
+    while (true) {
+        LabelTree(top);
+        if (slots.empty() || Need(top, goal) <= budget) return;
+        size_t worst = 0;
+        for (size_t i = 1; i < slots.size(); i++)
+            if (Need(*slots[i].first, NtReg)
+                > Need(*slots[worst].first, NtReg))
+                worst = i;
+        *slots[worst].first = Leaf(slots[worst].second);
+        slots.erase(slots.begin() + worst);
+    }
+}
+
+// Takes the pending trees used by the node just built into entry
+void TreeBuilder::Commit(Pending &entry) {
+    entry.leaves.insert(leaves.begin(), leaves.end());
+    for (size_t i = 0; i < slots.size(); i++) {
+        Pending &kid = pending[slots[i].second];
+        entry.folded.push_back(kid.pos);
+        entry.folded.insert(entry.folded.end(), kid.folded.begin(),
+                            kid.folded.end());
+        entry.leaves.insert(kid.leaves.begin(), kid.leaves.end());
+        entry.readsMemory |= kid.readsMemory;
+        pending.erase(slots[i].second);
+    }
+}
+
+// Replaces the instruction at entry.pos by its tree, if it has folded
+// the instructions of others
+void TreeBuilder::Place(Pending &entry) {
+    if (entry.folded.empty()) {
+        delete entry.node;
+        return;
+    }
+    Instruction *root = *entry.pos;
+    Location *dst = root->GetDst();
+    *entry.pos = new TreeInstruction(root, entry.node, dst);
+    for (size_t i = 0; i < entry.folded.size(); i++) {
+        delete *entry.folded[i];
+        code.erase(entry.folded[i]);
+    }
+}
+
+void TreeBuilder::Materialize(Location *temp) {
+    Pending entry = pending[temp];
+    pending.erase(temp);
+    Place(entry);
+}
+
+void TreeBuilder::Run(std::list<Instruction*>::iterator begin,
+                      std::list<Instruction*>::iterator end) {
+    for (std::list<Instruction*>::iterator p = begin; p != end; ++p) {
+        Instruction *instr = *p;
+        Location *dst = instr->GetDst();
+        Pending entry;
+        entry.pos = p;
+        entry.readsMemory = dynamic_cast<Load*>(instr) != NULL;
+        TreeNode *top = NULL;
+        BuildNode(instr, &top);
+        bool isStmt = dynamic_cast<Store*>(instr) || dynamic_cast<IfZ*>(instr)
+            || dynamic_cast<IfCmp*>(instr);
+        if (top) FitBudget(top, isStmt ? NtStmt : NtReg);
+        if (top && dynamic_cast<Assign*>(instr) && slots.empty()) {
+            // the source of the Assign is a plain variable after all
+            delete top;
+            top = NULL;
+        }
+        entry.node = top;
+        if (top) Commit(entry);
+
+        // place the pending trees that cannot be moved past instr
+        std::vector<Location*> blocked;
+        bool barrier = !(dynamic_cast<LoadConstant*>(instr)
+                         || dynamic_cast<LoadStringConstant*>(instr)
+                         || dynamic_cast<LoadLabel*>(instr)
+                         || dynamic_cast<Assign*>(instr)
+                         || dynamic_cast<Load*>(instr)
+                         || dynamic_cast<Store*>(instr)
+                         || dynamic_cast<BinaryOp*>(instr)
+                         || dynamic_cast<PushParam*>(instr)
+                         || dynamic_cast<PopParams*>(instr));
+        for (std::map<Location*, Pending>::iterator it = pending.begin();
+             it != pending.end(); ++it)
+            if (barrier || (dst && it->second.leaves.count(dst))
+                || (dynamic_cast<Store*>(instr) && it->second.readsMemory))
+                blocked.push_back(it->first);
+        for (size_t i = 0; i < blocked.size(); i++)
+            Materialize(blocked[i]);
+
+        if (!top) continue;
+        if (dst && dst->IsTemp() && numDefs[dst] == 1 && numUses[dst] == 1
+            && !dynamic_cast<Assign*>(instr))
+            pending[dst] = entry;
+        else
+            Place(entry);
+    }
+    while (!pending.empty())
+        Materialize(pending.begin()->first);
+}
+
+void SelectTrees(std::list<Instruction*> &code,
+                 std::list<Instruction*>::iterator begin,
+                 std::list<Instruction*>::iterator end) {
+    TreeBuilder builder(code, begin, end);
+    builder.Run(begin, end);
+}
@@ -0,0 +1,108 @@
+/* File: isel.h
+ * ------------
+ * Tree-pattern instruction selection in the style of BURS (bottom-up
+ * rewrite systems).
+ *
+ * SelectTrees rebuilds small expression trees from the TAC of one
+ * function: an instruction computing a temp that is used only once,
+ * later in the same basic block, is folded into the instruction using
+ * it, as long as nothing in between changes what it reads (its
+ * variables, or memory for a Load). The instruction at the root of
+ * each tree is replaced by a TreeInstruction holding the whole tree,
+ * so the folded temps never need a register or a stack slot.
+ *
+ * A TreeInstruction is translated by covering its tree with the rules
+ * of the table in isel.cc. Each rule matches one operator whose
+ * operands are given nonterminals (a register, an immediate of some
+ * kind, an address) and gives the cost and the MIPS template of that
+ * match. The labeler computes the cheapest cover of every node for
+ * every nonterminal by dynamic programming, and the reducer emits the
+ * templates of the cheapest cover. New MIPS idioms are added as rules
+ * to the table.
+ *
+ * The operands of a tree are evaluated in registers reserved from the
+ * Mips object. SelectTrees only builds trees that can be evaluated
+ * with the registers Mips has to spare (two with a register
+ * allocation, see regalloc.h).
+ */
+
+#ifndef _H_isel
+#define _H_isel
+
+#include <list>
+#include <string>
+#include <vector>
+#include "tac.h"
+#include "mips.h"
+
+// The operators of the tree nodes. The arithmetic and relational
+// operators are numbered as their BinaryOp::OpCode.
+typedef enum {
+    OpLeaf = BinaryOp::NumOps, OpConst, OpLoad, OpStore, OpIfZ, OpIfCmp,
+    NumTreeOps
+} TreeOp;
+
+// The nonterminals of the rules: what a node can be reduced to
+typedef enum {
+    NtReg,      // a register
+    NtAddr,     // an address operand off(reg)
+    NtImm,      // a signed 16-bit immediate
+    NtImmNext,  // a constant that is one less than a signed 16-bit immediate
+    NtNegImm,   // a constant whose negation is a signed 16-bit immediate
+    NtUImm,     // an unsigned 16-bit immediate
+    NtShift,    // a power of 2, given as the shift amount
+    NtZero,     // the constant 0
+    NtStmt,     // an instruction with no result
+    NumNonterms
+} Nonterm;
+
+struct TreeNode
+{
+    int op;                     // a BinaryOp::OpCode or a TreeOp
+    BinaryOp::OpCode code;      // the comparison of OpIfCmp
+    Location *var;              // the variable of OpLeaf
+    int value;                  // the value of OpConst
+    TreeNode *kids[2];
+    int numKids;
+
+    // filled in by the labeler
+    int cost[NumNonterms];
+    int rule[NumNonterms];
+
+    TreeNode(int op);
+    ~TreeNode();
+};
+
+class TreeInstruction: public Instruction
+{
+    Instruction *root;      // the TAC instruction at the root of the tree
+    TreeNode *tree;
+    Location *dst;          // where the value of tree goes, NULL if none
+    const char *label;      // the branch target of an IfZ/IfCmp root
+
+    struct Operand {
+        std::string text;
+        Mips::Register reg;
+        bool isScratch;
+    };
+    Operand Reduce(Mips *mips, TreeNode *n, int nt, bool isRoot);
+
+  public:
+    TreeInstruction(Instruction *root, TreeNode *tree, Location *dst);
+    ~TreeInstruction();
+    void EmitSpecific(Mips *mips);
+    Location *GetDst() { return dst; }
+    void GetSrcs(std::vector<Location*> &srcs);
+
+    // The control flow of a tree is that of its root
+    Instruction *GetRoot() { return root; }
+    static Instruction *RootOf(Instruction *instr);
+};
+
+// Folds the single-use temps of the function [begin, end) of code into
+// TreeInstructions
+void SelectTrees(std::list<Instruction*> &code,
+                 std::list<Instruction*>::iterator begin,
+                 std::list<Instruction*>::iterator end);
+
+#endif
@@ -0,0 +1,507 @@
+/* File: ivsr.cc
+ * -------------
+ * Implementation of induction variable strength reduction.
+ */
+
+#include <algorithm>
+#include <limits.h>
+#include "ivsr.h"
+#include "codegen.h"
+#include "dce.h"
+#include "mips.h"
+#include "utility.h"
+
+static const int LengthOffset = -4;     // where NewArray stores the length
+static const int MaxOffset = 32767;     // what a pointer may be off by
+static const int MaxWalk = 8;           // blocks searched before a loop
+
+StrengthReducer::StrengthReducer(FlowGraph &g)
+  : graph(g), begin(NULL), numReduced(0), numPointers(0), numReplaced(0) {}
+
+static bool IsSmall(long long v) {
+    return v >= -MaxOffset && v <= MaxOffset;
+}
+
+// The index of the last instruction of b before the i-th writing loc;
+// -1 if there is none
+static int FindDef(BasicBlock *b, Location *loc, int i) {
+    while (--i >= 0 && b->code[i]->GetDst() != loc)
+        ;
+    return i;
+}
+
+static int IndexOf(BasicBlock *b, Instruction *instr) {
+    return std::find(b->code.begin(), b->code.end(), instr) - b->code.begin();
+}
+
+// dst = src + offset
+static Instruction *Offset(Location *dst, Location *src, int offset) {
+    if (offset == 0) return new Assign(dst, src);
+    return new BinaryOp(BinaryOp::Add, dst, src, offset);
+}
+
+// Whether instr computes iv + c or iv - c, for a constant c other than
+// 0, which increment is set to
+static bool Increments(Instruction *instr, Location *iv, int *increment) {
+    BinaryOp *op = dynamic_cast<BinaryOp*>(instr);
+    if (!op || op->GetOp2() || op->GetOp1() != iv
+        || (op->GetOpCode() != BinaryOp::Add
+            && op->GetOpCode() != BinaryOp::Sub)
+        || op->GetImmediate() == 0 || op->GetImmediate() == INT_MIN)
+        return false;
+    *increment = op->GetOpCode() == BinaryOp::Add ? op->GetImmediate()
+                                                  : -op->GetImmediate();
+    return true;
+}
+
+// Finds the temps whose every write loads the same constant, such as
+// the element size ArrayAccess::Emit loads before multiplying by it
+void StrengthReducer::FindConstants() {
+    LocationSet varying;
+    for (int i = 0; i < graph.NumBlocks(); i++) {
+        BasicBlock *b = graph.GetBlock(i);
+        for (size_t j = 0; j < b->code.size(); j++) {
+            Location *dst = b->code[j]->GetDst();
+            if (!dst || varying.count(dst)) continue;
+            LoadConstant *lc = dynamic_cast<LoadConstant*>(b->code[j]);
+            if (lc && dst->IsTemp()
+                && (!constants.count(dst)
+                    || constants[dst] == lc->GetValue())) {
+                constants[dst] = lc->GetValue();
+                continue;
+            }
+            constants.erase(dst);
+            varying.insert(dst);
+        }
+    }
+}
+
+// Finds the writes of the loop, and the steps i = i + c, or i = t
+// after t = i + c when value numbering has shared the i + c of a
+// subscript
+void StrengthReducer::Scan(const Loop &loop) {
+    numDefs.clear();
+    defs.clear();
+    defBlocks.clear();
+    steps.clear();
+    stepBlocks.clear();
+    increments.clear();
+    sources.clear();
+    std::set<BasicBlock*>::const_iterator b;
+    for (b = loop.body.begin(); b != loop.body.end(); ++b) {
+        for (size_t i = 0; i < (*b)->code.size(); i++) {
+            Location *dst = (*b)->code[i]->GetDst();
+            if (!dst) continue;
+            numDefs[dst]++;
+            defs[dst] = (*b)->code[i];
+            defBlocks[dst] = *b;
+        }
+    }
+    std::map<Location*, Instruction*>::iterator d;
+    for (d = defs.begin(); d != defs.end(); ++d) {
+        Location *iv = d->first;
+        if (numDefs[iv] != 1 || !FlowGraph::IsTracked(iv)) continue;
+        int increment;
+        BinaryOp *source = NULL;
+        if (Assign *a = dynamic_cast<Assign*>(d->second)) {
+            BasicBlock *s = defBlocks[iv];
+            source = dynamic_cast<BinaryOp*>(
+                SoleDef(a->GetSrc(), s, IndexOf(s, a)));
+            if (!source || !Increments(source, iv, &increment)) continue;
+        } else if (!Increments(d->second, iv, &increment))
+            continue;
+        steps[iv] = d->second;
+        stepBlocks[iv] = defBlocks[iv];
+        increments[iv] = increment;
+        sources[iv] = source;
+    }
+}
+
+// The write of loc that the j-th instruction of b reads: the last one
+// before it in b, or else the only one in the loop if its block
+// dominates b. NULL if there is none.
+Instruction *StrengthReducer::SoleDef(Location *loc, BasicBlock *b, int j) {
+    int d = FindDef(b, loc, j);
+    if (d >= 0) return b->code[d];
+    if (!defs.count(loc) || numDefs[loc] != 1 || defBlocks[loc] == b
+        || !FlowGraph::Dominates(defBlocks[loc], b))
+        return NULL;
+    return defs[loc];
+}
+
+// The block of instr, found by SoleDef from b
+BasicBlock *StrengthReducer::BlockOf(Instruction *instr, BasicBlock *b) {
+    if (IndexOf(b, instr) < (int)b->code.size()) return b;
+    return defBlocks[instr->GetDst()];
+}
+
+// Whether the address computed by the j-th instruction of b is used by
+// a Load or Store in b
+bool StrengthReducer::IsAccessed(BasicBlock *b, int j) {
+    Location *u = b->code[j]->GetDst();
+    for (size_t i = j + 1; i < b->code.size(); i++) {
+        Instruction *instr = b->code[i];
+        Load *ld = dynamic_cast<Load*>(instr);
+        Store *st = dynamic_cast<Store*>(instr);
+        if ((ld && ld->GetReference() == u) || (st && st->GetReference() == u))
+            return true;
+        if (instr->GetDst() == u) return false;
+    }
+    return false;
+}
+
+// Whether the j-th instruction of b computes an address
+//     t = k * x ; u = base + t
+// where k is a constant, base is not written in the loop and x is a
+// basic induction variable or, computed before in b, one plus or minus
+// a constant
+bool StrengthReducer::MatchAddress(int l, BasicBlock *b, int j,
+                                   Address &address) {
+    BinaryOp *add = dynamic_cast<BinaryOp*>(b->code[j]);
+    if (!add || add->GetOpCode() != BinaryOp::Add || !add->GetOp2()
+        || !FlowGraph::IsTracked(add->GetDst()))
+        return false;
+    for (int side = 0; side < 2; side++) {
+        Location *base = side ? add->GetOp2() : add->GetOp1();
+        Location *t = side ? add->GetOp1() : add->GetOp2();
+        if (!FlowGraph::IsTracked(base) || numDefs.count(base)) continue;
+        BinaryOp *mul = dynamic_cast<BinaryOp*>(SoleDef(t, b, j));
+        if (!mul || mul->GetOpCode() != BinaryOp::Mul) continue;
+        Location *x = mul->GetOp1();
+        int scale;
+        if (!mul->GetOp2())
+            scale = mul->GetImmediate();
+        else if (constants.count(mul->GetOp2()))
+            scale = constants[mul->GetOp2()];
+        else if (constants.count(mul->GetOp1())) {
+            scale = constants[mul->GetOp1()];
+            x = mul->GetOp2();
+        } else
+            continue;
+
+        Instruction *read = mul;        // reading the induction variable
+        BasicBlock *rb = BlockOf(mul, b);
+        int offset = 0;
+        if (!steps.count(x)) {
+            BinaryOp *shift = dynamic_cast<BinaryOp*>(
+                SoleDef(x, rb, IndexOf(rb, mul)));
+            if (!shift || !steps.count(shift->GetOp1())
+                || !Increments(shift, shift->GetOp1(), &offset))
+                continue;
+            x = shift->GetOp1();
+            read = shift;
+            rb = BlockOf(shift, rb);
+        }
+        if (scale <= 0 || !IsSmall((long long)scale * offset)
+            || !IsSmall((long long)scale * increments[x]))
+            continue;
+        // the induction variable keeps its value from the read to j: the
+        // step is not in between in b, or, read in a block before, comes
+        // after b, once in an iteration
+        int from = -1;
+        if (rb == b)
+            from = IndexOf(b, read);
+        else {
+            BasicBlock *s = stepBlocks[x];
+            if (InInnerLoop(l, s) || (s != b && !FlowGraph::Dominates(b, s)))
+                continue;
+        }
+        if (FindDef(b, x, j) > from) continue;
+        address.block = b;
+        address.add = add;
+        address.iv = x;
+        address.base = base;
+        address.scale = scale;
+        address.offset = offset;
+        address.accessed = IsAccessed(b, j);
+        return true;
+    }
+    return false;
+}
+
+// The last instruction writing loc on the way into loop, found going
+// back from the only block entering it through blocks with only one
+// predecessor; writtenAfter gets the locations written after it. NULL
+// if there is none.
+Instruction *StrengthReducer::EnteringDef(const Loop &loop, Location *loc,
+                                          LocationSet &writtenAfter) {
+    BasicBlock *b = NULL;
+    BasicBlock *h = loop.header;
+    for (size_t p = 0; p < h->preds.size(); p++) {
+        if (loop.body.count(h->preds[p])) continue;
+        if (b) return NULL;
+        b = h->preds[p];
+    }
+    for (int walked = 0; b && walked < MaxWalk; walked++) {
+        for (int i = b->code.size() - 1; i >= 0; i--) {
+            Location *dst = b->code[i]->GetDst();
+            if (dst == loc) return b->code[i];
+            if (dst) writtenAfter.insert(dst);
+        }
+        b = b->preds.size() == 1 ? b->preds[0] : NULL;
+    }
+    return NULL;
+}
+
+// Whether iv enters loop as a constant c with scale * c small, which
+// start is set to
+bool StrengthReducer::StartsSmall(const Loop &loop, Location *iv, int scale,
+                                  int *start) {
+    LocationSet written;
+    LoadConstant *lc =
+        dynamic_cast<LoadConstant*>(EnteringDef(loop, iv, written));
+    if (!lc || !IsSmall((long long)scale * lc->GetValue())) return false;
+    *start = scale * lc->GetValue();
+    return true;
+}
+
+// Whether b is in a loop nested in the l-th
+bool StrengthReducer::InInnerLoop(int l, BasicBlock *b) {
+    for (size_t inner = 0; inner < loops.size(); inner++)
+        if (loops[inner].header != loops[l].header
+            && loops[l].body.count(loops[inner].header)
+            && loops[inner].body.count(b))
+            return true;
+    return false;
+}
+
+// Has address read pointer instead, propagating a plain copy of it into
+// the instructions after it while pointer keeps its value
+void StrengthReducer::Rewrite(const Address &address, Location *pointer) {
+    BasicBlock *b = address.block;
+    int j = IndexOf(b, address.add);
+    Location *u = address.add->GetDst();
+    b->code[j] = Offset(u, pointer, address.scale * address.offset);
+    delete address.add;
+    if (address.offset != 0) return;
+    for (size_t i = j + 1; i < b->code.size(); i++) {
+        Location *dst = b->code[i]->GetDst();
+        b->code[i]->ReplaceSrc(u, pointer);
+        if (dst == u || dst == address.iv) break;
+    }
+}
+
+// The location set in the preheader pre to the address that pointer of
+// family reaches when test holds with iv replaced by the pointer: the
+// bound of test times the scale, added to the base. The bound must be a
+// small constant or the length of the array, so that the address does
+// not overflow. NULL if it is neither.
+Location *StrengthReducer::Limit(const Loop &loop, BasicBlock *pre,
+                                 const Family &family, BinaryOp *test) {
+    Location *n = test->GetOp2();
+    if (!n) {
+        long long offset = (long long)family.scale * test->GetImmediate();
+        if (!IsSmall(offset)) return NULL;
+        Location *limit = CodeGenerator::NewTempVar(begin);
+        pre->code.push_back(Offset(limit, family.base, offset));
+        return limit;
+    }
+
+    // n is the length loaded before the loop, or in the header before
+    // anything that could keep the Load from running
+    Load *ld = NULL;
+    if (!numDefs.count(n)) {
+        LocationSet written;
+        ld = dynamic_cast<Load*>(EnteringDef(loop, n, written));
+        if (ld && written.count(family.base)) return NULL;
+    } else {
+        BasicBlock *h = loop.header;
+        size_t t = IndexOf(h, test);
+        if (t == h->code.size()) return NULL;
+        int d = FindDef(h, n, t);
+        ld = d >= 0 ? dynamic_cast<Load*>(h->code[d]) : NULL;
+        for (int i = 0; i < d; i++)
+            if (FlowGraph::IsCall(h->code[i])) return NULL;
+        if (numDefs[n] != 1) return NULL;
+    }
+    if (!ld || ld->GetReference() != family.base
+        || ld->GetOffset() != LengthOffset)
+        return NULL;
+
+    Location *length = n;
+    if (numDefs.count(n)) {
+        length = CodeGenerator::NewTempVar(begin);
+        pre->code.push_back(new Load(length, family.base, LengthOffset));
+    }
+    Location *limit = CodeGenerator::NewTempVar(begin);
+    if (Mips::CanUseImmediate(BinaryOp::Mul, family.scale)) {
+        pre->code.push_back(new BinaryOp(BinaryOp::Mul, limit, length,
+                                         family.scale));
+    } else {
+        Location *scale = CodeGenerator::NewTempVar(begin);
+        pre->code.push_back(new LoadConstant(scale, family.scale));
+        pre->code.push_back(new BinaryOp(BinaryOp::Mul, limit, length,
+                                         scale));
+    }
+    pre->code.push_back(new BinaryOp(BinaryOp::Add, limit, family.base,
+                                     limit));
+    return limit;
+}
+
+// Removes iv from the l-th loop when it is only read by its step and
+// one comparison, which then compares a pointer of its families with
+// the matching address, and is not live after the loop. The i + c a
+// step copies must not be read by anything else either.
+void StrengthReducer::ReplaceTest(int l, BasicBlock *pre, Location *iv,
+                                  const std::vector<Family> &families) {
+    const Loop &loop = loops[l];
+    Location *copied = sources[iv] ? sources[iv]->GetDst() : NULL;
+    BinaryOp *test = NULL;
+    BasicBlock *testBlock = NULL;
+    std::set<BasicBlock*>::const_iterator b;
+    for (b = loop.body.begin(); b != loop.body.end(); ++b) {
+        for (size_t i = 0; i < (*b)->code.size(); i++) {
+            Instruction *instr = (*b)->code[i];
+            std::vector<Location*> srcs;
+            instr->GetSrcs(srcs);
+            if (instr == steps[iv]) continue;
+            if (copied
+                && std::find(srcs.begin(), srcs.end(), copied) != srcs.end())
+                return;
+            if (instr == sources[iv]
+                || std::find(srcs.begin(), srcs.end(), iv) == srcs.end())
+                continue;
+            BinaryOp *cmp = dynamic_cast<BinaryOp*>(instr);
+            if (test || !cmp || cmp->GetOp1() != iv || cmp->GetOp2() == iv
+                || cmp->GetOpCode() < BinaryOp::Eq
+                || cmp->GetOpCode() > BinaryOp::Ge)
+                return;
+            test = cmp;
+            testBlock = *b;
+        }
+        for (size_t s = 0; s < (*b)->succs.size(); s++)
+            if (!loop.body.count((*b)->succs[s])
+                && ((*b)->succs[s]->liveIn.count(iv)
+                    || (copied && (*b)->succs[s]->liveIn.count(copied))))
+                return;
+    }
+
+    if (test) {
+        Location *limit = NULL, *pointer = NULL;
+        for (size_t f = 0; f < families.size() && !limit; f++) {
+            if (families[f].iv != iv) continue;
+            limit = Limit(loop, pre, families[f], test);
+            pointer = families[f].pointer;
+        }
+        if (!limit) return;
+        int i = IndexOf(testBlock, test);
+        testBlock->code[i] = new BinaryOp(test->GetOpCode(), test->GetDst(),
+                                          pointer, limit);
+        delete test;
+        numReplaced++;
+    }
+    BasicBlock *s = stepBlocks[iv];
+    s->code.erase(s->code.begin() + IndexOf(s, steps[iv]));
+    delete steps[iv];
+}
+
+void StrengthReducer::Reduce(int l) {
+    Loop &loop = loops[l];
+    if (!graph.CanInsertPreheader(loop)) return;
+    graph.ComputeDominators();
+    Scan(loop);
+    if (steps.empty()) return;
+
+    std::vector<Address> addresses;
+    for (int i = 0; i < graph.NumBlocks(); i++) {
+        BasicBlock *b = graph.GetBlock(i);
+        if (!loop.body.count(b)) continue;
+        for (size_t j = 0; j < b->code.size(); j++) {
+            Address address;
+            if (MatchAddress(l, b, j, address))
+                addresses.push_back(address);
+        }
+    }
+
+    // a family is safe when an access through one of its addresses
+    // runs in every iteration before the step, once per iteration
+    std::vector<Family> families;
+    std::vector<int> familyOf;
+    std::vector<bool> safe;
+    for (size_t a = 0; a < addresses.size(); a++) {
+        Address &address = addresses[a];
+        size_t f = 0;
+        while (f < families.size() && (families[f].iv != address.iv
+                                       || families[f].base != address.base
+                                       || families[f].scale != address.scale))
+            f++;
+        if (f == families.size()) {
+            Family family = {address.iv, address.base, NULL, address.scale};
+            families.push_back(family);
+            safe.push_back(false);
+        }
+        familyOf.push_back(f);
+        BasicBlock *s = stepBlocks[address.iv];
+        if (address.accessed
+            && (address.block == s || FlowGraph::Dominates(address.block, s)))
+            safe[f] = true;
+    }
+    std::vector<int> start(families.size());
+    std::vector<Family> kept;
+    for (size_t f = 0; f < families.size(); f++) {
+        safe[f] = safe[f] && !InInnerLoop(l, stepBlocks[families[f].iv])
+            && StartsSmall(loop, families[f].iv, families[f].scale,
+                           &start[f]);
+        if (safe[f]) kept.push_back(families[f]);
+    }
+    if (kept.empty()) return;
+
+    BasicBlock *pre = graph.InsertPreheader(loop);
+    for (size_t outer = l + 1; outer < loops.size(); outer++)
+        if (loops[outer].body.count(loop.header))
+            loops[outer].body.insert(pre);
+    for (size_t f = 0; f < families.size(); f++) {
+        if (!safe[f]) continue;
+        families[f].pointer = CodeGenerator::NewTempVar(begin);
+        pre->code.push_back(Offset(families[f].pointer, families[f].base,
+                                   start[f]));
+        numPointers++;
+    }
+    for (size_t a = 0; a < addresses.size(); a++) {
+        if (!safe[familyOf[a]]) continue;
+        Rewrite(addresses[a], families[familyOf[a]].pointer);
+        numReduced++;
+    }
+    std::vector<Location*> ivs;
+    kept.clear();
+    for (size_t f = 0; f < families.size(); f++) {
+        if (!safe[f]) continue;
+        Family &family = families[f];
+        BasicBlock *s = stepBlocks[family.iv];
+        int i = IndexOf(s, steps[family.iv]);
+        s->code.insert(s->code.begin() + i + 1,
+                       new BinaryOp(BinaryOp::Add, family.pointer,
+                                    family.pointer,
+                                    family.scale * increments[family.iv]));
+        if (std::find(ivs.begin(), ivs.end(), family.iv) == ivs.end())
+            ivs.push_back(family.iv);
+        kept.push_back(family);
+    }
+
+    RemoveDeadInstructions(graph);
+    for (size_t i = 0; i < ivs.size(); i++)
+        ReplaceTest(l, pre, ivs[i], kept);
+}
+
+void StrengthReducer::Run() {
+    begin = dynamic_cast<BeginFunc*>(graph.GetEntry()->code[1]);
+    FindConstants();
+    graph.ComputeDominators();
+    graph.FindLoops(loops);
+    for (size_t l = 0; l < loops.size(); l++)
+        Reduce(l);
+    if (numPointers > 0)
+        RemoveDeadInstructions(graph);
+    PrintDebug("ivsr", "%s: %d addresses reduced to %d pointers, "
+               "%d tests replaced", graph.GetName(), numReduced,
+               numPointers, numReplaced);
+}
+
+void ReduceStrength(std::list<Instruction*> &code,
+                    std::list<Instruction*>::iterator begin,
+                    std::list<Instruction*>::iterator end) {
+    FlowGraph graph(begin, end);
+    StrengthReducer reducer(graph);
+    reducer.Run();
+    graph.WriteBack(code, begin, end);
+}
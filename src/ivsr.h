@@ -0,0 +1,104 @@
+/* File: ivsr.h
+ * ------------
+ * Induction variable strength reduction on the flow graph of one
+ * function.
+ *
+ * ArrayAccess::Emit computes the address of a[x] as a + 4 * x. In a
+ * loop whose basic induction variable i is written only by i = i + c,
+ * the address a + k * (i + d) of an array a the loop does not write,
+ * with a constant k and a small constant d, is kept instead in a new
+ * pointer p = a + k * i: the preheader of the loop (see licm.h) sets it
+ * up, and an Add of k * c follows the step of i. The address then
+ * becomes p + k * d, which instruction selection folds into the offset
+ * of the Load or Store using it (see isel.h), or a copy of p that is
+ * propagated into them. The multiplication, and the additions computing
+ * the subscript and the address, are left to dead code elimination.
+ *
+ * The pointer is computed with trapping MIPS additions, so it must
+ * never hold an address the program would not have formed. It is only
+ * kept when i starts from a small constant and an access through one of
+ * its addresses runs in every iteration before the step: that access is
+ * checked (or proven in bounds by bce.h), so at each step p is within
+ * the array, or off its ends by a few elements. The heap lies far from
+ * both ends of the address space, so such a pointer does not overflow.
+ *
+ * When i is then only read by its step and one comparison with a small
+ * constant or the length of the array, and is not live after the loop,
+ * linear-function test replacement compares p with the address of that
+ * element instead, computed in the preheader, and removes the step of
+ * i: the loop keeps a single induction variable.
+ */
+
+#ifndef _H_ivsr
+#define _H_ivsr
+
+#include <list>
+#include <map>
+#include <vector>
+#include "tac.h"
+#include "cfg.h"
+
+class StrengthReducer
+{
+  private:
+    FlowGraph &graph;
+    BeginFunc *begin;
+    std::vector<Loop> loops;
+    std::map<Location*, int> constants;   // temps only loaded with one value
+    int numReduced, numPointers, numReplaced;
+
+    // An address base + scale * (iv + offset) computed by add in block
+    struct Address {
+        BasicBlock *block;
+        BinaryOp *add;
+        Location *iv, *base;
+        int scale, offset;
+        bool accessed;          // a Load or Store uses it before the step
+    };
+    // A pointer kept at base + scale * iv throughout the loop
+    struct Family {
+        Location *iv, *base, *pointer;
+        int scale;
+    };
+
+    // The loop being handled: the number of writes of each location,
+    // and the step of each basic induction variable, its only write
+    std::map<Location*, int> numDefs;
+    std::map<Location*, Instruction*> defs;      // the last write of each
+    std::map<Location*, BasicBlock*> defBlocks;
+    std::map<Location*, Instruction*> steps;
+    std::map<Location*, BasicBlock*> stepBlocks;
+    std::map<Location*, int> increments;
+    std::map<Location*, BinaryOp*> sources;   // the i + c a step copies
+
+    void FindConstants();
+    void Scan(const Loop &loop);
+    bool IsAccessed(BasicBlock *b, int j);
+    Instruction *SoleDef(Location *loc, BasicBlock *b, int j);
+    BasicBlock *BlockOf(Instruction *instr, BasicBlock *b);
+    bool MatchAddress(int l, BasicBlock *b, int j, Address &address);
+    Instruction *EnteringDef(const Loop &loop, Location *loc,
+                             LocationSet &writtenAfter);
+    bool StartsSmall(const Loop &loop, Location *iv, int scale, int *start);
+    bool InInnerLoop(int l, BasicBlock *b);
+    void Rewrite(const Address &address, Location *pointer);
+    Location *Limit(const Loop &loop, BasicBlock *pre, const Family &family,
+                    BinaryOp *test);
+    void ReplaceTest(int l, BasicBlock *pre, Location *iv,
+                     const std::vector<Family> &families);
+    void Reduce(int l);
+
+  public:
+    StrengthReducer(FlowGraph &graph);
+
+    // Reduces the addresses computed in every loop, innermost first
+    void Run();
+};
+
+// The function pass: reduces the array addresses computed in the loops
+// of the function [begin, end) to pointers
+void ReduceStrength(std::list<Instruction*> &code,
+                    std::list<Instruction*>::iterator begin,
+                    std::list<Instruction*>::iterator end);
+
+#endif
@@ -0,0 +1,161 @@
+/* File: licm.cc
+ * -------------
+ * Implementation of loop-invariant code motion.
+ */
+
+#include <string.h>
+#include "licm.h"
+#include "codegen.h"
+#include "utility.h"
+
+static const int LengthOffset = -4;     // where NewArray stores the length
+
+LoopInvariantMotion::LoopInvariantMotion(FlowGraph &g)
+  : graph(g), inRegisters(GetOptimizationLevel() >= 2), numHoisted(0),
+    stale(true), hasCalls(false), makesCalls(false) {}
+
+void LoopInvariantMotion::FindLoops() {
+    graph.ComputeDominators();
+    graph.FindLoops(loops);
+}
+
+// Whether b reports a runtime error: it runs once at most, so nothing
+// is gained by moving its code out of the loop
+static bool IsErrorPath(BasicBlock *b) {
+    for (size_t i = 0; i < b->code.size(); i++) {
+        LCall *call = dynamic_cast<LCall*>(b->code[i]);
+        if (call && !strcmp(call->GetLabel(), "_Halt")) return true;
+    }
+    return false;
+}
+
+void LoopInvariantMotion::Scan(Loop &loop) {
+    numDefs.clear();
+    storeOffsets.clear();
+    hasCalls = false;
+    makesCalls = false;
+    exits.clear();
+    liveAfter.clear();
+    std::set<BasicBlock*>::iterator b;
+    for (b = loop.body.begin(); b != loop.body.end(); ++b) {
+        for (size_t i = 0; i < (*b)->code.size(); i++) {
+            Instruction *instr = (*b)->code[i];
+            if (instr->GetDst()) numDefs[instr->GetDst()]++;
+            if (Store *st = dynamic_cast<Store*>(instr))
+                storeOffsets.insert(st->GetOffset());
+            LCall *call = dynamic_cast<LCall*>(instr);
+            if (dynamic_cast<ACall*>(instr)
+                || (call && !CodeGenerator::IsBuiltIn(call->GetLabel())))
+                hasCalls = true;
+            if (FlowGraph::IsCall(instr) && !IsErrorPath(*b))
+                makesCalls = true;
+        }
+        bool exit = false;
+        for (size_t s = 0; s < (*b)->succs.size(); s++) {
+            BasicBlock *succ = (*b)->succs[s];
+            if (loop.body.count(succ)) continue;
+            exit = true;
+            liveAfter.insert(succ->liveIn.begin(), succ->liveIn.end());
+        }
+        if (exit) exits.push_back(*b);
+    }
+}
+
+// Whether instr, in block b of the loop, can move to the preheader. It
+// is first when it is in the header with no call before it.
+bool LoopInvariantMotion::IsInvariant(Loop &loop, BasicBlock *b,
+                                      Instruction *instr, bool first) {
+    Location *dst = instr->GetDst();
+    if (!FlowGraph::IsTracked(dst) || numDefs[dst] != 1
+        || loop.header->liveIn.count(dst))
+        return false;
+    std::vector<Location*> srcs;
+    instr->GetSrcs(srcs);
+    for (size_t s = 0; s < srcs.size(); s++)
+        if (!FlowGraph::IsTracked(srcs[s]) || numDefs[srcs[s]] != 0)
+            return false;
+
+    bool faults = false;
+    if (BinaryOp *op = dynamic_cast<BinaryOp*>(instr)) {
+        BinaryOp::OpCode code = op->GetOpCode();
+        if (code >= BinaryOp::Eq || (inRegisters && makesCalls))
+            return false;
+        faults = (code == BinaryOp::Div || code == BinaryOp::Mod)
+            && (op->GetOp2() || op->GetImmediate() == 0);
+    } else if (Load *ld = dynamic_cast<Load*>(instr)) {
+        if (ld->GetOffset() != LengthOffset
+            && (hasCalls || storeOffsets.count(ld->GetOffset())))
+            return false;
+        faults = ld->GetReference() != CodeGenerator::ThisPtr;
+    } else if (dynamic_cast<LoadConstant*>(instr)
+               || dynamic_cast<LoadStringConstant*>(instr)
+               || dynamic_cast<LoadLabel*>(instr)) {
+        if (!inRegisters || makesCalls) return false;
+    } else
+        return false;
+    if (faults) return first;
+    if (!liveAfter.count(dst)) return true;
+    for (size_t e = 0; e < exits.size(); e++)
+        if (!FlowGraph::Dominates(b, exits[e])) return false;
+    return true;
+}
+
+void LoopInvariantMotion::Hoist(int l) {
+    Loop &loop = loops[l];
+    BasicBlock *h = loop.header;
+    if (!graph.CanInsertPreheader(loop)) return;
+    if (stale) {
+        graph.ComputeDominators();
+        graph.ComputeLiveness();
+        stale = false;
+    }
+    Scan(loop);
+
+    std::vector<Instruction*> hoisted;
+    const std::vector<BasicBlock*> &order = graph.ReversePostorder();
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t o = 0; o < order.size(); o++) {
+            BasicBlock *b = order[o];
+            if (!loop.body.count(b) || IsErrorPath(b)) continue;
+            bool first = b == h;
+            for (size_t i = 0; i < b->code.size(); i++) {
+                Instruction *instr = b->code[i];
+                if (IsInvariant(loop, b, instr, first)) {
+                    hoisted.push_back(instr);
+                    numDefs[instr->GetDst()]--;
+                    b->code.erase(b->code.begin() + i--);
+                    changed = true;
+                } else if (FlowGraph::IsCall(instr))
+                    first = false;
+            }
+        }
+    }
+    if (hoisted.empty()) return;
+
+    BasicBlock *pre = graph.InsertPreheader(loop);
+    stale = true;
+    pre->code.insert(pre->code.end(), hoisted.begin(), hoisted.end());
+    numHoisted += hoisted.size();
+    for (size_t outer = l + 1; outer < loops.size(); outer++)
+        if (loops[outer].body.count(h))
+            loops[outer].body.insert(pre);
+}
+
+void LoopInvariantMotion::Run() {
+    FindLoops();
+    for (size_t l = 0; l < loops.size(); l++)
+        Hoist(l);
+    PrintDebug("licm", "%s: %d loops, %d instructions hoisted",
+               graph.GetName(), (int)loops.size(), numHoisted);
+}
+
+void HoistInvariants(std::list<Instruction*> &code,
+                     std::list<Instruction*>::iterator begin,
+                     std::list<Instruction*>::iterator end) {
+    FlowGraph graph(begin, end);
+    LoopInvariantMotion motion(graph);
+    motion.Run();
+    graph.WriteBack(code, begin, end);
+}
@@ -0,0 +1,92 @@
+/* File: licm.h
+ * ------------
+ * Loop-invariant code motion on the flow graph of one function.
+ *
+ * A loop is found from a back edge b -> h, where h dominates b: its
+ * header is h and its body is h with the blocks reaching b backward
+ * without going through h. The back edges of the while and for loops
+ * generated for Decaf are the Gotos to the test at their top; loops
+ * sharing a header are taken as one. The loops are handled innermost
+ * first, so that what leaves an inner loop may then leave the loops
+ * around it as well.
+ *
+ * An instruction of a loop is invariant when it computes a value from
+ * tracked operands (see FlowGraph::IsTracked) that the loop does not
+ * write, or writes only with invariant instructions already moved out.
+ * It moves into the preheader of the loop, a block laid out just before
+ * the header that the edges entering the loop go through, when it is
+ * the only write of its destination in the loop and the destination is
+ * not live at the header (no read in the loop sees an older value).
+ * Its destination may be live after the loop only if the instruction
+ * ran on every way out of the loop, that is if its block dominates all
+ * the blocks the loop is left from.
+ *
+ * The instructions moved are the BinaryOps other than comparisons
+ * (which are cheaper fused into their branch, see FuseBranches), and
+ * the Loads the loop does not change: the length of an array (offset
+ * -4) never changes, and the other Loads change through a Store at the
+ * same offset (the fields of objects are at positive offsets, array
+ * elements and vtable pointers at 0) or a call to a function that is
+ * not built in. A Load that may fault (any Load not through this) or a
+ * division by a register that may trap only moves out of the header,
+ * where it ran before anything else of the loop could, and only when
+ * no call comes before it there (a call may halt the program). The
+ * code reporting a runtime error, before the call to _Halt, is left
+ * where it is.
+ *
+ * A value moved out lives in a register across the whole loop at -O2,
+ * and across a call that means saving it. So at -O2 a loop making calls
+ * only loses its Loads, and the loads of constants, strings and labels
+ * (one instruction to redo, where they can often be an immediate) move
+ * only out of loops without calls, and only at -O2, where they stay in
+ * a register rather than in a stack slot.
+ */
+
+#ifndef _H_licm
+#define _H_licm
+
+#include <list>
+#include <map>
+#include <set>
+#include <vector>
+#include "tac.h"
+#include "cfg.h"
+
+class LoopInvariantMotion
+{
+  private:
+    FlowGraph &graph;
+    std::vector<Loop> loops;
+    bool inRegisters;           // whether registers are allocated (-O2)
+    int numHoisted;
+    bool stale;                 // whether a preheader was inserted since
+                                // the dominators and liveness were computed
+
+    // What the loop being handled writes and where it is left from
+    std::map<Location*, int> numDefs;
+    std::set<int> storeOffsets;
+    bool hasCalls;                      // to functions not built in
+    bool makesCalls;                    // outside the error paths
+    std::vector<BasicBlock*> exits;     // the blocks with edges out
+    LocationSet liveAfter;              // live where the edges out go
+
+    void FindLoops();
+    void Scan(Loop &loop);
+    bool IsInvariant(Loop &loop, BasicBlock *b, Instruction *instr,
+                     bool first);
+    void Hoist(int l);
+
+  public:
+    LoopInvariantMotion(FlowGraph &graph);
+
+    // Moves the invariant instructions of every loop into its preheader
+    void Run();
+};
+
+// The function pass: moves the invariant code out of the loops of the
+// function [begin, end)
+void HoistInvariants(std::list<Instruction*> &code,
+                     std::list<Instruction*>::iterator begin,
+                     std::list<Instruction*>::iterator end);
+
+#endif
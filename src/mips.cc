@@ -18,11 +18,36 @@
  * Specifically, it always loads operands off stacks, and stores the
  * result back.  This breaks bad code immediately, theoretically helping
  * students.
+ *
+ * At optimization level 1 and above, the register descriptors are used
+ * to cache variables in registers for the length of a basic block. A
+ * variable is filled only on its first use in the block, and results
+ * stay in their (dirty) registers until the block ends at a label,
+ * branch, call or return, where the dirty registers are spilled.
+ *
+ * At optimization level 2 and above, the variables of each function
+ * are assigned to registers for the whole function by a
+ * RegisterAllocator (see regalloc.h). Only the variables left without a
+ * register go through the register descriptors, using $v0 and $v1 as
+ * scratch registers.
+ *
+ * With -fregparams, the first four arguments of a call are passed in
+ * $a0-$a3. The caller still reserves the stack slots of all arguments
+ * (as in the o32 convention), so a callee can store the register
+ * arguments into their usual fp+4.. slots when it needs them in memory.
+ *
+ * The TreeInstructions of the instruction selector (see isel.h) evaluate
+ * several operations in one Tac instruction. The registers of their
+ * operands are reserved (ReserveOperand, ReserveScratch) so that the
+ * register descriptors do not pick them again while they are needed.
  */
 
 #include <stdarg.h>
 #include <cstring>
+#include <string>
 #include "mips.h"
+#include "regalloc.h"
+#include "peephole.h"
 
 // Helper to check if two variable locations are one and the same
 // (same name, segment, and offset)
@@ -42,7 +67,7 @@ static bool LocationsAreSame(Location *var1, Location *var2) {
 void Mips::SpillRegister(Location *dst, Register reg) {
     Assert(dst);
     const char *offsetFromWhere = dst->GetSegment() == fpRelative
-        ? regs[fp].name : regs[gp].name;
+        ? regs[frameReg].name : regs[gp].name;
     Assert(dst->GetOffset() % 4 == 0); // all variables are 4 bytes in size
     Emit("sw %s, %d(%s)\t# spill %s from %s to %s%+d", regs[reg].name,
             dst->GetOffset(), offsetFromWhere, dst->GetName(), regs[reg].name,
@@ -57,13 +82,235 @@ void Mips::SpillRegister(Location *dst, Register reg) {
 void Mips::FillRegister(Location *src, Register reg) {
     Assert(src);
     const char *offsetFromWhere = src->GetSegment() == fpRelative
-        ? regs[fp].name : regs[gp].name;
+        ? regs[frameReg].name : regs[gp].name;
     Assert(src->GetOffset() % 4 == 0); // all variables are 4 bytes in size
     Emit("lw %s, %d(%s)\t# fill %s to %s from %s%+d", regs[reg].name,
             src->GetOffset(), offsetFromWhere, src->GetName(), regs[reg].name,
             offsetFromWhere,src->GetOffset());
 }
 
+/* Method: GetRegister
+ * -------------------
+ * Returns the register holding var, slaving var into a register first if
+ * it is not already in one. If the variable is read, its current value
+ * is filled from memory. If the variable is written, the register is
+ * marked dirty so that the new value gets spilled back to memory later.
+ * The registers avoid1/avoid2 (typically holding the other operands of
+ * the instruction) are not chosen when a register has to be freed up.
+ */
+Mips::Register Mips::GetRegister(Location *var, Reason reason,
+        Register avoid1, Register avoid2)
+{
+    Register reg;
+    if (allocation && (reg = allocation->GetRegister(var)) != zero)
+        return reg;
+    if (!FindRegisterWithContents(var, reg)) {
+        reg = SelectRegisterToSpill(avoid1, avoid2);
+        SpillRegister(reg);
+        DiscardValueInRegister(reg);
+        if (reason == ForRead) FillRegister(var, reg);
+        regs[reg].var = var;
+    }
+    if (reason == ForWrite) {
+        // another variable given the same stack slot (see stackslots.h)
+        // is dead once var is written, so its value is not written back
+        for (Register r = zero; r < NumRegs; r = Register(r+1))
+            if (r != reg && IsCandidateRegister(r) && regs[r].var
+                && !LocationsAreSame(var, regs[r].var)
+                && var->GetSegment() == regs[r].var->GetSegment()
+                && var->GetOffset() == regs[r].var->GetOffset())
+                DiscardValueInRegister(r);
+        regs[reg].isDirty = true;
+    }
+    regs[reg].lastUsed = ++useCounter;
+    return reg;
+}
+
+/* Method: FindRegisterWithContents
+ * --------------------------------
+ * Searches the register descriptors for one that currently holds var.
+ * Returns true and sets reg if found.
+ */
+bool Mips::FindRegisterWithContents(Location *var, Register& reg) {
+    for (reg = zero; reg < NumRegs; reg = Register(reg+1))
+        if (IsCandidateRegister(reg) && LocationsAreSame(var, regs[reg].var))
+            return true;
+    return false;
+}
+
+/* Method: IsCandidateRegister
+ * ---------------------------
+ * Without caching, only the three scratch registers rs, rt and rd are
+ * used. With caching, all general purpose registers are available.
+ * With a register allocation, the general purpose registers belong to
+ * the allocated variables and the others use $v0 and $v1.
+ */
+bool Mips::IsCandidateRegister(Register reg) {
+    if (allocation) return reg == v0 || reg == v1;
+    if (cacheInBlock) return regs[reg].isGeneralPurpose;
+    return reg == rs || reg == rt || reg == rd;
+}
+
+/* Method: IsAllocated
+ * -------------------
+ * Returns true if var lives in a register for the whole function.
+ */
+bool Mips::IsAllocated(Location *var) {
+    return allocation && allocation->GetRegister(var) != zero;
+}
+
+/* Method: SelectRegisterToSpill
+ * -----------------------------
+ * Picks a register to hold a new variable. An empty register is preferred,
+ * then the least recently used clean register (it can be reused without
+ * a store), then the least recently used dirty one.
+ */
+Mips::Register Mips::SelectRegisterToSpill(Register avoid1, Register avoid2) {
+    Register best = zero;
+    for (Register r = zero; r < NumRegs; r = Register(r+1)) {
+        if (!IsCandidateRegister(r) || r == avoid1 || r == avoid2
+            || regs[r].numReserved) continue;
+        if (best == zero) { best = r; continue; }
+        if (regs[r].var == NULL) {
+            if (regs[best].var != NULL) best = r;
+        } else if (regs[best].var != NULL) {
+            if (regs[r].isDirty != regs[best].isDirty) {
+                if (!regs[r].isDirty) best = r;
+            } else if (regs[r].lastUsed < regs[best].lastUsed) {
+                best = r;
+            }
+        }
+    }
+    // With only the two scratch registers of an allocation, the result
+    // of an instruction may have to share a register with an operand,
+    // which is fine since all operands are read before it is written.
+    if (best == zero && allocation) best = avoid1;
+    Assert(best != zero);
+    return best;
+}
+
+/* Method: SpillRegister
+ * ---------------------
+ * Writes the contents of reg back to the variable slaved to it, if the
+ * register is dirty. The register keeps its (now clean) contents.
+ */
+void Mips::SpillRegister(Register reg) {
+    if (regs[reg].var && regs[reg].isDirty) {
+        SpillRegister(regs[reg].var, reg);
+        regs[reg].isDirty = false;
+    }
+}
+
+/* Method: SpillAllDirtyRegisters
+ * ------------------------------
+ * Used before flow of control leaves the basic block (branches, calls,
+ * labels): all dirty registers are written back to memory.
+ */
+void Mips::SpillAllDirtyRegisters() {
+    for (Register r = zero; r < NumRegs; r = Register(r+1))
+        SpillRegister(r);
+}
+
+/* Method: SpillForEndFunction
+ * ---------------------------
+ * Used before returning from a function. Locals and temps of the function
+ * are about to disappear with the stack frame, so only the dirty registers
+ * holding global variables need to be written back.
+ */
+void Mips::SpillForEndFunction() {
+    for (Register r = zero; r < NumRegs; r = Register(r+1))
+        if (regs[r].var && regs[r].var->GetSegment() == gpRelative)
+            SpillRegister(r);
+}
+
+/* Method: DiscardValueInRegister
+ * ------------------------------
+ * Forgets the contents of reg (without writing it back).
+ */
+void Mips::DiscardValueInRegister(Register reg) {
+    regs[reg].var = NULL;
+    regs[reg].isDirty = false;
+}
+
+/* Method: DiscardAllRegisters
+ * ---------------------------
+ * Used once the register contents are no longer known to be valid, such
+ * as at the start of a new basic block or after a call.
+ */
+void Mips::DiscardAllRegisters() {
+    for (Register r = zero; r < NumRegs; r = Register(r+1))
+        DiscardValueInRegister(r);
+}
+
+/* Method: EndInstruction
+ * ----------------------
+ * Called after each Tac instruction is translated. Without caching, the
+ * result of the instruction is written back immediately and nothing is
+ * remembered for the next instruction.
+ */
+void Mips::EndInstruction() {
+    for (Register r = zero; r < NumRegs; r = Register(r+1))
+        regs[r].numReserved = 0;
+    if (!cacheInBlock || allocation) {
+        SpillAllDirtyRegisters();
+        DiscardAllRegisters();
+    }
+}
+
+/* Method: ReserveOperand
+ * -----------------------
+ * Gets var in a register (as GetRegister does for an operand) and keeps
+ * that register from being picked for anything else until released.
+ */
+Mips::Register Mips::ReserveOperand(Location *var) {
+    Register reg = GetRegister(var);
+    regs[reg].numReserved++;
+    return reg;
+}
+
+/* Method: ReserveScratch
+ * ----------------------
+ * Empties a register to hold an intermediate result of a tree and
+ * reserves it. The registers to avoid are those of the operands the
+ * result is computed from (already released): they are only taken when
+ * no other register is free, which is fine since an instruction reads
+ * its operands before writing its result.
+ */
+Mips::Register Mips::ReserveScratch(Register avoid1, Register avoid2) {
+    if (!HasFreeRegister(avoid1, avoid2)) avoid1 = avoid2 = zero;
+    Register reg = SelectRegisterToSpill(avoid1, avoid2);
+    SpillRegister(reg);
+    DiscardValueInRegister(reg);
+    regs[reg].numReserved++;
+    regs[reg].lastUsed = ++useCounter;
+    return reg;
+}
+
+/* Method: GetResultRegister
+ * -------------------------
+ * Gets the register the result of a tree is written to for dst,
+ * avoiding the registers of its operands as ReserveScratch does.
+ */
+Mips::Register Mips::GetResultRegister(Location *dst, Register avoid1,
+                                       Register avoid2) {
+    if (!HasFreeRegister(avoid1, avoid2)) avoid1 = avoid2 = zero;
+    return GetRegister(dst, ForWrite, avoid1, avoid2);
+}
+
+// Whether a candidate register other than avoid1 and avoid2 is not
+// reserved
+bool Mips::HasFreeRegister(Register avoid1, Register avoid2) {
+    for (Register r = zero; r < NumRegs; r = Register(r+1))
+        if (IsCandidateRegister(r) && !regs[r].numReserved
+            && r != avoid1 && r != avoid2)
+            return true;
+    return false;
+}
+
+void Mips::ReleaseRegister(Register reg) {
+    if (regs[reg].numReserved > 0) regs[reg].numReserved--;
+}
+
 /* Method: Emit
  * ------------
  * General purpose helper used to emit assembly instructions in
@@ -77,10 +324,24 @@ void Mips::Emit(const char *fmt, ...) {
     va_start(args, fmt);
     vsprintf(buf, fmt, args);
     va_end(args);
-    if (buf[strlen(buf) - 1] != ':') printf("\t"); // don't tab in labels
-    if (buf[0] != '#') printf("  ");   // outdent comments a little
-    printf("%s", buf);
-    if (buf[strlen(buf)-1] != '\n') printf("\n"); // end with a newline
+    std::string line;
+    if (buf[strlen(buf) - 1] != ':') line += "\t"; // don't tab in labels
+    if (buf[0] != '#') line += "  ";   // outdent comments a little
+    line += buf;
+    if (line[line.size() - 1] == '\n') line.erase(line.size() - 1);
+    if (peephole)
+        peephole->Add(line.c_str());
+    else
+        printf("%s\n", line.c_str());
+}
+
+/* Method: FlushOutput
+ * -------------------
+ * Used at the end of the program to print the assembly buffered for
+ * the peephole optimizer, once it has been improved.
+ */
+void Mips::FlushOutput() {
+    if (peephole) peephole->Flush();
 }
 
 /* Method: EmitLoadConstant
@@ -90,10 +351,9 @@ void Mips::Emit(const char *fmt, ...) {
  * immediate) instruction with the constant value.
  */
 void Mips::EmitLoadConstant(Location *dst, int val) {
-    Register r = rd;
+    Register r = GetRegister(dst, ForWrite);
     Emit("li %s, %d\t\t# load constant value %d into %s", regs[r].name,
             val, val, regs[r].name);
-    SpillRegister(dst, rd);
 }
 
 /* Method: EmitLoadStringConstant
@@ -119,8 +379,8 @@ void Mips::EmitLoadStringConstant(Location *dst, const char *str) {
  * Slaves dst into a register and emits an la (load address) instruction
  */
 void Mips::EmitLoadLabel(Location *dst, const char *label) {
-    Emit("la %s, %s\t# load label", regs[rd].name, label);
-    SpillRegister(dst, rd);
+    Register r = GetRegister(dst, ForWrite);
+    Emit("la %s, %s\t# load label", regs[r].name, label);
 }
 
 /* Method: EmitCopy
@@ -130,8 +390,16 @@ void Mips::EmitLoadLabel(Location *dst, const char *label) {
  * copy the contents from src to dst.
  */
 void Mips::EmitCopy(Location *dst, Location *src) {
-    FillRegister(src, rd);
-    SpillRegister(dst, rd);
+    Register r = GetRegister(src);
+    if ((!cacheInBlock || allocation) && !IsAllocated(dst)) {
+        // no need for a move, store the source register straight away.
+        SpillRegister(dst, r);
+        return;
+    }
+    Register d = GetRegister(dst, ForWrite, r);
+    if (d != r)
+        Emit("move %s, %s\t\t# copy %s to %s", regs[d].name, regs[r].name,
+                src->GetName(), dst->GetName());
 }
 
 /* Method: EmitLoad
@@ -143,10 +411,10 @@ void Mips::EmitCopy(Location *dst, Location *src) {
  * at an offset of y bytes from the address currently contained in rx.
  */
 void Mips::EmitLoad(Location *dst, Location *reference, int offset) {
-    FillRegister(reference, rs);
-    Emit("lw %s, %d(%s) \t# load with offset", regs[rd].name,
-            offset, regs[rs].name);
-    SpillRegister(dst, rd);
+    Register r = GetRegister(reference);
+    Register d = GetRegister(dst, ForWrite, r);
+    Emit("lw %s, %d(%s) \t# load with offset", regs[d].name,
+            offset, regs[r].name);
 }
 
 /* Method: EmitStore
@@ -158,10 +426,10 @@ void Mips::EmitLoad(Location *dst, Location *reference, int offset) {
  * at an offset of y bytes from the address currently contained in rx.
  */
 void Mips::EmitStore(Location *reference, Location *value, int offset) {
-    FillRegister(value, rs);
-    FillRegister(reference, rd);
+    Register v = GetRegister(value);
+    Register r = GetRegister(reference, ForRead, v);
     Emit("sw %s, %d(%s) \t# store with offset",
-            regs[rs].name, offset, regs[rd].name);
+            regs[v].name, offset, regs[r].name);
 }
 
 /* Method: EmitBinaryOp
@@ -175,11 +443,90 @@ void Mips::EmitStore(Location *reference, Location *value, int offset) {
 void Mips::EmitBinaryOp(BinaryOp::OpCode code, Location *dst,
         Location *op1, Location *op2)
 {
-    FillRegister(op1, rs);
-    FillRegister(op2, rt);
-    Emit("%s %s, %s, %s\t", NameForTac(code), regs[rd].name,
-            regs[rs].name, regs[rt].name);
-    SpillRegister(dst, rd);
+    Register r1 = GetRegister(op1);
+    Register r2 = GetRegister(op2, ForRead, r1);
+    Register d = GetRegister(dst, ForWrite, r1, r2);
+    Emit("%s %s, %s, %s\t", NameForTac(code), regs[d].name,
+            regs[r1].name, regs[r2].name);
+}
+
+/* Method: CanUseImmediate
+ * ------------------------
+ * Tells whether EmitBinaryOp can do the operation with the constant imm
+ * as its second operand, using the 16-bit immediate forms (signed for
+ * addi and slti, unsigned for andi and ori), a shift for a multiply by
+ * a power of 2 and $zero for a comparison with 0.
+ */
+static bool IsSigned16(int val) {
+    return val >= -32768 && val <= 32767;
+}
+
+bool Mips::CanUseImmediate(BinaryOp::OpCode code, int imm) {
+    switch (code) {
+      case BinaryOp::Add: case BinaryOp::Lt: case BinaryOp::Ge:
+        return IsSigned16(imm);
+      case BinaryOp::Sub:
+        return IsSigned16(-imm);
+      case BinaryOp::Le: case BinaryOp::Gt:
+        return IsSigned16(imm) && IsSigned16(imm + 1);
+      case BinaryOp::Mul:
+        return imm > 0 && (imm & (imm - 1)) == 0;
+      case BinaryOp::Eq: case BinaryOp::Ne:
+        return imm == 0;
+      case BinaryOp::And: case BinaryOp::Or:
+        return imm >= 0 && imm <= 65535;
+      default:
+        return false;
+    }
+}
+
+/* Method: EmitBinaryOp
+ * --------------------
+ * Used to perform a binary operation on a variable and a constant for
+ * which CanUseImmediate is true. Slaves the operand and dst to registers
+ * and emits the immediate form of the operation. The <= and > tests are
+ * done with slti against imm+1, and > and >= flip the slti result.
+ */
+void Mips::EmitBinaryOp(BinaryOp::OpCode code, Location *dst,
+        Location *op1, int imm)
+{
+    Assert(CanUseImmediate(code, imm));
+    Register r1 = GetRegister(op1);
+    Register d = GetRegister(dst, ForWrite, r1);
+    const char *rd = regs[d].name, *rs = regs[r1].name;
+    switch (code) {
+      case BinaryOp::Add:
+        Emit("addi %s, %s, %d\t", rd, rs, imm);
+        break;
+      case BinaryOp::Sub:
+        Emit("addi %s, %s, %d\t", rd, rs, -imm);
+        break;
+      case BinaryOp::Mul: {
+        int shift = 0;
+        while ((1 << shift) != imm) shift++;
+        Emit("sll %s, %s, %d\t", rd, rs, shift);
+        break;
+      }
+      case BinaryOp::Lt: case BinaryOp::Ge:
+        Emit("slti %s, %s, %d\t", rd, rs, imm);
+        break;
+      case BinaryOp::Le: case BinaryOp::Gt:
+        Emit("slti %s, %s, %d\t", rd, rs, imm + 1);
+        break;
+      case BinaryOp::Eq: case BinaryOp::Ne:
+        Emit("%s %s, %s, $zero\t", NameForTac(code), rd, rs);
+        break;
+      case BinaryOp::And:
+        Emit("andi %s, %s, %d\t", rd, rs, imm);
+        break;
+      case BinaryOp::Or:
+        Emit("ori %s, %s, %d\t", rd, rs, imm);
+        break;
+      default:
+        Failure("No immediate form for Tac operator %d", code);
+    }
+    if (code == BinaryOp::Gt || code == BinaryOp::Ge)
+        Emit("xori %s, %s, 1\t", rd, rd);
 }
 
 /* Method: EmitLabel
@@ -190,6 +537,8 @@ void Mips::EmitBinaryOp(BinaryOp::OpCode code, Location *dst,
  * wipe the slate clean.
  */
 void Mips::EmitLabel(const char *label) {
+    SpillAllDirtyRegisters();
+    DiscardAllRegisters();
     Emit("%s:", label);
 }
 
@@ -201,7 +550,9 @@ void Mips::EmitLabel(const char *label) {
  * try to be clever, we just wipe slate clean.
  */
 void Mips::EmitGoto(const char *label) {
+    SpillAllDirtyRegisters();
     Emit("b %s\t\t# unconditional branch", label);
+    DiscardAllRegisters();
 }
 
 /* Method: EmitIfZ
@@ -212,22 +563,100 @@ void Mips::EmitGoto(const char *label) {
  * all registers here.
  */
 void Mips::EmitIfZ(Location *test, const char *label) {
-    FillRegister(test, rs);
-    Emit("beqz %s, %s\t# branch if %s is zero ", regs[rs].name, label,
+    Register r = GetRegister(test);
+    SpillAllDirtyRegisters();
+    Emit("beqz %s, %s\t# branch if %s is zero ", regs[r].name, label,
             test->GetName());
 }
 
+/* Method: EmitIfCmp
+ * -----------------
+ * Used for a conditional branch on the comparison of op1 with op2, or
+ * with the constant imm if op2 is NULL. Slaves the operands to registers
+ * and emits one branch instruction, using the forms comparing with zero
+ * when imm is 0. Spills all registers like EmitIfZ.
+ */
+void Mips::EmitIfCmp(BinaryOp::OpCode code, Location *op1, Location *op2,
+        int imm, const char *label) {
+    static const char *branch[] = { "beq", "bne", "blt", "ble", "bgt", "bge" };
+    const char *name = branch[code - BinaryOp::Eq];
+    Register r1 = GetRegister(op1);
+    Register r2 = op2 ? GetRegister(op2, ForRead, r1) : zero;
+    SpillAllDirtyRegisters();
+    if (op2)
+        Emit("%s %s, %s, %s\t# branch if %s %s %s", name, regs[r1].name,
+             regs[r2].name, label, op1->GetName(), BinaryOp::opName[code],
+             op2->GetName());
+    else if (imm == 0)
+        Emit("%sz %s, %s\t# branch if %s %s 0", name, regs[r1].name, label,
+             op1->GetName(), BinaryOp::opName[code]);
+    else
+        Emit("%s %s, %d, %s\t# branch if %s %s %d", name, regs[r1].name,
+             imm, label, op1->GetName(), BinaryOp::opName[code], imm);
+}
+
+/* Method: EmitJumpTable
+ * ----------------------
+ * Used for an indexed branch through a table of labels. The table goes
+ * in the data segment, and the entry of index is loaded at index * 4
+ * from it, the first entry (for index first) being at offset 0. The
+ * loaded address goes into a scratch register, since at -O2 the
+ * register of index may belong to a variable live at the targets, and
+ * all registers are spilled as for Goto before the jump.
+ */
+void Mips::EmitJumpTable(Location *index, int first,
+        List<const char*> *labels) {
+    static int tableNum = 1;
+    char table[16];
+    sprintf(table, "_table%d", tableNum++);
+    Register r = ReserveOperand(index);
+    Register s = ReserveScratch(r, zero);
+    SpillAllDirtyRegisters();
+    Emit("sll %s, %s, 2\t# offset of entry %s in %s", regs[s].name,
+         regs[r].name, index->GetName(), table);
+    if (first)
+        Emit("lw %s, %s%+d(%s)\t# load entry %s - %d", regs[s].name, table,
+             -4 * first, regs[s].name, index->GetName(), first);
+    else
+        Emit("lw %s, %s(%s)\t# load entry %s", regs[s].name, table,
+             regs[s].name, index->GetName());
+    Emit("jr %s\t\t# jump through %s", regs[s].name, table);
+    Emit(".data");
+    Emit(".align 2");
+    Emit("%s:", table);
+    for (int i = 0; i < labels->NumElements(); i++)
+        Emit(".word %s", labels->Nth(i));
+    Emit(".text");
+    DiscardAllRegisters();
+}
+
 /* Method: EmitParam
  * -----------------
  * Used to push a parameter on the stack in anticipation of upcoming
  * function call. Decrements the stack pointer by 4. Slaves argument into
  * register and then stores contents to location just made at end of
- * stack.
+ * stack. With the register calling convention, the space for all the
+ * arguments is made at once when the first of them is pushed (the last
+ * argument), and the first four arguments are copied to $a0-$a3 instead.
  */
-void Mips::EmitParam(Location *arg) {
-    Emit("subu $sp, $sp, 4\t# decrement sp to make space for param");
-    FillRegister(arg, rs);
-    Emit("sw %s, 4($sp)\t# copy param value to stack", regs[rs].name);
+void Mips::EmitParam(Location *arg, int argIndex, int numArgs) {
+    if (!regParams) {
+        Emit("subu $sp, $sp, 4\t# decrement sp to make space for param");
+        Register r = GetRegister(arg);
+        Emit("sw %s, 4($sp)\t# copy param value to stack", regs[r].name);
+        return;
+    }
+    Assert(argIndex >= 0 && argIndex < numArgs);
+    if (argIndex == numArgs - 1)
+        Emit("subu $sp, $sp, %d\t# decrement sp to make space for params",
+             4 * numArgs);
+    Register r = GetRegister(arg);
+    if (argIndex < NumArgRegs)
+        Emit("move %s, %s\t\t# pass param %d in register",
+             regs[a0 + argIndex].name, regs[r].name, argIndex);
+    else
+        Emit("sw %s, %d($sp)\t# copy param value to stack", regs[r].name,
+             4 + 4 * argIndex);
 }
 
 /* Method: EmitCallInstr
@@ -239,14 +668,24 @@ void Mips::EmitParam(Location *arg) {
  * jal for a label, a jalr if address in register. Both will save the
  * return address in $ra. If there is an expected result passed, we slave
  * the var to a register and copy function return value from $v0 into that
- * register.
+ * register. With a register allocation, the allocated variables live
+ * across the call are saved to their stack slots and reloaded after it.
  */
 void Mips::EmitCallInstr(Location *result, const char *fn, bool isLabel) {
+    SpillAllDirtyRegisters();
+    std::vector<Location*> saved;
+    if (allocation)
+        saved = allocation->GetLiveAcrossCall(currentInstruction);
+    for (size_t i = 0; i < saved.size(); i++)
+        SpillRegister(saved[i], allocation->GetRegister(saved[i]));
     Emit("%s %-15s\t# jump to function", isLabel? "jal": "jalr", fn);
+    DiscardAllRegisters();
+    for (size_t i = 0; i < saved.size(); i++)
+        FillRegister(saved[i], allocation->GetRegister(saved[i]));
     if (result != NULL) {
+        Register r = GetRegister(result, ForWrite);
         Emit("move %s, %s\t\t# copy function return value from $v0",
-                regs[rd].name, regs[v0].name);
-        SpillRegister(result, rd);
+                regs[r].name, regs[v0].name);
     }
 }
 
@@ -256,8 +695,8 @@ void Mips::EmitLCall(Location *dst, const char *label) {
 }
 
 void Mips::EmitACall(Location *dst, Location *fn) {
-    FillRegister(fn, rs);
-    EmitCallInstr(dst, regs[rs].name, false);
+    Register r = GetRegister(fn);
+    EmitCallInstr(dst, regs[r].name, false);
 }
 
 /*
@@ -282,18 +721,61 @@ void Mips::EmitPopParams(int bytes) {
  * which is to remove our locals/temps from the stack, remove
  * saved registers ($fp and $ra) and restore previous values of
  * $fp and $ra so everything is returned to the state we entered.
- * We then emit jr to jump to the saved $ra.
+ * The callee-saved registers saved by the prologue are restored first.
+ * We then emit jr to jump to the saved $ra. A leaf function did not
+ * save $ra, and a function without a stack frame has nothing to undo.
  */
 void Mips::EmitReturn(Location *returnVal) {
     if (returnVal != NULL) {
-        FillRegister(returnVal, rd);
+        Register r = GetRegister(returnVal);
         Emit("move $v0, %s\t\t# assign return value into $v0",
-                regs[rd].name);
+                regs[r].name);
     }
+    SpillForEndFunction();
+    EmitEpilogue();
+    Emit("jr $ra\t\t# return from function");
+    DiscardAllRegisters();
+}
+
+// Restores the registers saved by EmitBeginFunction and pops the frame
+void Mips::EmitEpilogue() {
+    if (!hasFrame) return;
+    for (size_t i = 0; i < calleeSaved.size(); i++)
+        Emit("lw %s, %d($fp)\t# restore callee-saved register",
+             regs[calleeSaved[i]].name, SavedRegisterOffset(i));
     Emit("move $sp, $fp\t\t# pop callee frame off stack");
-    Emit("lw $ra, -4($fp)\t# restore saved ra");
+    if (!isLeaf)
+        Emit("lw $ra, -4($fp)\t# restore saved ra");
     Emit("lw $fp, 0($fp)\t# restore saved fp");
-    Emit("jr $ra\t\t# return from function");
+}
+
+/* Method: EmitTailCall
+ * --------------------
+ * Used for a call in tail position. The arguments just pushed are
+ * copied over the params of the function (the caller made room for at
+ * least as many), except those passed in $a0-$a3 with the register
+ * calling convention. The frame is then popped as for a return, so the
+ * stack is as the caller left it, and we jump to the callee with the
+ * return address of our caller still in $ra. $v0 and $v1 are free by
+ * then: $v1 holds the address of a method and $v0 each argument copied.
+ */
+void Mips::EmitTailCall(const char *label, Location *fnAddr, int numArgs) {
+    Assert(hasFrame && !isLeaf);
+    SpillForEndFunction();
+    if (fnAddr) {
+        Register r = GetRegister(fnAddr);
+        Emit("move $v1, %s\t\t# method address", regs[r].name);
+    }
+    for (int i = regParams ? NumArgRegs : 0; i < numArgs; i++) {
+        Emit("lw $v0, %d($sp)\t# copy param %d over ours", 4 + 4 * i, i);
+        Emit("sw $v0, %d($fp)", 4 + 4 * i);
+    }
+    EmitEpilogue();
+    if (label)
+        Emit("j %-15s\t# tail call", label);
+    else
+        Emit("jr $v1\t\t# tail call");
+    DiscardAllRegisters();
 }
 
 /* Method: EmitBeginFunction
@@ -302,19 +784,76 @@ void Mips::EmitReturn(Location *returnVal) {
  * upon entering a new function. We decrement the $sp to make space
  * and then save the current values of $fp and $ra (since we are
  * going to change them), then set up the $fp and bump the $sp down
- * to make space for all our locals/temps.
+ * to make space for all our locals/temps. A leaf function does not
+ * save $ra (its slot is left unused so that the offsets do not change)
+ * and a function without a stack frame skips all of this, addressing
+ * its params from $sp, which then holds the value $fp would have. With
+ * a register allocation, the callee-saved registers the function uses
+ * are saved below the locals/temps and the params assigned to registers
+ * are then loaded into them. With the register calling convention, the
+ * params passed in registers are moved to their allocated registers or
+ * else stored to their stack slots.
  */
-void Mips::EmitBeginFunction(int stackFrameSize) {
+void Mips::EmitBeginFunction(int stackFrameSize, List<Location*> *params) {
     Assert(stackFrameSize >= 0);
-    Emit("subu $sp, $sp, 8\t# decrement sp to make space to save ra, fp");
-    Emit("sw $fp, 8($sp)\t# save fp");
-    Emit("sw $ra, 4($sp)\t# save ra");
-    Emit("addiu $fp, $sp, 8\t# set up new fp");
+    DiscardAllRegisters();
+    frameReg = hasFrame ? fp : sp;
+    frameSize = stackFrameSize;
+    calleeSaved.clear();
+    if (allocation)
+        calleeSaved = allocation->GetCalleeSavedUsed();
+    Assert(hasFrame || calleeSaved.empty());
+    if (hasFrame) {
+        Emit("subu $sp, $sp, 8\t# decrement sp to make space to save ra, fp");
+        Emit("sw $fp, 8($sp)\t# save fp");
+        if (!isLeaf)
+            Emit("sw $ra, 4($sp)\t# save ra");
+        Emit("addiu $fp, $sp, 8\t# set up new fp");
+
+        int bytes = stackFrameSize + 4 * calleeSaved.size();
+        if (bytes != 0)
+            Emit("subu $sp, $sp, %d\t# decrement sp to make space for "
+                 "locals/temps", bytes);
+        for (size_t i = 0; i < calleeSaved.size(); i++)
+            Emit("sw %s, %d($fp)\t# save callee-saved register",
+                 regs[calleeSaved[i]].name, SavedRegisterOffset(i));
+    } else {
+        Emit("# leaf function without stack frame");
+    }
 
-    if (stackFrameSize != 0)
-        Emit(
-            "subu $sp, $sp, %d\t# decrement sp to make space for locals/temps",
-            stackFrameSize);
+    if (allocation) {
+        Emit("# %d variables spilled by register allocation",
+             allocation->NumSpilled());
+        const std::vector<Location*> &live = allocation->GetLiveOnEntry();
+        for (size_t i = 0; i < live.size(); i++) {
+            Register r = allocation->GetRegister(live[i]);
+            int argIndex = (live[i]->GetOffset() - 4) / 4;
+            if (regParams && argIndex < NumArgRegs)
+                Emit("move %s, %s\t\t# param %s passed in register",
+                     regs[r].name, regs[a0 + argIndex].name,
+                     live[i]->GetName());
+            else
+                FillRegister(live[i], r);
+        }
+    }
+    if (regParams) {
+        for (int i = 0; i < params->NumElements(); i++) {
+            Location *param = params->Nth(i);
+            int argIndex = (param->GetOffset() - 4) / 4;
+            if (argIndex < NumArgRegs && !IsAllocated(param))
+                SpillRegister(param, Register(a0 + argIndex));
+        }
+    }
+}
+
+
+/* Method: SavedRegisterOffset
+ * ---------------------------
+ * The offset from $fp of the slot the i-th callee-saved register is
+ * saved to, just below the locals/temps.
+ */
+int Mips::SavedRegisterOffset(int i) {
+    return -(8 + frameSize + 4 * i);
 }
 
 
@@ -424,7 +963,19 @@ Mips::Mips() {
     regs[s6] = (RegContents){false, NULL, "$s6", true};
     regs[s7] = (RegContents){false, NULL, "$s7", true};
     rs = t0; rt = t1; rd = t2;
+    cacheInBlock = GetOptimizationLevel() >= 1;
+    useCounter = 0;
+    allocation = NULL;
+    regParams = IsFlagOn("regparams", false);
+    isLeaf = false;
+    hasFrame = true;
+    frameReg = fp;
+    frameSize = 0;
+    currentInstruction = NULL;
+    if (IsFlagOn("peephole", GetOptimizationLevel() >= 1))
+        peephole = new Peephole;
 }
 
 const char *Mips::mipsName[BinaryOp::NumOps];
+Peephole *Mips::peephole = NULL;
 
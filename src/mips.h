@@ -18,14 +18,17 @@
 #ifndef _H_mips
 #define _H_mips
 
+#include <vector>
 #include "tac.h"
 #include "list.h"
 
 class Location;
+class RegisterAllocator;
+class Peephole;
 
 class Mips
 {
-  private:
+  public:
     typedef enum {
         zero, at, v0, v1, a0, a1, a2, a3,
         s0, s1, s2, s3, s4, s5, s6, s7,
@@ -33,32 +36,93 @@ class Mips
         t8, t9, k0, k1, gp, sp, fp, ra, NumRegs
     } Register;
 
+  private:
     struct RegContents {
         bool isDirty;
         Location *var;
         const char *name;
         bool isGeneralPurpose;
+        int lastUsed;
+        int numReserved;    // the operands of a tree holding the register
     } regs[NumRegs];
 
     Register rs, rt, rd;
+    static const int NumArgRegs = 4;
+
+    // When set, the contents of registers are kept until the end of the
+    // current basic block instead of being written back after each
+    // Tac instruction.
+    bool cacheInBlock;
+    int useCounter;
+
+    // When set, the registers of the current function were assigned
+    // by a global register allocator (see regalloc.h) and only $v0/$v1
+    // are used for the variables left in memory.
+    RegisterAllocator *allocation;
+
+    // When set, the first four arguments of a call are passed in $a0-$a3
+    // (see EmitParam and EmitBeginFunction).
+    bool regParams;
+
+    // Set for each function by SetFrameInfo. Without a stack frame, $fp
+    // is not set up and the params are addressed from $sp (frameReg).
+    bool isLeaf, hasFrame;
+    Register frameReg;
+
+    // The callee-saved registers the current function saves below its
+    // locals/temps, which take frameSize bytes
+    std::vector<Register> calleeSaved;
+    int frameSize;
 
     typedef enum { ForRead, ForWrite } Reason;
 
     void FillRegister(Location *src, Register reg);
     void SpillRegister(Location *dst, Register reg);
 
+    Register GetRegister(Location *var, Reason reason = ForRead,
+            Register avoid1 = zero, Register avoid2 = zero);
+    bool FindRegisterWithContents(Location *var, Register& reg);
+    bool IsCandidateRegister(Register reg);
+    bool IsAllocated(Location *var);
+    Register SelectRegisterToSpill(Register avoid1, Register avoid2);
+    bool HasFreeRegister(Register avoid1, Register avoid2);
+    void SpillRegister(Register reg);
+    void SpillAllDirtyRegisters();
+    void SpillForEndFunction();
+    int SavedRegisterOffset(int i);
+    void DiscardValueInRegister(Register reg);
+    void DiscardAllRegisters();
+    void EndInstruction();
+
     void EmitCallInstr(Location *dst, const char *fn, bool isL);
+    void EmitEpilogue();
 
     static const char *mipsName[BinaryOp::NumOps];
     static const char *NameForTac(BinaryOp::OpCode code);
 
     Instruction* currentInstruction;
 
+    // When set, Emit buffers the assembly here to be improved by the
+    // peephole optimizer (see peephole.h) instead of printing it.
+    static Peephole *peephole;
+
  public:
     Mips();
 
+    // Sets the register allocation for the function about to be
+    // emitted, NULL to go back to the per instruction register use.
+    void SetAllocation(RegisterAllocator *a) { allocation = a; }
+
+    // Tells whether the function about to be emitted makes no calls
+    // (so $ra need not be saved) and whether it needs a stack frame.
+    void SetFrameInfo(bool leaf, bool needsFrame)
+        { isLeaf = leaf; hasFrame = needsFrame; }
+
     static void Emit(const char *fmt, ...);
 
+    // Prints the assembly held back by the peephole optimizer
+    void FlushOutput();
+
     void EmitLoadConstant(Location *dst, int val);
     void EmitLoadStringConstant(Location *dst, const char *str);
     void EmitLoadLabel(Location *dst, const char *label);
@@ -69,22 +133,43 @@ class Mips
 
     void EmitBinaryOp(BinaryOp::OpCode code, Location *dst,
             Location *op1, Location *op2);
+    void EmitBinaryOp(BinaryOp::OpCode code, Location *dst,
+            Location *op1, int imm);
+
+    // Whether the binary operation can take the constant imm as its
+    // second operand (see the EmitBinaryOp above)
+    static bool CanUseImmediate(BinaryOp::OpCode code, int imm);
 
     void EmitLabel(const char *label);
     void EmitGoto(const char *label);
     void EmitIfZ(Location *test, const char*label);
+    void EmitIfCmp(BinaryOp::OpCode code, Location *op1, Location *op2,
+            int imm, const char *label);
+    void EmitJumpTable(Location *index, int first, List<const char*> *labels);
     void EmitReturn(Location *returnVal);
 
-    void EmitBeginFunction(int frameSize);
+    void EmitBeginFunction(int frameSize, List<Location*> *params);
     void EmitEndFunction();
 
-    void EmitParam(Location *arg);
+    void EmitParam(Location *arg, int argIndex, int numArgs);
     void EmitLCall(Location *result, const char* label);
     void EmitACall(Location *result, Location *fnAddr);
     void EmitPopParams(int bytes);
+    void EmitTailCall(const char *label, Location *fnAddr, int numArgs);
 
     void EmitVTable(const char *label, List<const char*> *methodLabels);
 
+    // Used by the tree instruction selector (see isel.h) to evaluate a
+    // tree of operations within one Tac instruction. A reserved register
+    // is not reused until it is released or the instruction ends.
+    Register ReserveOperand(Location *var);
+    Register ReserveScratch(Register avoid1, Register avoid2);
+    Register GetResultRegister(Location *dst, Register avoid1,
+                               Register avoid2);
+    void ReleaseRegister(Register reg);
+    void SpillBeforeBranch() { SpillAllDirtyRegisters(); }
+    const char *NameOf(Register reg) const { return regs[reg].name; }
+
     void EmitPreamble();
 
     class CurrentInstruction;
@@ -99,6 +184,7 @@ class Mips::CurrentInstruction
     }
 
     ~CurrentInstruction() {
+        mips.EndInstruction();
         mips.currentInstruction= NULL;
     }
 
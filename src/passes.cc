@@ -0,0 +1,114 @@
+/* File: passes.cc
+ * ---------------
+ * Implementation of the PassManager and the table of passes.
+ */
+
+#include <string.h>
+#include <time.h>
+#include "passes.h"
+#include "codegen.h"
+#include "bce.h"
+#include "cfg.h"
+#include "copyprop.h"
+#include "dce.h"
+#include "gvn.h"
+#include "inline.h"
+#include "isel.h"
+#include "ivsr.h"
+#include "licm.h"
+#include "sccp.h"
+#include "ssa.h"
+#include "stackslots.h"
+#include "tailcall.h"
+#include "utility.h"
+
+// The passes in the order they run. Tree instruction selection comes
+// after the others, which do not look into a TreeInstruction, and the
+// stack slots are assigned last, to the locations left after it.
+static struct {
+    const char *name;
+    int level;              // the lowest -O level running the pass
+    FunctionPass function;
+    ProgramPass program;
+} passes[] = {
+    {"deadfuncs", 1, NULL, RemoveUnusedFunctions},
+    {"inline", 2, NULL, InlineCalls},
+    {"tailrecursion", 1, RemoveTailRecursion, NULL},
+    {"ssa", 2, RenameWebs, NULL},
+    {"sccp", 1, PropagateConstants, NULL},
+    {"gvn", 1, NumberValues, NULL},
+    {"copyprop", 1, PropagateCopies, NULL},
+    {"bce", 1, EliminateBoundsChecks, NULL},
+    {"dce", 1, EliminateDeadCode, NULL},
+    {"licm", 1, HoistInvariants, NULL},
+    {"ivsr", 2, ReduceStrength, NULL},
+    {"fusebranches", 1, CodeGenerator::FuseBranches, NULL},
+    {"immediates", 1, CodeGenerator::SelectImmediates, NULL},
+    {"tailcalls", 1, MarkTailCalls, NULL},
+    {"isel", 1, SelectTrees, NULL},
+    {"stackslots", 1, AssignStackSlots, NULL},
+};
+static const int NumPasses = sizeof(passes) / sizeof(passes[0]);
+
+PassManager::PassManager(std::list<Instruction*> &c) : code(c) {}
+
+bool PassManager::IsPass(const char *name) {
+    for (int i = 0; i < NumPasses; i++)
+        if (!strcmp(passes[i].name, name)) return true;
+    return false;
+}
+
+void PassManager::RunFunctionPass(int i) {
+    std::list<Instruction*>::iterator p = code.begin();
+    while (p != code.end()) {
+        std::list<Instruction*>::iterator end =
+            CodeGenerator::FunctionEnd(code, p);
+        if (end != p) {
+            passes[i].function(code, p, end);
+            p = end;
+        } else
+            ++p;
+    }
+}
+
+void PassManager::RunProgramPass(int i) {
+    passes[i].program(code);
+}
+
+void PassManager::Run() {
+    double total = 0;
+    for (int i = 0; i < NumPasses; i++) {
+        if (!IsFlagOn(passes[i].name,
+                      GetOptimizationLevel() >= passes[i].level))
+            continue;
+        int before = code.size();
+        clock_t start = clock();
+        if (passes[i].function)
+            RunFunctionPass(i);
+        else
+            RunProgramPass(i);
+        double ms = 1000.0 * (clock() - start) / CLOCKS_PER_SEC;
+        total += ms;
+        PrintDebug("passes", "%-14s %8.3f ms %6d -> %6d instructions",
+                   passes[i].name, ms, before, (int)code.size());
+    }
+    PrintDebug("passes", "%-14s %8.3f ms", "total", total);
+    if (IsDebugOn("cfg"))
+        PrintGraphs();
+}
+
+void PassManager::PrintGraphs() {
+    std::list<Instruction*>::iterator p = code.begin();
+    while (p != code.end()) {
+        std::list<Instruction*>::iterator end =
+            CodeGenerator::FunctionEnd(code, p);
+        if (end != p) {
+            FlowGraph graph(p, end);
+            graph.ComputeDominators();
+            graph.ComputeLoopDepth();
+            graph.Print();
+            p = end;
+        } else
+            ++p;
+    }
+}
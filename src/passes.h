@@ -0,0 +1,53 @@
+/* File: passes.h
+ * --------------
+ * The PassManager runs the optimization passes over the Tac of the
+ * program before it is translated to MIPS.
+ *
+ * The passes are listed in order in a table in passes.cc. A function
+ * pass rewrites the Tac of one function at a time: the instructions
+ * from the Label naming the function to its EndFunc (see
+ * CodeGenerator::FunctionEnd). It may insert, replace and erase
+ * instructions in that range, except its first Label. A program pass
+ * sees the whole list of instructions at once.
+ *
+ * Each pass has a name and the optimization level from which it runs.
+ * The name is also a code generation flag, so a pass can be turned on
+ * at a lower level with -f<name> or off with -fno-<name>.
+ *
+ * The debug key "passes" reports, for each pass that ran, the time it
+ * took and the number of Tac instructions before and after it. The
+ * debug key "cfg" prints the flow graph of each function (blocks,
+ * successors and immediate dominators) after the passes.
+ */
+
+#ifndef _H_passes
+#define _H_passes
+
+#include <list>
+#include "tac.h"
+
+typedef void (*FunctionPass)(std::list<Instruction*> &code,
+                             std::list<Instruction*>::iterator begin,
+                             std::list<Instruction*>::iterator end);
+typedef void (*ProgramPass)(std::list<Instruction*> &code);
+
+class PassManager
+{
+  private:
+    std::list<Instruction*> &code;
+
+    void RunFunctionPass(int i);
+    void RunProgramPass(int i);
+    void PrintGraphs();
+
+  public:
+    PassManager(std::list<Instruction*> &code);
+
+    // Runs the passes enabled at the current optimization level
+    void Run();
+
+    // Whether name is the name of a pass, and so a code generation flag
+    static bool IsPass(const char *name);
+};
+
+#endif
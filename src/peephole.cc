@@ -0,0 +1,245 @@
+/* File: peephole.cc
+ * -----------------
+ * Implementation of the Peephole class and its table of rules.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "peephole.h"
+#include "utility.h"
+
+static std::string Trim(const std::string &s) {
+    size_t first = s.find_first_not_of(" \t\n");
+    if (first == std::string::npos) return "";
+    size_t last = s.find_last_not_of(" \t\n");
+    return s.substr(first, last - first + 1);
+}
+
+AsmLine::AsmLine(const char *line) : text(line), deleted(false) {
+    std::string s = Trim(text);
+    size_t hash = s.find('#');
+    std::string word = s.substr(0, s.find_first_of(" \t"));
+    if (s.empty() || s[0] == '#') {
+        kind = Comment;
+    } else if (word[word.size() - 1] == ':') {
+        std::string rest = Trim(s.substr(word.size()));
+        kind = (rest.empty() || rest[0] == '#') ? Label : Directive;
+        op = word.substr(0, word.size() - 1);
+    } else if (s[0] == '.') {
+        kind = Directive;
+        op = word;
+    } else {
+        kind = Instr;
+        op = word;
+        if (hash != std::string::npos) comment = s.substr(hash);
+        std::string operands = Trim(s.substr(word.size(), hash - word.size()));
+        while (!operands.empty()) {
+            size_t comma = operands.find(',');
+            args.push_back(Trim(operands.substr(0, comma)));
+            if (comma == std::string::npos) break;
+            operands = operands.substr(comma + 1);
+        }
+    }
+}
+
+void AsmLine::Rewrite(const std::string &o, const std::vector<std::string> &a,
+                      const std::string &c) {
+    op = o;
+    args = a;
+    comment = c;
+    text = "\t  " + op + " ";
+    for (size_t i = 0; i < args.size(); i++)
+        text += (i ? ", " : "") + args[i];
+    if (!comment.empty()) text += "\t" + comment;
+}
+
+/* Helpers for the rules. Next skips comments and deleted lines, so that
+ * the TAC comments between two instructions do not keep them from
+ * being seen as neighbors.
+ */
+static size_t Next(std::vector<AsmLine> &lines, size_t i) {
+    for (i++; i < lines.size(); i++)
+        if (!lines[i].deleted && lines[i].kind != AsmLine::Comment)
+            break;
+    return i;
+}
+
+static bool IsInstr(std::vector<AsmLine> &lines, size_t i, const char *op) {
+    return i < lines.size() && lines[i].kind == AsmLine::Instr
+        && (!op || lines[i].op == op);
+}
+
+// The conditional branches and the branch testing the opposite condition
+static const char *inverseBranch[][2] = {
+    {"beq", "bne"}, {"blt", "bge"}, {"ble", "bgt"},
+    {"beqz", "bnez"}, {"bltz", "bgez"}, {"blez", "bgtz"}
+};
+static const int NumBranches =
+    sizeof(inverseBranch) / sizeof(inverseBranch[0]);
+
+static const char *InverseBranch(const std::string &op) {
+    for (int i = 0; i < NumBranches; i++)
+        for (int j = 0; j < 2; j++)
+            if (op == inverseBranch[i][j]) return inverseBranch[i][1 - j];
+    return NULL;
+}
+
+static bool IsJump(const std::string &op) {
+    return op == "b" || op == "j";
+}
+
+// Whether one of the labels starting at line i is label
+static bool LabelFollows(std::vector<AsmLine> &lines, size_t i,
+                         const std::string &label) {
+    for (; i < lines.size() && lines[i].kind == AsmLine::Label;
+         i = Next(lines, i))
+        if (lines[i].op == label) return true;
+    return false;
+}
+
+/* The rules. Each one is given the lines and the position of a line
+ * that is not a comment, and returns whether it rewrote anything.
+ */
+
+// move $r, $r
+static bool MoveToSelf(std::vector<AsmLine> &lines, size_t i) {
+    AsmLine &a = lines[i];
+    if (!IsInstr(lines, i, "move") || a.args.size() != 2
+        || a.args[0] != a.args[1])
+        return false;
+    a.deleted = true;
+    return true;
+}
+
+// sw $r, x followed by lw $s, x: the value is still in $r
+static bool StoreThenLoad(std::vector<AsmLine> &lines, size_t i) {
+    size_t j = Next(lines, i);
+    if (!IsInstr(lines, i, "sw") || !IsInstr(lines, j, "lw")
+        || lines[i].args.size() != 2 || lines[j].args.size() != 2
+        || lines[i].args[1] != lines[j].args[1])
+        return false;
+    const std::string &stored = lines[i].args[0];
+    if (lines[j].args[0] == stored) {
+        lines[j].deleted = true;
+    } else {
+        std::vector<std::string> args;
+        args.push_back(lines[j].args[0]);
+        args.push_back(stored);
+        lines[j].Rewrite("move", args,
+                         "# reuse value just stored to " + lines[i].args[1]);
+    }
+    return true;
+}
+
+// a branch or jump to the label right after it
+static bool BranchToNext(std::vector<AsmLine> &lines, size_t i) {
+    AsmLine &a = lines[i];
+    if (!IsInstr(lines, i, NULL) || a.args.empty()
+        || !(IsJump(a.op) || InverseBranch(a.op)))
+        return false;
+    if (!LabelFollows(lines, Next(lines, i), a.args.back()))
+        return false;
+    a.deleted = true;
+    return true;
+}
+
+// a conditional branch over a jump: branch on the opposite condition to
+// where the jump goes instead
+static bool BranchOverJump(std::vector<AsmLine> &lines, size_t i) {
+    AsmLine &a = lines[i];
+    size_t j = Next(lines, i);
+    const char *inverse = InverseBranch(a.op);
+    if (!IsInstr(lines, i, NULL) || !inverse || !IsInstr(lines, j, NULL)
+        || !IsJump(lines[j].op)
+        || !LabelFollows(lines, Next(lines, j), a.args.back()))
+        return false;
+    std::vector<std::string> args = a.args;
+    args.back() = lines[j].args[0];
+    a.Rewrite(inverse, args, "# inverted to branch around a jump");
+    lines[j].deleted = true;
+    return true;
+}
+
+// an instruction right after a jump or return, that no label leads to
+static bool Unreachable(std::vector<AsmLine> &lines, size_t i) {
+    size_t j = Next(lines, i);
+    if (!IsInstr(lines, i, NULL)
+        || !(IsJump(lines[i].op) || lines[i].op == "jr")
+        || !IsInstr(lines, j, NULL))
+        return false;
+    lines[j].deleted = true;
+    return true;
+}
+
+static struct {
+    const char *name;
+    bool (*apply)(std::vector<AsmLine> &lines, size_t i);
+    int fired;
+} rules[] = {
+    {"move-to-self", MoveToSelf, 0},
+    {"store-then-load", StoreThenLoad, 0},
+    {"branch-to-next", BranchToNext, 0},
+    {"branch-over-jump", BranchOverJump, 0},
+    {"unreachable", Unreachable, 0},
+};
+static const int NumRules = sizeof(rules) / sizeof(rules[0]);
+
+void Peephole::Add(const char *line) {
+    lines.push_back(AsmLine(line));
+}
+
+/* Moves the lines between each .data and the next .text (the string
+ * constants and the vtables) to one data segment at the end, so that
+ * the instructions around them become neighbors. The output still ends
+ * in the text segment, where the run script appends defs.asm.
+ */
+int Peephole::MergeDataSegments(std::vector<AsmLine> &out) {
+    std::vector<AsmLine> data;
+    bool inData = false;
+    int merged = 0;
+    for (size_t i = 0; i < lines.size(); i++) {
+        AsmLine &line = lines[i];
+        if (line.kind == AsmLine::Directive && line.op == ".data") {
+            inData = true;
+            merged++;
+        } else if (line.kind == AsmLine::Directive && line.op == ".text"
+                   && inData) {
+            inData = false;
+        } else {
+            (inData ? data : out).push_back(line);
+        }
+    }
+    if (!data.empty()) {
+        out.push_back(AsmLine("\t  .data"));
+        out.insert(out.end(), data.begin(), data.end());
+        out.push_back(AsmLine("\t  .text"));   // defs.asm is appended
+    }
+    return merged;
+}
+
+void Peephole::Flush() {
+    std::vector<AsmLine> code;
+    int merged = MergeDataSegments(code);
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 0; i < code.size(); i++) {
+            for (int r = 0; r < NumRules; r++) {
+                if (code[i].deleted || code[i].kind == AsmLine::Comment)
+                    break;
+                if (rules[r].apply(code, i)) {
+                    rules[r].fired++;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; i < code.size(); i++)
+        if (!code[i].deleted) printf("%s\n", code[i].text.c_str());
+    PrintDebug("peephole", "merge-data-segments: %d", merged);
+    for (int r = 0; r < NumRules; r++)
+        PrintDebug("peephole", "%s: %d", rules[r].name, rules[r].fired);
+    lines.clear();
+}
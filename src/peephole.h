@@ -0,0 +1,56 @@
+/* File: peephole.h
+ * ----------------
+ * The Peephole class buffers the assembly emitted by the Mips class
+ * and improves it with a set of local rewriting rules before printing
+ * it. Each rule looks at a small window of consecutive instructions
+ * (comments are skipped, labels are not) and either rewrites it or
+ * leaves it alone. The rules are listed in a table in peephole.cc and
+ * are applied until none of them fires.
+ *
+ * The string constants and vtables, which are emitted in the middle
+ * of the text segment, are also moved to a single data segment at the
+ * end of the program.
+ *
+ * The debug key "peephole" reports how many times each rule fired.
+ */
+
+#ifndef _H_peephole
+#define _H_peephole
+
+#include <string>
+#include <vector>
+
+// One line of assembly, split into its parts when it is an instruction
+struct AsmLine
+{
+    typedef enum { Instr, Label, Directive, Comment } Kind;
+    Kind kind;
+    std::string text;              // the line as emitted
+    std::string op;                // instruction name or label name
+    std::vector<std::string> args; // operands of an instruction
+    std::string comment;
+    bool deleted;
+
+    AsmLine(const char *line);
+
+    // Replaces the instruction, regenerating its text
+    void Rewrite(const std::string &op, const std::vector<std::string> &args,
+                 const std::string &comment);
+};
+
+class Peephole
+{
+  private:
+    std::vector<AsmLine> lines;
+
+    int MergeDataSegments(std::vector<AsmLine> &out);
+
+  public:
+    // Adds one line formatted by Mips::Emit (without the newline)
+    void Add(const char *line);
+
+    // Applies the rules to the lines buffered so far and prints them
+    void Flush();
+};
+
+#endif
@@ -0,0 +1,370 @@
+/* File: regalloc.cc
+ * -----------------
+ * Implementation of the register allocators.
+ */
+
+#include <algorithm>
+#include "regalloc.h"
+#include "utility.h"
+
+const Mips::Register RegisterAllocator::allocatable[] = {
+    Mips::t0, Mips::t1, Mips::t2, Mips::t3, Mips::t4,
+    Mips::t5, Mips::t6, Mips::t7, Mips::t8, Mips::t9,
+    Mips::s0, Mips::s1, Mips::s2, Mips::s3,
+    Mips::s4, Mips::s5, Mips::s6, Mips::s7
+};
+const int RegisterAllocator::NumAllocatable =
+    sizeof(allocatable) / sizeof(allocatable[0]);
+
+Mips::Register RegisterAllocator::GetRegister(Location *loc) const {
+    std::map<Location*, Mips::Register>::const_iterator it =
+        assignment.find(loc);
+    return it == assignment.end() ? Mips::zero : it->second;
+}
+
+const std::vector<Location*> &
+RegisterAllocator::GetLiveAcrossCall(Instruction *call) {
+    return liveAcrossCall[call];
+}
+
+std::vector<Mips::Register> RegisterAllocator::RegistersToTry(Location *loc) {
+    std::vector<Mips::Register> regs;
+    bool calleeSavedFirst = crossesCall.count(loc) > 0;
+    for (int pass = 0; pass < 2; pass++)
+        for (int i = 0; i < NumAllocatable; i++)
+            if (IsCalleeSaved(allocatable[i]) == (calleeSavedFirst == !pass))
+                regs.push_back(allocatable[i]);
+    return regs;
+}
+
+void RegisterAllocator::FindLocationsLiveAcrossCalls() {
+    for (int i = 0; i < graph->NumBlocks(); i++) {
+        BasicBlock *b = graph->GetBlock(i);
+        LocationSet live = b->liveOut;
+        for (int j = b->code.size() - 1; j >= 0; j--) {
+            Instruction *instr = b->code[j];
+            if (FlowGraph::IsCall(instr))
+                for (LocationSet::iterator it = live.begin();
+                     it != live.end(); ++it)
+                    if (*it != instr->GetDst()) crossesCall.insert(*it);
+            FlowGraph::TransferLive(instr, live);
+        }
+    }
+}
+
+void RegisterAllocator::RecordCallsAndEntry() {
+    for (int i = 0; i < graph->NumBlocks(); i++) {
+        BasicBlock *b = graph->GetBlock(i);
+        LocationSet live = b->liveOut;
+        for (int j = b->code.size() - 1; j >= 0; j--) {
+            Instruction *instr = b->code[j];
+            if (FlowGraph::IsCall(instr)) {
+                // coalesced locations live at the same time share their
+                // value, so saving one of them is enough
+                std::vector<Location*> &across = liveAcrossCall[instr];
+                std::set<Mips::Register> saved;
+                for (LocationSet::iterator it = live.begin();
+                     it != live.end(); ++it) {
+                    Mips::Register r = GetRegister(*it);
+                    if (*it != instr->GetDst() && r && !IsCalleeSaved(r)
+                        && !saved.count(r)) {
+                        saved.insert(r);
+                        across.push_back(*it);
+                    }
+                }
+            }
+            FlowGraph::TransferLive(instr, live);
+        }
+    }
+    LocationSet &entry = graph->GetEntry()->liveIn;
+    for (LocationSet::iterator it = entry.begin(); it != entry.end(); ++it)
+        if ((*it)->GetOffset() > 0 && GetRegister(*it))
+            liveOnEntry.push_back(*it);
+    std::set<Mips::Register> used;
+    for (std::map<Location*, Mips::Register>::iterator it =
+         assignment.begin(); it != assignment.end(); ++it)
+        if (IsCalleeSaved(it->second)) used.insert(it->second);
+    calleeSavedUsed.assign(used.begin(), used.end());
+    PrintDebug("regalloc", "%s: %d spilled", graph->GetName(), numSpilled);
+}
+
+// A live interval, in positions: instruction number i has position 2i
+// for the reads of its operands and 2i+1 for the write of its result.
+struct Interval {
+    Location *loc;
+    int start, end;
+};
+
+static bool StartsBefore(const Interval *a, const Interval *b) {
+    return a->start < b->start;
+}
+
+static bool EndsBefore(const Interval *a, const Interval *b) {
+    return a->end < b->end;
+}
+
+/* Method: LinearScanAllocator::Allocate
+ * -------------------------------------
+ * Builds the live intervals from the liveness of each instruction and
+ * scans them in order of increasing start. The active list holds the
+ * intervals currently in registers, sorted by end; intervals that have
+ * ended give back their registers. When no register is free, either
+ * the new interval or the active one ending last is spilled, whichever
+ * ends later.
+ */
+void LinearScanAllocator::Allocate() {
+    graph->ComputeLiveness();
+    FindLocationsLiveAcrossCalls();
+
+    std::map<Location*, Interval> intervals;
+    int numInstrs = 0;
+    for (int i = 0; i < graph->NumBlocks(); i++)
+        numInstrs += graph->GetBlock(i)->code.size();
+    int pos = 2 * numInstrs;
+    for (int i = graph->NumBlocks() - 1; i >= 0; i--) {
+        BasicBlock *b = graph->GetBlock(i);
+        LocationSet live = b->liveOut;
+        for (int j = b->code.size() - 1; j >= 0; j--) {
+            Instruction *instr = b->code[j];
+            pos -= 2;
+            Location *dst = instr->GetDst();
+            if (FlowGraph::IsTracked(dst)) live.insert(dst);
+            for (int k = 0; k < 2; k++) {
+                // k == 0: live after instr, k == 1: live before instr
+                int p = pos + 1 - k;
+                for (LocationSet::iterator it = live.begin();
+                     it != live.end(); ++it) {
+                    std::map<Location*, Interval>::iterator iv =
+                        intervals.find(*it);
+                    if (iv == intervals.end()) {
+                        Interval n = { *it, p, p };
+                        intervals[*it] = n;
+                    } else {
+                        iv->second.start = std::min(iv->second.start, p);
+                        iv->second.end = std::max(iv->second.end, p);
+                    }
+                }
+                if (k == 0) FlowGraph::TransferLive(instr, live);
+            }
+        }
+    }
+
+    std::vector<Interval*> order;
+    for (std::map<Location*, Interval>::iterator it = intervals.begin();
+         it != intervals.end(); ++it)
+        order.push_back(&it->second);
+    std::stable_sort(order.begin(), order.end(), StartsBefore);
+
+    std::set<Mips::Register> freeRegs(allocatable,
+                                      allocatable + NumAllocatable);
+    std::vector<Interval*> active;
+    for (size_t i = 0; i < order.size(); i++) {
+        Interval *cur = order[i];
+        while (!active.empty() && active.front()->end < cur->start) {
+            freeRegs.insert(assignment[active.front()->loc]);
+            active.erase(active.begin());
+        }
+        if (freeRegs.empty()) {
+            Interval *last = active.back();
+            if (last->end > cur->end) {
+                assignment[cur->loc] = assignment[last->loc];
+                assignment.erase(last->loc);
+                active.pop_back();
+            } else {
+                numSpilled++;
+                continue;
+            }
+            numSpilled++;
+        } else {
+            std::vector<Mips::Register> regs = RegistersToTry(cur->loc);
+            for (size_t r = 0; !assignment.count(cur->loc); r++)
+                if (freeRegs.count(regs[r])) {
+                    assignment[cur->loc] = regs[r];
+                    freeRegs.erase(regs[r]);
+                }
+        }
+        active.insert(std::upper_bound(active.begin(), active.end(),
+                                       cur, EndsBefore), cur);
+    }
+
+    RecordCallsAndEntry();
+}
+
+int GraphColoringAllocator::NodeFor(Location *loc) {
+    std::map<Location*, int>::iterator it = nodeFor.find(loc);
+    if (it != nodeFor.end()) return it->second;
+    int n = nodes.size();
+    nodes.push_back(loc);
+    nodeFor[loc] = n;
+    adjacent.push_back(std::set<int>());
+    alias.push_back(n);
+    spillCost.push_back(0);
+    return n;
+}
+
+int GraphColoringAllocator::Find(int n) {
+    while (alias[n] != n)
+        n = alias[n];
+    return n;
+}
+
+void GraphColoringAllocator::AddEdge(int a, int b) {
+    if (a == b) return;
+    adjacent[a].insert(b);
+    adjacent[b].insert(a);
+}
+
+/* Method: GraphColoringAllocator::BuildGraph
+ * ------------------------------------------
+ * A definition interferes with every location live after it, except
+ * for the source of a copy, which holds the same value. The locations
+ * live on entry to the function (the params) all interfere with each
+ * other. Also sums up the spill costs and collects the copies.
+ */
+void GraphColoringAllocator::BuildGraph() {
+    for (int i = 0; i < graph->NumBlocks(); i++) {
+        BasicBlock *b = graph->GetBlock(i);
+        double weight = 1;
+        for (int d = 0; d < b->loopDepth && d < 6; d++)
+            weight *= 10;
+        LocationSet live = b->liveOut;
+        for (int j = b->code.size() - 1; j >= 0; j--) {
+            Instruction *instr = b->code[j];
+            Location *dst = instr->GetDst();
+            std::vector<Location*> srcs;
+            instr->GetSrcs(srcs);
+            Location *copied = NULL;
+            if (dynamic_cast<Assign*>(instr) && FlowGraph::IsTracked(srcs[0]))
+                copied = srcs[0];
+            if (FlowGraph::IsTracked(dst)) {
+                int d = NodeFor(dst);
+                spillCost[d] += weight;
+                for (LocationSet::iterator it = live.begin();
+                     it != live.end(); ++it)
+                    if (*it != copied) AddEdge(d, NodeFor(*it));
+                if (copied)
+                    moves.push_back(std::make_pair(d, NodeFor(copied)));
+            }
+            for (size_t k = 0; k < srcs.size(); k++)
+                if (FlowGraph::IsTracked(srcs[k]))
+                    spillCost[NodeFor(srcs[k])] += weight;
+            FlowGraph::TransferLive(instr, live);
+        }
+    }
+    LocationSet &entry = graph->GetEntry()->liveIn;
+    for (LocationSet::iterator a = entry.begin(); a != entry.end(); ++a)
+        for (LocationSet::iterator b = a; b != entry.end(); ++b)
+            AddEdge(NodeFor(*a), NodeFor(*b));
+}
+
+/* Method: GraphColoringAllocator::Coalesce
+ * ----------------------------------------
+ * Merges the two ends of each copy that do not interfere, provided the
+ * merged node has fewer than NumAllocatable neighbors of significant
+ * degree (Briggs' conservative test). Repeats until nothing changes
+ * since each merge can make other copies coalescable.
+ */
+void GraphColoringAllocator::Coalesce() {
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 0; i < moves.size(); i++) {
+            int a = Find(moves[i].first), b = Find(moves[i].second);
+            if (a == b || adjacent[a].count(b)) continue;
+            std::set<int> merged = adjacent[a];
+            merged.insert(adjacent[b].begin(), adjacent[b].end());
+            int significant = 0;
+            for (std::set<int>::iterator it = merged.begin();
+                 it != merged.end(); ++it) {
+                int degree = adjacent[*it].size();
+                if (adjacent[a].count(*it) && adjacent[b].count(*it))
+                    degree--;
+                if (degree >= NumAllocatable) significant++;
+            }
+            if (significant >= NumAllocatable) continue;
+
+            for (std::set<int>::iterator it = adjacent[b].begin();
+                 it != adjacent[b].end(); ++it) {
+                adjacent[*it].erase(b);
+                AddEdge(a, *it);
+            }
+            adjacent[b].clear();
+            alias[b] = a;
+            spillCost[a] += spillCost[b];
+            changed = true;
+        }
+    }
+}
+
+/* Method: GraphColoringAllocator::Color
+ * -------------------------------------
+ * Simplify removes the nodes of insignificant degree one at a time
+ * (or, when there are none left, the cheapest node to spill) and
+ * pushes them on a stack. Select pops them back and gives each a
+ * register not used by its neighbors colored so far; a node for which
+ * none is left is spilled.
+ */
+void GraphColoringAllocator::Color() {
+    std::vector<int> degree(nodes.size());
+    std::vector<bool> removed(nodes.size());
+    int remaining = 0;
+    for (size_t n = 0; n < nodes.size(); n++) {
+        degree[n] = adjacent[n].size();
+        removed[n] = alias[n] != (int)n;
+        if (!removed[n]) remaining++;
+    }
+
+    std::vector<int> stack;
+    while (remaining > 0) {
+        int pick = -1;
+        for (size_t n = 0; n < nodes.size() && pick < 0; n++)
+            if (!removed[n] && degree[n] < NumAllocatable)
+                pick = n;
+        if (pick < 0) {
+            for (size_t n = 0; n < nodes.size(); n++)
+                if (!removed[n] && (pick < 0 || spillCost[n] / degree[n]
+                        < spillCost[pick] / degree[pick]))
+                    pick = n;
+        }
+        removed[pick] = true;
+        remaining--;
+        stack.push_back(pick);
+        for (std::set<int>::iterator it = adjacent[pick].begin();
+             it != adjacent[pick].end(); ++it)
+            degree[*it]--;
+    }
+
+    // a coalesced node crosses a call if any of its locations does
+    for (size_t n = 0; n < nodes.size(); n++)
+        if (crossesCall.count(nodes[n]))
+            crossesCall.insert(nodes[Find(n)]);
+
+    std::vector<Mips::Register> color(nodes.size(), Mips::zero);
+    while (!stack.empty()) {
+        int n = stack.back();
+        stack.pop_back();
+        std::set<Mips::Register> used;
+        for (std::set<int>::iterator it = adjacent[n].begin();
+             it != adjacent[n].end(); ++it)
+            used.insert(color[*it]);
+        std::vector<Mips::Register> regs = RegistersToTry(nodes[n]);
+        for (size_t r = 0; r < regs.size() && !color[n]; r++)
+            if (!used.count(regs[r]))
+                color[n] = regs[r];
+        if (!color[n]) numSpilled++;
+    }
+
+    for (size_t n = 0; n < nodes.size(); n++)
+        if (color[Find(n)])
+            assignment[nodes[n]] = color[Find(n)];
+}
+
+void GraphColoringAllocator::Allocate() {
+    graph->ComputeLiveness();
+    graph->ComputeLoopDepth();
+    FindLocationsLiveAcrossCalls();
+    BuildGraph();
+    Coalesce();
+    Color();
+    RecordCallsAndEntry();
+}
@@ -0,0 +1,127 @@
+/* File: regalloc.h
+ * ----------------
+ * Global register allocation for the variables of one function.
+ *
+ * A RegisterAllocator assigns the fp-relative locations (params,
+ * locals and temps) of a function to the general purpose registers.
+ * A location that gets no register stays in its stack slot and is
+ * loaded/stored around each use by the Mips class, which keeps $v0
+ * and $v1 as scratch registers for that.
+ *
+ * The $s registers are callee-saved: a function saves the ones it uses
+ * in its prologue and restores them before returning, so they keep
+ * their values across calls. The $t registers are not preserved across
+ * calls, so the allocator records for each call which locations
+ * allocated to $t registers are live across it; Mips saves those to
+ * their stack slots before the call and reloads them after it. Both
+ * allocators prefer $s registers for the locations live across a call
+ * and $t registers for the others.
+ *
+ * The LinearScanAllocator is the linear scan algorithm of Poletto and
+ * Sarkar: each location gets one live interval spanning the positions
+ * (in instruction order) where it is live, and the intervals are
+ * assigned registers in order of their start, spilling the interval
+ * that ends furthest away when the registers run out.
+ *
+ * The GraphColoringAllocator is a Chaitin-Briggs allocator: it builds
+ * the interference graph of the locations, conservatively coalesces
+ * the locations related by Assign copies (Briggs' test, so coalescing
+ * never makes the graph harder to color), and colors it by simplify
+ * and select with optimistic coloring. When the graph has to be
+ * simplified past a node of significant degree, the node with the
+ * lowest spill cost per neighbor is chosen, where the spill cost counts
+ * each use or definition as 10 to the power of its loop depth.
+ */
+
+#ifndef _H_regalloc
+#define _H_regalloc
+
+#include <map>
+#include <set>
+#include <vector>
+#include "cfg.h"
+#include "mips.h"
+
+class RegisterAllocator
+{
+  protected:
+    FlowGraph *graph;
+    std::map<Location*, Mips::Register> assignment;
+    std::map<Instruction*, std::vector<Location*> > liveAcrossCall;
+    std::vector<Location*> liveOnEntry;
+    std::vector<Mips::Register> calleeSavedUsed;
+    int numSpilled;
+
+    // The locations live across at least one call
+    LocationSet crossesCall;
+
+    // Fills in crossesCall. Needs the liveness computed on graph.
+    void FindLocationsLiveAcrossCalls();
+
+    // Fills in liveAcrossCall, liveOnEntry and calleeSavedUsed once the
+    // assignment has been made. Needs the liveness computed on graph.
+    void RecordCallsAndEntry();
+
+    // The allocatable registers in the order to try them for loc
+    std::vector<Mips::Register> RegistersToTry(Location *loc);
+
+  public:
+    RegisterAllocator(FlowGraph *g) : graph(g), numSpilled(0) {}
+    virtual ~RegisterAllocator() {}
+
+    virtual void Allocate() = 0;
+
+    // Returns the register assigned to loc, or zero if it has none
+    Mips::Register GetRegister(Location *loc) const;
+
+    // The allocated locations live across the given call instruction
+    const std::vector<Location*> &GetLiveAcrossCall(Instruction *call);
+
+    // The allocated params that have to be loaded into their registers
+    // on entry to the function
+    const std::vector<Location*> &GetLiveOnEntry() const
+        { return liveOnEntry; }
+
+    // The callee-saved registers the function has to save and restore
+    const std::vector<Mips::Register> &GetCalleeSavedUsed() const
+        { return calleeSavedUsed; }
+
+    int NumSpilled() const { return numSpilled; }
+
+    // The registers available to the allocator
+    static const Mips::Register allocatable[];
+    static const int NumAllocatable;
+    static bool IsCalleeSaved(Mips::Register r)
+        { return r >= Mips::s0 && r <= Mips::s7; }
+};
+
+class LinearScanAllocator : public RegisterAllocator
+{
+  public:
+    LinearScanAllocator(FlowGraph *g) : RegisterAllocator(g) {}
+    void Allocate();
+};
+
+class GraphColoringAllocator : public RegisterAllocator
+{
+  private:
+    std::vector<Location*> nodes;
+    std::map<Location*, int> nodeFor;
+    std::vector<std::set<int> > adjacent;
+    std::vector<int> alias;     // the node a coalesced node was merged into
+    std::vector<double> spillCost;
+    std::vector<std::pair<int, int> > moves;
+
+    int NodeFor(Location *loc);
+    int Find(int n);
+    void AddEdge(int a, int b);
+    void BuildGraph();
+    void Coalesce();
+    void Color();
+
+  public:
+    GraphColoringAllocator(FlowGraph *g) : RegisterAllocator(g) {}
+    void Allocate();
+};
+
+#endif
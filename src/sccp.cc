@@ -0,0 +1,199 @@
+/* File: sccp.cc
+ * -------------
+ * Implementation of sparse conditional constant propagation.
+ */
+
+#include "sccp.h"
+#include "mips.h"
+#include "utility.h"
+
+ConstantPropagator::ConstantPropagator(FlowGraph &g)
+  : graph(g), out(g.NumBlocks()), visited(g.NumBlocks(), false),
+    numFolded(0), numBranches(0) {}
+
+bool ConstantPropagator::IsExecutable(BasicBlock *from, BasicBlock *to) {
+    return executable.count(std::make_pair(from->id, to->id)) > 0;
+}
+
+void ConstantPropagator::MarkExecutable(BasicBlock *from, BasicBlock *to) {
+    if (executable.insert(std::make_pair(from->id, to->id)).second)
+        worklist.push_back(to);
+}
+
+bool ConstantPropagator::Lookup(const ConstantMap &values, Location *loc,
+                                int *value) {
+    ConstantMap::const_iterator v = values.find(loc);
+    if (v == values.end()) return false;
+    *value = v->second;
+    return true;
+}
+
+// Finds the value instr stores in its destination, if it is known
+bool ConstantPropagator::Evaluate(Instruction *instr,
+                                  const ConstantMap &values, int *value) {
+    if (LoadConstant *lc = dynamic_cast<LoadConstant*>(instr)) {
+        *value = lc->GetValue();
+        return true;
+    }
+    if (Assign *a = dynamic_cast<Assign*>(instr))
+        return Lookup(values, a->GetSrc(), value);
+    BinaryOp *b = dynamic_cast<BinaryOp*>(instr);
+    int v1, v2 = b ? b->GetImmediate() : 0;
+    if (!b || !Lookup(values, b->GetOp1(), &v1)
+        || (b->GetOp2() && !Lookup(values, b->GetOp2(), &v2)))
+        return false;
+    return BinaryOp::Fold(b->GetOpCode(), v1, v2, value);
+}
+
+// Finds whether the conditional branch instr is taken, if it is known
+bool ConstantPropagator::EvaluateBranch(Instruction *instr,
+                                        const ConstantMap &values,
+                                        bool *taken) {
+    int v1, v2, result;
+    if (IfZ *ifz = dynamic_cast<IfZ*>(instr)) {
+        if (!Lookup(values, ifz->GetTest(), &v1)) return false;
+        *taken = v1 == 0;
+        return true;
+    }
+    IfCmp *ifc = dynamic_cast<IfCmp*>(instr);
+    v2 = ifc ? ifc->GetImmediate() : 0;
+    if (!ifc || !Lookup(values, ifc->GetOp1(), &v1)
+        || (ifc->GetOp2() && !Lookup(values, ifc->GetOp2(), &v2))
+        || !BinaryOp::Fold(ifc->GetOpCode(), v1, v2, &result))
+        return false;
+    *taken = result != 0;
+    return true;
+}
+
+void ConstantPropagator::Transfer(Instruction *instr, ConstantMap &values) {
+    Location *dst = instr->GetDst();
+    int value;
+    if (!FlowGraph::IsTracked(dst)) return;
+    if (Evaluate(instr, values, &value))
+        values[dst] = value;
+    else
+        values.erase(dst);
+}
+
+// The constants at the start of b: those all of its executable
+// predecessors agree on
+void ConstantPropagator::In(BasicBlock *b, ConstantMap &values) {
+    values.clear();
+    bool first = true;
+    for (size_t p = 0; p < b->preds.size(); p++) {
+        BasicBlock *pred = b->preds[p];
+        if (!IsExecutable(pred, b)) continue;
+        if (first) {
+            values = out[pred->id];
+            first = false;
+            continue;
+        }
+        ConstantMap::iterator v = values.begin();
+        while (v != values.end()) {
+            int other;
+            if (Lookup(out[pred->id], v->first, &other)
+                && other == v->second)
+                ++v;
+            else
+                values.erase(v++);
+        }
+    }
+}
+
+void ConstantPropagator::Visit(BasicBlock *b) {
+    ConstantMap values;
+    In(b, values);
+    for (size_t i = 0; i < b->code.size(); i++)
+        Transfer(b->code[i], values);
+    bool changed = !visited[b->id] || values != out[b->id];
+    visited[b->id] = true;
+    out[b->id] = values;
+
+    bool taken;
+    Instruction *last = b->code.back();
+    if (EvaluateBranch(last, values, &taken)) {
+        // the block falling through comes last among the successors
+        BasicBlock *next = b->succs.back();
+        if (taken) {
+            const char *label = dynamic_cast<IfZ*>(last)
+                ? dynamic_cast<IfZ*>(last)->branch_label()
+                : dynamic_cast<IfCmp*>(last)->branch_label();
+            next = graph.GetBlockForLabel(label);
+        }
+        MarkExecutable(b, next);
+        if (changed) worklist.push_back(next);
+        return;
+    }
+    for (size_t s = 0; s < b->succs.size(); s++) {
+        MarkExecutable(b, b->succs[s]);
+        if (changed) worklist.push_back(b->succs[s]);
+    }
+}
+
+void ConstantPropagator::Solve() {
+    worklist.push_back(graph.GetEntry());
+    while (!worklist.empty()) {
+        BasicBlock *b = worklist.back();
+        worklist.pop_back();
+        Visit(b);
+    }
+}
+
+void ConstantPropagator::Rewrite(BasicBlock *b) {
+    ConstantMap values;
+    In(b, values);
+    for (size_t i = 0; i < b->code.size(); i++) {
+        Instruction *instr = b->code[i];
+        BinaryOp *op = dynamic_cast<BinaryOp*>(instr);
+        int value;
+        if ((op || dynamic_cast<Assign*>(instr))
+            && Evaluate(instr, values, &value)) {
+            b->code[i] = new LoadConstant(instr->GetDst(), value);
+            numFolded++;
+        } else if (op && op->GetOp2() && Lookup(values, op->GetOp2(), &value)
+                   && Mips::CanUseImmediate(op->GetOpCode(), value)) {
+            b->code[i] = new BinaryOp(op->GetOpCode(), op->GetDst(),
+                                      op->GetOp1(), value);
+        }
+        if (b->code[i] != instr) delete instr;
+        Transfer(b->code[i], values);
+    }
+
+    bool taken;
+    Instruction *last = b->code.back();
+    if (!EvaluateBranch(last, values, &taken)) return;
+    if (!taken) {
+        b->code.pop_back();
+    } else if (IfZ *ifz = dynamic_cast<IfZ*>(last)) {
+        b->code.back() = new Goto(ifz->branch_label());
+    } else {
+        b->code.back() = new Goto(dynamic_cast<IfCmp*>(last)->branch_label());
+    }
+    delete last;
+    numBranches++;
+}
+
+void ConstantPropagator::Rewrite() {
+    for (int i = 0; i < graph.NumBlocks(); i++) {
+        BasicBlock *b = graph.GetBlock(i);
+        if (!visited[i]) continue;
+        Rewrite(b);
+        std::vector<BasicBlock*> succs = b->succs;
+        for (size_t s = 0; s < succs.size(); s++)
+            if (!IsExecutable(b, succs[s]))
+                graph.RemoveEdge(b, succs[s]);
+    }
+    PrintDebug("sccp", "%s: %d values folded, %d branches resolved",
+               graph.GetName(), numFolded, numBranches);
+}
+
+void PropagateConstants(std::list<Instruction*> &code,
+                        std::list<Instruction*>::iterator begin,
+                        std::list<Instruction*>::iterator end) {
+    FlowGraph graph(begin, end);
+    ConstantPropagator propagator(graph);
+    propagator.Solve();
+    propagator.Rewrite();
+    graph.RemoveUnreachableBlocks();
+    graph.WriteBack(code, begin, end);
+}
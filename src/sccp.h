@@ -0,0 +1,83 @@
+/* File: sccp.h
+ * ------------
+ * Sparse conditional constant propagation (Wegman and Zadeck,
+ * "Constant Propagation with Conditional Branches") on the flow graph
+ * of one function.
+ *
+ * Each variable is either a known constant or unknown. The values are
+ * propagated forward through the blocks, along the edges found to be
+ * executable only: the entry is executable, an unconditional edge out
+ * of an executable block is executable, and a conditional branch whose
+ * test is a known constant makes only the edge it takes executable.
+ * A block is analyzed once one of its incoming edges is executable,
+ * and a variable is known at its start only if it holds the same
+ * constant at the end of each of its executable predecessors, so a
+ * value reaching a loop header along the back edge does not spoil the
+ * constant coming into the loop before the back edge is found
+ * executable. Only the variables tracked by the FlowGraph are known;
+ * they start out unknown at the entry (parameters, and locals that are
+ * not yet assigned).
+ *
+ * The code is then rewritten: an Assign or BinaryOp computing a known
+ * value becomes a LoadConstant, a known second operand of a BinaryOp
+ * becomes an immediate when MIPS has the form, a branch whose test is
+ * known becomes a Goto or disappears, and the blocks no executable edge
+ * reaches are deleted. That includes the runtime error path of a
+ * NewArray whose size is a known positive constant.
+ */
+
+#ifndef _H_sccp
+#define _H_sccp
+
+#include <list>
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+#include "tac.h"
+#include "cfg.h"
+
+typedef std::map<Location*, int> ConstantMap;
+
+class ConstantPropagator
+{
+  private:
+    FlowGraph &graph;
+    std::vector<ConstantMap> out;       // the constants at the end of a block
+    std::vector<bool> visited;
+    std::set<std::pair<int, int> > executable;
+    std::vector<BasicBlock*> worklist;
+    int numFolded, numBranches;
+
+    bool IsExecutable(BasicBlock *from, BasicBlock *to);
+    void MarkExecutable(BasicBlock *from, BasicBlock *to);
+    void In(BasicBlock *b, ConstantMap &values);
+    void Visit(BasicBlock *b);
+    void Rewrite(BasicBlock *b);
+
+    static bool Lookup(const ConstantMap &values, Location *loc, int *value);
+    static bool Evaluate(Instruction *instr, const ConstantMap &values,
+                         int *value);
+    static bool EvaluateBranch(Instruction *instr, const ConstantMap &values,
+                               bool *taken);
+    static void Transfer(Instruction *instr, ConstantMap &values);
+
+  public:
+    ConstantPropagator(FlowGraph &graph);
+
+    // Finds the executable edges and the constants at the end of each
+    // executable block
+    void Solve();
+
+    // Rewrites the code of the graph with the constants found and
+    // removes the edges that are not executable
+    void Rewrite();
+};
+
+// The function pass: propagates the constants of the function
+// [begin, end) and deletes its unreachable blocks
+void PropagateConstants(std::list<Instruction*> &code,
+                        std::list<Instruction*>::iterator begin,
+                        std::list<Instruction*>::iterator end);
+
+#endif
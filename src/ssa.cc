@@ -0,0 +1,301 @@
+/* File: ssa.cc
+ * ------------
+ * Implementation of SSA construction and destruction.
+ */
+
+#include <map>
+#include <set>
+#include <string.h>
+#include <vector>
+#include "ssa.h"
+#include "codegen.h"
+#include "utility.h"
+
+typedef std::map<Location*, std::vector<Location*> > VersionStacks;
+
+// The location each version made by BuildSSA stands for, until LeaveSSA
+static std::map<Location*, Location*> original;
+static std::map<Location*, int> numVersions;
+
+static Location *OriginalOf(Location *loc) {
+    std::map<Location*, Location*>::iterator o = original.find(loc);
+    return o == original.end() ? loc : o->second;
+}
+
+// A new version of loc in the frame of begin
+static Location *NewVersion(BeginFunc *begin, Location *loc) {
+    char *name = new char[strlen(loc->GetName()) + 16];
+    sprintf(name, "%s.%d", loc->GetName(), ++numVersions[loc]);
+    Location *version = CodeGenerator::NewLocalVar(begin, name);
+    delete[] name;
+    original[version] = loc;
+    return version;
+}
+
+// The dominance frontier of each block, by block id: the blocks with
+// several predecessors are in the frontier of each block on the way up
+// the dominator tree from a predecessor to their immediate dominator
+static void ComputeFrontiers(FlowGraph &graph,
+                             std::vector<std::set<int> > &frontier) {
+    frontier.assign(graph.NumBlocks(), std::set<int>());
+    for (int i = 0; i < graph.NumBlocks(); i++) {
+        BasicBlock *b = graph.GetBlock(i);
+        if (b->preds.size() < 2) continue;
+        for (size_t p = 0; p < b->preds.size(); p++)
+            for (BasicBlock *r = b->preds[p]; r != b->idom; r = r->idom)
+                frontier[r->id].insert(b->id);
+    }
+}
+
+// Renames the reads and writes of the locations of stacks in b and in
+// the blocks it dominates, and the sources of the Phis b flows into
+static void Rename(BasicBlock *b, BeginFunc *begin, VersionStacks &stacks) {
+    std::vector<Location*> pushed;
+    for (size_t i = 0; i < b->code.size(); i++) {
+        Instruction *instr = b->code[i];
+        if (!dynamic_cast<Phi*>(instr)) {
+            std::vector<Location*> srcs;
+            instr->GetSrcs(srcs);
+            for (size_t s = 0; s < srcs.size(); s++)
+                if (stacks.count(srcs[s]))
+                    instr->ReplaceSrc(srcs[s], stacks[srcs[s]].back());
+        }
+        Location *dst = instr->GetDst();
+        if (dst && stacks.count(dst)) {
+            Location *version = NewVersion(begin, dst);
+            instr->ReplaceDst(version);
+            stacks[dst].push_back(version);
+            pushed.push_back(dst);
+        }
+    }
+    for (size_t s = 0; s < b->succs.size(); s++) {
+        BasicBlock *succ = b->succs[s];
+        for (size_t i = 0; i < succ->code.size(); i++) {
+            Phi *phi = dynamic_cast<Phi*>(succ->code[i]);
+            if (!phi) continue;
+            Location *loc = OriginalOf(phi->GetDst());
+            for (size_t p = 0; p < succ->preds.size(); p++)
+                if (succ->preds[p] == b)
+                    phi->SetSrc(p, stacks[loc].back());
+        }
+    }
+    for (size_t c = 0; c < b->domChildren.size(); c++)
+        Rename(b->domChildren[c], begin, stacks);
+    for (size_t i = 0; i < pushed.size(); i++)
+        stacks[pushed[i]].pop_back();
+}
+
+int BuildSSA(FlowGraph &graph, BeginFunc *begin) {
+    graph.RemoveUnreachableBlocks();
+    graph.ComputeLiveness();
+
+    // the tracked locations written, in order, and the blocks writing them
+    std::vector<Location*> locs;
+    std::map<Location*, std::vector<int> > written;
+    std::map<Location*, int> numWrites;
+    for (int i = 0; i < graph.NumBlocks(); i++) {
+        BasicBlock *b = graph.GetBlock(i);
+        for (size_t j = 0; j < b->code.size(); j++) {
+            Location *dst = b->code[j]->GetDst();
+            if (!FlowGraph::IsTracked(dst)) continue;
+            if (numWrites[dst]++ == 0) locs.push_back(dst);
+            written[dst].push_back(i);
+        }
+    }
+
+    std::vector<std::set<int> > frontier;
+    ComputeFrontiers(graph, frontier);
+    BasicBlock *entry = graph.GetEntry();
+    VersionStacks stacks;
+    int numPhis = 0;
+    for (size_t l = 0; l < locs.size(); l++) {
+        Location *loc = locs[l];
+        if (numWrites[loc] == 1 && !entry->liveIn.count(loc)) continue;
+        stacks[loc].push_back(loc);
+        std::vector<int> work = written[loc];
+        std::set<int> queued(work.begin(), work.end()), hasPhi;
+        while (!work.empty()) {
+            int b = work.back();
+            work.pop_back();
+            std::set<int>::iterator d;
+            for (d = frontier[b].begin(); d != frontier[b].end(); ++d) {
+                BasicBlock *block = graph.GetBlock(*d);
+                if (hasPhi.count(*d) || !block->liveIn.count(loc)) continue;
+                hasPhi.insert(*d);
+                int at = dynamic_cast<Label*>(block->code[0]) ? 1 : 0;
+                block->code.insert(block->code.begin() + at,
+                                   new Phi(loc, block->preds.size()));
+                numPhis++;
+                if (queued.insert(*d).second) work.push_back(*d);
+            }
+        }
+    }
+    Rename(entry, begin, stacks);
+    return numPhis;
+}
+
+// Inserts instr at the end of b, before the branch ending it (and the
+// EndFunc that may follow, see FlowGraph::RemoveUnreachableBlocks)
+static void InsertAtEnd(BasicBlock *b, Instruction *instr) {
+    std::vector<Instruction*>::iterator at = b->code.end();
+    if (dynamic_cast<EndFunc*>(at[-1])) --at;
+    Instruction *last = at[-1];
+    if (dynamic_cast<Goto*>(last) || dynamic_cast<IfZ*>(last)
+        || dynamic_cast<IfCmp*>(last) || dynamic_cast<JumpTable*>(last))
+        --at;
+    b->code.insert(at, instr);
+}
+
+static Location *Find(std::map<Location*, Location*> &merged,
+                      Location *loc) {
+    std::map<Location*, Location*>::iterator m = merged.find(loc);
+    if (m == merged.end()) return loc;
+    return m->second = Find(merged, m->second);
+}
+
+// Makes the instructions of graph use the location loc is renamed to
+// instead of each loc
+static void RenameAll(FlowGraph &graph,
+                      std::map<Location*, Location*> &to) {
+    for (int i = 0; i < graph.NumBlocks(); i++) {
+        BasicBlock *b = graph.GetBlock(i);
+        for (size_t j = 0; j < b->code.size(); j++) {
+            Instruction *instr = b->code[j];
+            std::vector<Location*> srcs;
+            instr->GetSrcs(srcs);
+            for (size_t s = 0; s < srcs.size(); s++)
+                if (Find(to, srcs[s]) != srcs[s])
+                    instr->ReplaceSrc(srcs[s], Find(to, srcs[s]));
+            Location *dst = instr->GetDst();
+            if (dst && Find(to, dst) != dst)
+                instr->ReplaceDst(Find(to, dst));
+        }
+    }
+}
+
+int LeaveSSA(FlowGraph &graph, BeginFunc *begin) {
+    std::set<Instruction*> inserted;
+    for (int i = 0; i < graph.NumBlocks(); i++) {
+        BasicBlock *b = graph.GetBlock(i);
+        for (size_t j = 0; j < b->code.size(); j++) {
+            Phi *phi = dynamic_cast<Phi*>(b->code[j]);
+            if (!phi) continue;
+            Location *w = NewVersion(begin, OriginalOf(phi->GetDst()));
+            std::set<BasicBlock*> done;
+            for (int p = 0; p < phi->NumSrcs(); p++) {
+                if (!done.insert(b->preds[p]).second) continue;
+                Instruction *copy = new Assign(w, phi->GetSrc(p));
+                InsertAtEnd(b->preds[p], copy);
+                inserted.insert(copy);
+            }
+            b->code[j] = new Assign(phi->GetDst(), w);
+            inserted.insert(b->code[j]);
+            delete phi;
+        }
+    }
+
+    // the interference graph, where a copy does not make its destination
+    // interfere with its source
+    std::map<Location*, std::set<Location*> > interferes;
+    graph.ComputeLiveness();
+    for (int i = 0; i < graph.NumBlocks(); i++) {
+        BasicBlock *b = graph.GetBlock(i);
+        LocationSet live = b->liveOut;
+        for (int j = b->code.size() - 1; j >= 0; j--) {
+            Instruction *instr = b->code[j];
+            Location *dst = instr->GetDst();
+            Assign *copy = dynamic_cast<Assign*>(instr);
+            if (FlowGraph::IsTracked(dst)) {
+                for (LocationSet::iterator l = live.begin(); l != live.end();
+                     ++l)
+                    if (*l != dst && !(copy && *l == copy->GetSrc())) {
+                        interferes[dst].insert(*l);
+                        interferes[*l].insert(dst);
+                    }
+            }
+            FlowGraph::TransferLive(instr, live);
+        }
+    }
+
+    // coalesces the copies inserted, keeping the location that is not a
+    // version when there is one: two such locations, which a pass may
+    // have made the sides of a copy, are different variables
+    std::map<Location*, Location*> merged;
+    for (int i = 0; i < graph.NumBlocks(); i++) {
+        BasicBlock *b = graph.GetBlock(i);
+        for (size_t j = 0; j < b->code.size(); j++) {
+            if (!inserted.count(b->code[j])) continue;
+            Assign *copy = dynamic_cast<Assign*>(b->code[j]);
+            Location *d = Find(merged, copy->GetDst());
+            Location *s = Find(merged, copy->GetSrc());
+            if (d == s || interferes[d].count(s)
+                || (!original.count(d) && !original.count(s)))
+                continue;
+            Location *keep = original.count(s) ? d : s;
+            Location *gone = keep == d ? s : d;
+            merged[gone] = keep;
+            std::set<Location*> &n = interferes[gone];
+            for (std::set<Location*>::iterator l = n.begin(); l != n.end();
+                 ++l) {
+                interferes[*l].erase(gone);
+                interferes[*l].insert(keep);
+                interferes[keep].insert(*l);
+            }
+            interferes.erase(gone);
+        }
+    }
+
+    // renames the locations merged and removes the copies made useless,
+    // then gives each location no longer used to its first version left
+    RenameAll(graph, merged);
+    std::vector<Location*> used;
+    std::set<Location*> seen;
+    for (int i = 0; i < graph.NumBlocks(); i++) {
+        BasicBlock *b = graph.GetBlock(i);
+        for (size_t j = 0; j < b->code.size(); j++) {
+            Assign *copy = dynamic_cast<Assign*>(b->code[j]);
+            if (copy && copy->GetDst() == copy->GetSrc()) {
+                inserted.erase(copy);
+                delete copy;
+                b->code.erase(b->code.begin() + j--);
+                continue;
+            }
+            std::vector<Location*> locs;
+            b->code[j]->GetSrcs(locs);
+            if (b->code[j]->GetDst()) locs.push_back(b->code[j]->GetDst());
+            for (size_t l = 0; l < locs.size(); l++)
+                if (seen.insert(locs[l]).second) used.push_back(locs[l]);
+        }
+    }
+    std::map<Location*, Location*> back;
+    std::set<Location*> given;
+    for (size_t l = 0; l < used.size(); l++) {
+        Location *o = OriginalOf(used[l]);
+        if (o != used[l] && !seen.count(o) && given.insert(o).second)
+            back[used[l]] = o;
+    }
+    RenameAll(graph, back);
+    original.clear();
+    return inserted.size();
+}
+
+void RenameWebs(std::list<Instruction*> &code,
+                std::list<Instruction*>::iterator begin,
+                std::list<Instruction*>::iterator end) {
+    std::list<Instruction*>::iterator p = begin;
+    BeginFunc *beginFunc = dynamic_cast<BeginFunc*>(*++p);
+    FlowGraph graph(begin, end);
+    int numPhis = BuildSSA(graph, beginFunc);
+    int numVersions = original.size();
+    if (numVersions && IsDebugOn("ssa")) {
+        printf("+++ (ssa): %s in SSA form\n", graph.GetName());
+        for (int i = 0; i < graph.NumBlocks(); i++)
+            for (size_t j = 0; j < graph.GetBlock(i)->code.size(); j++)
+                graph.GetBlock(i)->code[j]->Print();
+    }
+    int numCopies = LeaveSSA(graph, beginFunc);
+    graph.WriteBack(code, begin, end);
+    if (numVersions)
+        PrintDebug("ssa", "%s: %d versions, %d phis, %d copies left",
+                   graph.GetName(), numVersions, numPhis, numCopies);
+}
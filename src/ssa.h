@@ -0,0 +1,67 @@
+/* File: ssa.h
+ * -----------
+ * Static single assignment form for the flow graph of one function.
+ *
+ * BuildSSA renames the tracked locations (see FlowGraph::IsTracked)
+ * that are written more than once, or written and also read before
+ * any write, so that each of their versions is written exactly once,
+ * as in Cytron et al. ("Efficiently Computing Static Single Assignment
+ * Form and the Control Dependence Graph"). The dominance frontiers come
+ * from the immediate dominators, by the method of Cooper, Harvey and
+ * Kennedy. A Phi is placed at the iterated dominance frontier of the
+ * blocks writing a location, in the blocks where it is live (pruned
+ * SSA), and the dominator tree is walked keeping the current version of
+ * each location to rename the reads, the writes and the sources of the
+ * Phis of the successors. A version is a new local or temp of the frame
+ * named after its location (x.1, _tmp4.2, ...). The value a location
+ * has on entry, that of a param or an unset local, stays the location
+ * itself. The other locations are already in SSA form: a temp written
+ * once is written before all of its reads.
+ *
+ * LeaveSSA replaces the Phis with copies: each source is copied into a
+ * new location at the end of its predecessor, before its branch, and
+ * the Phi becomes a copy of that location. As the new location is only
+ * live between those copies, this is correct whatever the passes did to
+ * the code in SSA form, without splitting edges. The copies are then
+ * coalesced: the interference graph is built from the liveness (the
+ * destination of a copy does not interfere with its source), and the
+ * two sides of each copy inserted are merged when they do not
+ * interfere, taking the union of their neighbors, unless neither is a
+ * version (a pass in SSA form may have made a copy of one location of
+ * the program into another, such as a param). The versions of a
+ * location still apart are its webs, the parts of its live range not
+ * connected by a Phi: one of them gets the location back when it is
+ * no longer used, the others keep their names.
+ *
+ * RenameWebs, the pass, only goes into SSA form and out of it: a local
+ * reused for unrelated values, such as the counters of two loops,
+ * becomes one location per web, each allocated a register (or a stack
+ * slot) of its own. The passes working on SSA form run between
+ * BuildSSA and LeaveSSA. The debug key "ssa" prints each
+ * function in SSA form and reports the locations renamed, the Phis
+ * placed and the copies left.
+ */
+
+#ifndef _H_ssa
+#define _H_ssa
+
+#include <list>
+#include "tac.h"
+#include "cfg.h"
+
+// Puts the function of graph into SSA form, removing its unreachable
+// blocks first. The versions are allocated in the frame of begin.
+// Returns the number of Phis placed.
+int BuildSSA(FlowGraph &graph, BeginFunc *begin);
+
+// Takes the function of graph out of SSA form. Returns the number of
+// copies left.
+int LeaveSSA(FlowGraph &graph, BeginFunc *begin);
+
+// The function pass: splits the locals and temps of the function
+// [begin, end) into their webs
+void RenameWebs(std::list<Instruction*> &code,
+                std::list<Instruction*>::iterator begin,
+                std::list<Instruction*>::iterator end);
+
+#endif
@@ -0,0 +1,79 @@
+/* File: stackslots.cc
+ * -------------------
+ * Implementation of stack slot allocation.
+ */
+
+#include <map>
+#include <set>
+#include <vector>
+#include "stackslots.h"
+#include "cfg.h"
+#include "codegen.h"
+#include "utility.h"
+
+// Whether loc is a local or temp of the frame
+static bool InFrame(Location *loc) {
+    return FlowGraph::IsTracked(loc)
+        && loc->GetOffset() <= CodeGenerator::OffsetToFirstLocal;
+}
+
+void AssignStackSlots(std::list<Instruction*> &code,
+                      std::list<Instruction*>::iterator begin,
+                      std::list<Instruction*>::iterator end) {
+    std::list<Instruction*>::iterator p = begin;
+    BeginFunc *beginFunc = dynamic_cast<BeginFunc*>(*++p);
+    std::vector<Location*> locs;
+    std::map<Location*, int> index;
+    for (; p != end; ++p) {
+        std::vector<Location*> used;
+        if ((*p)->GetDst()) used.push_back((*p)->GetDst());
+        (*p)->GetSrcs(used);
+        for (size_t i = 0; i < used.size(); i++)
+            if (InFrame(used[i]) && !index.count(used[i])) {
+                index[used[i]] = locs.size();
+                locs.push_back(used[i]);
+            }
+    }
+
+    std::vector<std::set<int> > interferes(locs.size());
+    FlowGraph graph(begin, end);
+    graph.ComputeLiveness();
+    for (int i = 0; i < graph.NumBlocks(); i++) {
+        BasicBlock *b = graph.GetBlock(i);
+        LocationSet live = b->liveOut;
+        for (int j = b->code.size() - 1; j >= 0; j--) {
+            Location *dst = b->code[j]->GetDst();
+            if (InFrame(dst)) {
+                int d = index[dst];
+                for (LocationSet::iterator l = live.begin(); l != live.end();
+                     ++l)
+                    if (*l != dst && InFrame(*l)) {
+                        interferes[d].insert(index[*l]);
+                        interferes[index[*l]].insert(d);
+                    }
+            }
+            FlowGraph::TransferLive(b->code[j], live);
+        }
+    }
+
+    std::vector<int> slot(locs.size());
+    int numSlots = 0;
+    for (size_t i = 0; i < locs.size(); i++) {
+        std::set<int> taken;
+        for (std::set<int>::iterator n = interferes[i].begin();
+             n != interferes[i].end() && *n < (int)i; ++n)
+            taken.insert(slot[*n]);
+        slot[i] = 0;
+        while (taken.count(slot[i]))
+            slot[i]++;
+        if (slot[i] == numSlots) numSlots++;
+        locs[i]->SetOffset(CodeGenerator::OffsetToFirstLocal
+                           - slot[i] * CodeGenerator::VarSize);
+    }
+
+    int frameSize = numSlots * CodeGenerator::VarSize;
+    PrintDebug("stackslots", "%s: %d locals and temps in %d slots, frame "
+               "%d -> %d bytes", graph.GetName(), (int)locs.size(), numSlots,
+               beginFunc->GetFrameSize(), frameSize);
+    beginFunc->SetFrameSize(frameSize);
+}
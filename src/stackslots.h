@@ -0,0 +1,43 @@
+/* File: stackslots.h
+ * ------------------
+ * Stack slot allocation: the locals and temps of one function share
+ * the slots of its frame when their lifetimes do not overlap.
+ *
+ * The code generator gives each local and temp a slot of its own as it
+ * is created (see CodeGenerator::GenTempVar), so the frame of a function
+ * grows with every expression in it, although most temps only live
+ * from one instruction to the next. After the other passes, when the
+ * temps folded into trees by instruction selection are gone, the
+ * liveness of the flow graph gives the interference graph of the
+ * fp-relative locations at negative offsets: a location written by an
+ * instruction interferes with those live after it, whether or not the
+ * value written is read. The graph is colored greedily, in the order
+ * the locations are first written or read, each taking the lowest slot
+ * none of its neighbors holds, and the locations are moved to their
+ * slots. A local never written nor read takes no slot. BeginFunc gets
+ * the size of the frame left.
+ *
+ * Two locations sharing a slot are never live at the same time, so the
+ * register allocation done later can still use the slots: a location
+ * kept in a $t register is saved to its slot only across a call it is
+ * live across. At -O1, the values written in a block stay in registers
+ * until it ends, so writing a location drops the value still unwritten
+ * of another location of its slot, which is dead by then (see
+ * Mips::GetRegister). The locations of a function are only used by that
+ * function, so they are moved in place. The params keep their offsets,
+ * which are set by the calling convention.
+ */
+
+#ifndef _H_stackslots
+#define _H_stackslots
+
+#include <list>
+#include "tac.h"
+
+// The function pass: packs the locals and temps of the function
+// [begin, end) into the fewest stack slots
+void AssignStackSlots(std::list<Instruction*> &code,
+                      std::list<Instruction*>::iterator begin,
+                      std::list<Instruction*>::iterator end);
+
+#endif
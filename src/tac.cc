@@ -13,6 +13,10 @@ Location::Location(Segment s, int o, const char *name) :
 Location::Location(Segment s, int o, const char *name, Location *b) :
     variableName(strdup(name)), segment(s), offset(o), base(b) {}
 
+bool Location::IsTemp() const {
+    return strncmp(variableName, "_tmp", 4) == 0;
+}
+
 void Location::Print() {
     const char *s = (segment == fpRelative) ? "FP" : "GP";
     const char *b = (base == NULL) ? "NIL" : base->GetName();
@@ -33,9 +37,18 @@ void Instruction::Emit(Mips *mips) {
 LoadConstant::LoadConstant(Location *d, int v)
   : dst(d), val(v) {
     Assert(dst != NULL);
+    Reprint();
+}
+
+void LoadConstant::Reprint() {
     sprintf(printed, "%s = %d", dst->GetName(), val);
 }
 
+void LoadConstant::ReplaceDst(Location *to) {
+    dst = to;
+    Reprint();
+}
+
 void LoadConstant::EmitSpecific(Mips *mips) {
     mips->EmitLoadConstant(dst, val);
 }
@@ -46,10 +59,19 @@ LoadStringConstant::LoadStringConstant(Location *d, const char *s)
     const char *quote = (*s == '"') ? "" : "\"";
     str = new char[strlen(s) + 2*strlen(quote) + 1];
     sprintf(str, "%s%s%s", quote, s, quote);
-    quote = (strlen(str) > 50) ? "...\"" : "";
+    Reprint();
+}
+
+void LoadStringConstant::Reprint() {
+    const char *quote = (strlen(str) > 50) ? "...\"" : "";
     sprintf(printed, "%s = %.50s%s", dst->GetName(), str, quote);
 }
 
+void LoadStringConstant::ReplaceDst(Location *to) {
+    dst = to;
+    Reprint();
+}
+
 void LoadStringConstant::EmitSpecific(Mips *mips) {
     mips->EmitLoadStringConstant(dst, str);
 }
@@ -57,9 +79,18 @@ void LoadStringConstant::EmitSpecific(Mips *mips) {
 LoadLabel::LoadLabel(Location *d, const char *l)
   : dst(d), label(strdup(l)) {
     Assert(dst != NULL && label != NULL);
+    Reprint();
+}
+
+void LoadLabel::Reprint() {
     sprintf(printed, "%s = %s", dst->GetName(), label);
 }
 
+void LoadLabel::ReplaceDst(Location *to) {
+    dst = to;
+    Reprint();
+}
+
 void LoadLabel::EmitSpecific(Mips *mips) {
     mips->EmitLoadLabel(dst, label);
 }
@@ -68,9 +99,23 @@ void LoadLabel::EmitSpecific(Mips *mips) {
 Assign::Assign(Location *d, Location *s)
   : dst(d), src(s) {
     Assert(dst != NULL && src != NULL);
+    Reprint();
+}
+
+void Assign::Reprint() {
     sprintf(printed, "%s = %s", dst->GetName(), src->GetName());
 }
 
+void Assign::ReplaceSrc(Location *from, Location *to) {
+    if (src == from) src = to;
+    Reprint();
+}
+
+void Assign::ReplaceDst(Location *to) {
+    dst = to;
+    Reprint();
+}
+
 void Assign::EmitSpecific(Mips *mips) {
     mips->EmitCopy(dst, src);
 }
@@ -78,6 +123,10 @@ void Assign::EmitSpecific(Mips *mips) {
 Load::Load(Location *d, Location *s, int off)
   : dst(d), src(s), offset(off) {
     Assert(dst != NULL && src != NULL);
+    Reprint();
+}
+
+void Load::Reprint() {
     if (offset)
         sprintf(printed, "%s = *(%s + %d)", dst->GetName(), src->GetName(),
                 offset);
@@ -85,6 +134,16 @@ Load::Load(Location *d, Location *s, int off)
         sprintf(printed, "%s = *(%s)", dst->GetName(), src->GetName());
 }
 
+void Load::ReplaceSrc(Location *from, Location *to) {
+    if (src == from) src = to;
+    Reprint();
+}
+
+void Load::ReplaceDst(Location *to) {
+    dst = to;
+    Reprint();
+}
+
 void Load::EmitSpecific(Mips *mips) {
     mips->EmitLoad(dst, src, offset);
 }
@@ -92,6 +151,10 @@ void Load::EmitSpecific(Mips *mips) {
 Store::Store(Location *d, Location *s, int off)
   : dst(d), src(s), offset(off) {
     Assert(dst != NULL && src != NULL);
+    Reprint();
+}
+
+void Store::Reprint() {
     if (offset)
         sprintf(printed, "*(%s + %d) = %s", dst->GetName(), offset,
                 src->GetName());
@@ -99,6 +162,12 @@ Store::Store(Location *d, Location *s, int off)
         sprintf(printed, "*(%s) = %s", dst->GetName(), src->GetName());
 }
 
+void Store::ReplaceSrc(Location *from, Location *to) {
+    if (dst == from) dst = to;
+    if (src == from) src = to;
+    Reprint();
+}
+
 void Store::EmitSpecific(Mips *mips) {
     mips->EmitStore(dst, src, offset);
 }
@@ -117,16 +186,67 @@ BinaryOp::OpCode BinaryOp::OpCodeForName(const char *name) {
     return Add; // can't get here, but compiler doesn't know that
 }
 
+bool BinaryOp::Fold(OpCode code, int a, int b, int *result) {
+    unsigned ua = a, ub = b;
+    switch (code) {
+      case Add: *result = ua + ub; return true;
+      case Sub: *result = ua - ub; return true;
+      case Mul: *result = ua * ub; return true;
+      case Div: case Mod:
+        if (b == 0 || b == -1) return false;
+        *result = code == Div ? a / b : a % b;
+        return true;
+      case Eq: *result = a == b; return true;
+      case Ne: *result = a != b; return true;
+      case Lt: *result = a < b; return true;
+      case Le: *result = a <= b; return true;
+      case Gt: *result = a > b; return true;
+      case Ge: *result = a >= b; return true;
+      case And: *result = a & b; return true;
+      case Or: *result = a | b; return true;
+      default: return false;
+    }
+}
+
 BinaryOp::BinaryOp(OpCode c, Location *d, Location *o1, Location *o2)
-  : code(c), dst(d), op1(o1), op2(o2) {
+  : code(c), dst(d), op1(o1), op2(o2), imm(0) {
     Assert(dst != NULL && op1 != NULL && op2 != NULL);
     Assert(code >= 0 && code < NumOps);
-    sprintf(printed, "%s = %s %s %s", dst->GetName(), op1->GetName(),
-            opName[code], op2->GetName());
+    Reprint();
+}
+
+BinaryOp::BinaryOp(OpCode c, Location *d, Location *o1, int i)
+  : code(c), dst(d), op1(o1), op2(NULL), imm(i) {
+    Assert(dst != NULL && op1 != NULL);
+    Assert(code >= 0 && code < NumOps);
+    Reprint();
+}
+
+void BinaryOp::Reprint() {
+    if (op2)
+        sprintf(printed, "%s = %s %s %s", dst->GetName(), op1->GetName(),
+                opName[code], op2->GetName());
+    else
+        sprintf(printed, "%s = %s %s %d", dst->GetName(), op1->GetName(),
+                opName[code], imm);
+}
+
+void BinaryOp::ReplaceSrc(Location *from, Location *to) {
+    if (op1 == from) op1 = to;
+    if (op2 == from) op2 = to;
+    Reprint();
+}
+
+void BinaryOp::ReplaceDst(Location *to) {
+    dst = to;
+    Reprint();
 }
 
 void BinaryOp::EmitSpecific(Mips *mips) {
-    mips->EmitBinaryOp(code, dst, op1, op2);
+    if (op2)
+        mips->EmitBinaryOp(code, dst, op1, op2);
+    else
+        mips->EmitBinaryOp(code, dst, op1, imm);
 }
 
 Label::Label(const char *l) : label(strdup(l)) {
@@ -154,16 +274,88 @@ void Goto::EmitSpecific(Mips *mips) {
 IfZ::IfZ(Location *te, const char *l)
   : test(te), label(strdup(l)) {
     Assert(test != NULL && label != NULL);
+    Reprint();
+}
+
+void IfZ::Reprint() {
     sprintf(printed, "IfZ %s Goto %s", test->GetName(), label);
 }
 
+void IfZ::ReplaceSrc(Location *from, Location *to) {
+    if (test == from) test = to;
+    Reprint();
+}
+
 void IfZ::EmitSpecific(Mips *mips) {
     mips->EmitIfZ(test, label);
 }
 
+IfCmp::IfCmp(BinaryOp::OpCode c, Location *o1, Location *o2, int i,
+             const char *l)
+  : code(c), op1(o1), op2(o2), imm(i), label(strdup(l)) {
+    Assert(op1 != NULL && label != NULL);
+    Assert(code >= BinaryOp::Eq && code <= BinaryOp::Ge);
+    Reprint();
+}
+
+void IfCmp::Reprint() {
+    if (op2)
+        sprintf(printed, "If %s %s %s Goto %s", op1->GetName(),
+                BinaryOp::opName[code], op2->GetName(), label);
+    else
+        sprintf(printed, "If %s %s %d Goto %s", op1->GetName(),
+                BinaryOp::opName[code], imm, label);
+}
+
+void IfCmp::ReplaceSrc(Location *from, Location *to) {
+    if (op1 == from) op1 = to;
+    if (op2 == from) op2 = to;
+    Reprint();
+}
+
+void IfCmp::EmitSpecific(Mips *mips) {
+    mips->EmitIfCmp(code, op1, op2, imm, label);
+}
+
+JumpTable::JumpTable(Location *i, int f, List<const char*> *l)
+  : index(i), first(f), labels(l) {
+    Assert(index != NULL && labels != NULL && labels->NumElements() > 0);
+    Reprint();
+}
+
+void JumpTable::Reprint() {
+    sprintf(printed, "Goto table[%s - %d] of %d labels", index->GetName(),
+            first, labels->NumElements());
+}
+
+void JumpTable::Print() {
+    printf("\tJumpTable %s - %d =\n", index->GetName(), first);
+    for (int i = 0; i < labels->NumElements(); i++)
+        printf("\t\t%s,\n", labels->Nth(i));
+    printf("\t;\n");
+}
+
+void JumpTable::ReplaceSrc(Location *from, Location *to) {
+    if (index == from) index = to;
+    Reprint();
+}
+
+void JumpTable::ReplaceLabel(const char *from, const char *to) {
+    for (int i = 0; i < labels->NumElements(); i++)
+        if (!strcmp(labels->Nth(i), from)) {
+            labels->RemoveAt(i);
+            labels->InsertAt(strdup(to), i);
+        }
+}
+
+void JumpTable::EmitSpecific(Mips *mips) {
+    mips->EmitJumpTable(index, first, labels);
+}
+
 BeginFunc::BeginFunc() {
     sprintf(printed,"BeginFunc (unassigned)");
     frameSize = -555; // used as sentinel to recognized unassigned value
+    params = new List<Location*>;
 }
 
 void BeginFunc::SetFrameSize(int numBytesForAllLocalsAndTemps) {
@@ -171,8 +363,13 @@ void BeginFunc::SetFrameSize(int numBytesForAllLocalsAndTemps) {
     sprintf(printed,"BeginFunc %d", frameSize);
 }
 
+void BeginFunc::SetParams(List<Location*> *p) {
+    Assert(p != NULL);
+    params = p;
+}
+
 void BeginFunc::EmitSpecific(Mips *mips) {
-    mips->EmitBeginFunction(frameSize);
+    mips->EmitBeginFunction(frameSize, params);
 }
 
 EndFunc::EndFunc() : Instruction() {
@@ -184,21 +381,39 @@ void EndFunc::EmitSpecific(Mips *mips) {
 }
 
 Return::Return(Location *v) : val(v) {
+    Reprint();
+}
+
+void Return::Reprint() {
     sprintf(printed, "Return %s", val? val->GetName() : "");
 }
 
+void Return::ReplaceSrc(Location *from, Location *to) {
+    if (val == from) val = to;
+    Reprint();
+}
+
 void Return::EmitSpecific(Mips *mips) {
     mips->EmitReturn(val);
 }
 
 PushParam::PushParam(Location *p)
-  : param(p) {
+  : param(p), argIndex(-1), numArgs(-1) {
     Assert(param != NULL);
+    Reprint();
+}
+
+void PushParam::Reprint() {
     sprintf(printed, "PushParam %s", param->GetName());
 }
 
+void PushParam::ReplaceSrc(Location *from, Location *to) {
+    if (param == from) param = to;
+    Reprint();
+}
+
 void PushParam::EmitSpecific(Mips *mips) {
-    mips->EmitParam(param);
+    mips->EmitParam(param, argIndex, numArgs);
 }
 
 PopParams::PopParams(int nb)
@@ -212,10 +427,19 @@ void PopParams::EmitSpecific(Mips *mips) {
 
 LCall::LCall(const char *l, Location *d)
   : label(strdup(l)), dst(d) {
+    Reprint();
+}
+
+void LCall::Reprint() {
     sprintf(printed, "%s%sLCall %s", dst? dst->GetName(): "", dst?" = ":"",
             label);
 }
 
+void LCall::ReplaceDst(Location *to) {
+    dst = to;
+    Reprint();
+}
+
 void LCall::EmitSpecific(Mips *mips) {
     mips->EmitLCall(dst, label);
 }
@@ -223,13 +447,82 @@ void LCall::EmitSpecific(Mips *mips) {
 ACall::ACall(Location *ma, Location *d)
   : dst(d), methodAddr(ma) {
     Assert(methodAddr != NULL);
+    Reprint();
+}
+
+void ACall::Reprint() {
     sprintf(printed, "%s%sACall %s", dst? dst->GetName(): "", dst?" = ":"",
             methodAddr->GetName());
 }
+
+void ACall::ReplaceSrc(Location *from, Location *to) {
+    if (methodAddr == from) methodAddr = to;
+    Reprint();
+}
+
+void ACall::ReplaceDst(Location *to) {
+    dst = to;
+    Reprint();
+}
 void ACall::EmitSpecific(Mips *mips) {
     mips->EmitACall(dst, methodAddr);
 }
 
+TailCall::TailCall(const char *l, Location *ma, int n)
+  : label(l ? strdup(l) : NULL), methodAddr(ma), numArgs(n) {
+    Assert((label != NULL) != (methodAddr != NULL));
+    Reprint();
+}
+
+void TailCall::Reprint() {
+    sprintf(printed, "TailCall %s", label ? label : methodAddr->GetName());
+}
+
+void TailCall::ReplaceSrc(Location *from, Location *to) {
+    if (methodAddr == from) methodAddr = to;
+    Reprint();
+}
+
+void TailCall::EmitSpecific(Mips *mips) {
+    mips->EmitTailCall(label, methodAddr, numArgs);
+}
+
+Phi::Phi(Location *d, int numPreds)
+  : dst(d), srcs(numPreds, d) {
+    Assert(dst != NULL && numPreds > 0);
+    Reprint();
+}
+
+// The sources are printed as long as they fit
+void Phi::Reprint() {
+    int n = snprintf(printed, sizeof(printed), "%s = phi(", dst->GetName());
+    for (size_t i = 0; i < srcs.size() && n < (int)sizeof(printed); i++)
+        n += snprintf(printed + n, sizeof(printed) - n, "%s%s",
+                      i ? ", " : "", srcs[i]->GetName());
+    if (n < (int)sizeof(printed))
+        snprintf(printed + n, sizeof(printed) - n, ")");
+}
+
+void Phi::SetSrc(int i, Location *src) {
+    srcs[i] = src;
+    Reprint();
+}
+
+void Phi::ReplaceSrc(Location *from, Location *to) {
+    for (size_t i = 0; i < srcs.size(); i++)
+        if (srcs[i] == from) srcs[i] = to;
+    Reprint();
+}
+
+void Phi::ReplaceDst(Location *to) {
+    dst = to;
+    Reprint();
+}
+
+void Phi::EmitSpecific(Mips *mips) {
+    Failure("Phi for %s left in the code", dst->GetName());
+}
+
 VTable::VTable(const char *l, List<const char *> *m)
   : methodLabels(m), label(strdup(l)) {
     Assert(methodLabels != NULL && label != NULL);
@@ -23,6 +23,7 @@
 #ifndef _H_tac
 #define _H_tac
 
+#include <vector>
 #include "list.h" // for VTable
 
 class Mips;
@@ -54,20 +55,40 @@ class Location
     int GetOffset() const           { return offset; }
     Location* GetBase() const       { return base; }
 
+    // Moves a local or temp to another slot of its frame (see
+    // stackslots.h)
+    void SetOffset(int o)           { offset = o; }
+
+    // Temps are defined before all of their uses, so a temp with only
+    // one definition holds the same value at each use
+    bool IsTemp() const;
+
     void Print();
 };
 
 // base class from which all Tac instructions derived
 // has the interface for the 2 polymorphic messages: Print & Emit
+//
+// The dataflow interface (GetDst and GetSrcs) is used by the analyses
+// of the back end: GetDst returns the Location written by the
+// instruction (NULL if none) and GetSrcs appends the Locations read.
+// ReplaceSrc makes the instruction read to wherever it read from, and
+// ReplaceDst makes an instruction with a destination write to instead.
 
 class Instruction {
   protected:
     char printed[128];
 
   public:
+    virtual ~Instruction() {}
     virtual void Print();
     virtual void EmitSpecific(Mips *mips) = 0;
     void Emit(Mips *mips);
+
+    virtual Location *GetDst() { return NULL; }
+    virtual void GetSrcs(std::vector<Location*> &srcs) {}
+    virtual void ReplaceSrc(Location *from, Location *to) {}
+    virtual void ReplaceDst(Location *to) {}
 };
 
 // for convenience, the instruction classes are listed here.
@@ -83,6 +104,8 @@ class BinaryOp;
 class Label;
 class Goto;
 class IfZ;
+class IfCmp;
+class JumpTable;
 class BeginFunc;
 class EndFunc;
 class Return;
@@ -90,59 +113,92 @@ class PushParam;
 class PopParams;
 class LCall;
 class ACall;
+class TailCall;
+class Phi;
 class VTable;
 
 class LoadConstant: public Instruction
 {
     Location *dst;
     int val;
+    void Reprint();
   public:
     LoadConstant(Location *dst, int val);
     void EmitSpecific(Mips *mips);
+    Location *GetDst() { return dst; }
+    int GetValue() { return val; }
+    void ReplaceDst(Location *to);
 };
 
 class LoadStringConstant: public Instruction
 {
     Location *dst;
     char *str;
+    void Reprint();
   public:
     LoadStringConstant(Location *dst, const char *s);
     void EmitSpecific(Mips *mips);
+    Location *GetDst() { return dst; }
+    void ReplaceDst(Location *to);
 };
 
 class LoadLabel: public Instruction
 {
     Location *dst;
     const char *label;
+    void Reprint();
   public:
     LoadLabel(Location *dst, const char *label);
     void EmitSpecific(Mips *mips);
+    Location *GetDst() { return dst; }
+    const char *GetLabel() const { return label; }
+    void ReplaceDst(Location *to);
 };
 
 class Assign: public Instruction
 {
     Location *dst, *src;
+    void Reprint();
   public:
     Assign(Location *dst, Location *src);
     void EmitSpecific(Mips *mips);
+    Location *GetDst() { return dst; }
+    Location *GetSrc() { return src; }
+    void GetSrcs(std::vector<Location*> &srcs) { srcs.push_back(src); }
+    void ReplaceSrc(Location *from, Location *to);
+    void ReplaceDst(Location *to);
 };
 
 class Load: public Instruction
 {
     Location *dst, *src;
     int offset;
+    void Reprint();
   public:
     Load(Location *dst, Location *src, int offset = 0);
     void EmitSpecific(Mips *mips);
+    Location *GetDst() { return dst; }
+    void GetSrcs(std::vector<Location*> &srcs) { srcs.push_back(src); }
+    Location *GetReference() { return src; }
+    int GetOffset() { return offset; }
+    void ReplaceSrc(Location *from, Location *to);
+    void ReplaceDst(Location *to);
 };
 
 class Store: public Instruction
 {
     Location *dst, *src;
     int offset;
+    void Reprint();
   public:
     Store(Location *d, Location *s, int offset = 0);
     void EmitSpecific(Mips *mips);
+    void GetSrcs(std::vector<Location*> &srcs)
+        { srcs.push_back(dst); srcs.push_back(src); }
+    Location *GetReference() { return dst; }
+    Location *GetValue() { return src; }
+    int GetOffset() { return offset; }
+    void ReplaceSrc(Location *from, Location *to);
 };
 
 class BinaryOp: public Instruction
@@ -157,12 +213,28 @@ class BinaryOp: public Instruction
     static const char * const opName[NumOps];
     static OpCode OpCodeForName(const char *name);
 
+    // Computes code on two constants as the MIPS instruction would,
+    // except for a division that would trap
+    static bool Fold(OpCode code, int a, int b, int *result);
+
   protected:
     OpCode code;
     Location *dst, *op1, *op2;
+    int imm;                    // the second operand when op2 is NULL
+    void Reprint();
   public:
     BinaryOp(OpCode c, Location *dst, Location *op1, Location *op2);
+    BinaryOp(OpCode c, Location *dst, Location *op1, int imm);
     void EmitSpecific(Mips *mips);
+    Location *GetDst() { return dst; }
+    void GetSrcs(std::vector<Location*> &srcs)
+        { srcs.push_back(op1); if (op2) srcs.push_back(op2); }
+    OpCode GetOpCode() { return code; }
+    Location *GetOp1() { return op1; }
+    Location *GetOp2() { return op2; }
+    int GetImmediate() { return imm; }
+    void ReplaceSrc(Location *from, Location *to);
+    void ReplaceDst(Location *to);
 };
 
 class Label: public Instruction
@@ -188,19 +260,72 @@ class IfZ: public Instruction
 {
     Location *test;
     const char *label;
+    void Reprint();
   public:
     IfZ(Location *test, const char *label);
     void EmitSpecific(Mips *mips);
+    void GetSrcs(std::vector<Location*> &srcs) { srcs.push_back(test); }
+    Location *GetTest() { return test; }
     const char* branch_label() const { return label; }
+    void ReplaceSrc(Location *from, Location *to);
+};
+
+// Branches if op1 compares to op2 (or to imm when op2 is NULL) by the
+// relational operator code. Made from a comparison feeding an IfZ.
+class IfCmp: public Instruction
+{
+    BinaryOp::OpCode code;
+    Location *op1, *op2;
+    int imm;
+    const char *label;
+    void Reprint();
+  public:
+    IfCmp(BinaryOp::OpCode c, Location *op1, Location *op2, int imm,
+          const char *label);
+    void EmitSpecific(Mips *mips);
+    void GetSrcs(std::vector<Location*> &srcs)
+        { srcs.push_back(op1); if (op2) srcs.push_back(op2); }
+    const char* branch_label() const { return label; }
+    BinaryOp::OpCode GetOpCode() { return code; }
+    Location *GetOp1() { return op1; }
+    Location *GetOp2() { return op2; }
+    int GetImmediate() { return imm; }
+    void ReplaceSrc(Location *from, Location *to);
+};
+
+// Branches to the label at entry index - first of a table of labels.
+// The index must be in range: CodeGenerator::GenSwitch checks it first.
+class JumpTable: public Instruction
+{
+    Location *index;
+    int first;
+    List<const char*> *labels;
+    void Reprint();
+  public:
+    JumpTable(Location *index, int first, List<const char*> *labels);
+    void Print();
+    void EmitSpecific(Mips *mips);
+    void GetSrcs(std::vector<Location*> &srcs) { srcs.push_back(index); }
+    Location *GetIndex() { return index; }
+    int GetFirst() { return first; }
+    List<const char*> *GetLabels() { return labels; }
+    void ReplaceSrc(Location *from, Location *to);
+    // Makes the entries branching to from branch to to instead
+    void ReplaceLabel(const char *from, const char *to);
 };
 
 class BeginFunc: public Instruction
 {
     int frameSize;
+    List<Location*> *params;
   public:
     BeginFunc();
     // used to backpatch the instruction with frame size once known
     void SetFrameSize(int numBytesForAllLocalsAndTemps);
+    int GetFrameSize() const { return frameSize; }
+    // the Locations of the params, including "this" for methods
+    void SetParams(List<Location*> *params);
+    List<Location*> *GetParams() const { return params; }
     void EmitSpecific(Mips *mips);
 };
 
@@ -214,17 +339,28 @@ class EndFunc: public Instruction
 class Return: public Instruction
 {
     Location *val;
+    void Reprint();
   public:
     Return(Location *val);
     void EmitSpecific(Mips *mips);
+    void GetSrcs(std::vector<Location*> &srcs)
+        { if (val) srcs.push_back(val); }
+    void ReplaceSrc(Location *from, Location *to);
 };
 
 class PushParam: public Instruction
 {
     Location *param;
+    int argIndex, numArgs;
+    void Reprint();
   public:
     PushParam(Location *param);
+    // used to record the position of the param among the numArgs params
+    // of the call, 0 being the first argument (pushed last)
+    void SetPosition(int index, int num) { argIndex = index; numArgs = num; }
     void EmitSpecific(Mips *mips);
+    void GetSrcs(std::vector<Location*> &srcs) { srcs.push_back(param); }
+    void ReplaceSrc(Location *from, Location *to);
 };
 
 class PopParams: public Instruction
@@ -233,23 +369,74 @@ class PopParams: public Instruction
   public:
     PopParams(int numBytesOfParamsToRemove);
     void EmitSpecific(Mips *mips);
+    int GetNumBytes() const { return numBytes; }
 };
 
 class LCall: public Instruction
 {
     const char *label;
     Location *dst;
+    void Reprint();
   public:
     LCall(const char *labe, Location *result);
     void EmitSpecific(Mips *mips);
+    Location *GetDst() { return dst; }
+    const char *GetLabel() const { return label; }
+    void ReplaceDst(Location *to);
 };
 
 class ACall: public Instruction
 {
     Location *dst, *methodAddr;
+    void Reprint();
   public:
     ACall(Location *meth, Location *result);
     void EmitSpecific(Mips *mips);
+    Location *GetDst() { return dst; }
+    void GetSrcs(std::vector<Location*> &srcs) { srcs.push_back(methodAddr); }
+    void ReplaceSrc(Location *from, Location *to);
+    void ReplaceDst(Location *to);
+};
+
+// A call in tail position, made with the stack frame of the function:
+// the numArgs arguments pushed replace its own params, then it leaves
+// its frame and jumps to the callee, which returns straight to its
+// caller. Made from an LCall of label (or an ACall of methodAddr) and
+// its PopParams followed by a Return of its result (see tailcall.h).
+class TailCall: public Instruction
+{
+    const char *label;
+    Location *methodAddr;
+    int numArgs;
+    void Reprint();
+  public:
+    TailCall(const char *label, Location *meth, int numArgs);
+    void EmitSpecific(Mips *mips);
+    void GetSrcs(std::vector<Location*> &srcs)
+        { if (methodAddr) srcs.push_back(methodAddr); }
+    void ReplaceSrc(Location *from, Location *to);
+};
+
+// A phi function of SSA form (see ssa.h): dst gets its i-th source
+// when control comes from the i-th predecessor of its block. Phis only
+// exist while a pass holds a function in SSA form, so they are never
+// emitted.
+class Phi: public Instruction
+{
+    Location *dst;
+    std::vector<Location*> srcs;
+    void Reprint();
+  public:
+    Phi(Location *dst, int numPreds);
+    void EmitSpecific(Mips *mips);
+    Location *GetDst() { return dst; }
+    int NumSrcs() const { return srcs.size(); }
+    Location *GetSrc(int i) const { return srcs[i]; }
+    void SetSrc(int i, Location *src);
+    void GetSrcs(std::vector<Location*> &s)
+        { s.insert(s.end(), srcs.begin(), srcs.end()); }
+    void ReplaceSrc(Location *from, Location *to);
+    void ReplaceDst(Location *to);
 };
 
 class VTable: public Instruction
@@ -260,6 +447,8 @@ class VTable: public Instruction
     VTable(const char *labelForTable, List<const char *> *methodLabels);
     void Print();
     void EmitSpecific(Mips *mips);
+    const char *GetLabel() const { return label; }
+    List<const char *> *GetMethodLabels() const { return methodLabels; }
 };
 
 #endif
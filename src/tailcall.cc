@@ -0,0 +1,164 @@
+/* File: tailcall.cc
+ * -----------------
+ * Implementation of the tail call passes.
+ */
+
+#include <string.h>
+#include <vector>
+#include "tailcall.h"
+#include "cfg.h"
+#include "codegen.h"
+#include "utility.h"
+
+typedef std::list<Instruction*>::iterator Iterator;
+
+// The number of PushParams just before the call at call
+static int CountArgs(Iterator begin, Iterator call) {
+    int n = 0;
+    while (call != begin && dynamic_cast<PushParam*>(*--call))
+        n++;
+    return n;
+}
+
+// Whether the instruction at p leaves the function with result, the
+// result of a call (NULL if it has none), or with no value
+static bool Returns(Iterator p, Location *result) {
+    if (dynamic_cast<EndFunc*>(*p)) return true;
+    Return *ret = dynamic_cast<Return*>(*p);
+    if (!ret) return false;
+    std::vector<Location*> val;
+    ret->GetSrcs(val);
+    return val.empty() || val[0] == result;
+}
+
+// Deletes the instructions from p to the Return or EndFunc at last,
+// keeping an EndFunc, and returns the position after them
+static Iterator EraseCall(std::list<Instruction*> &code, Iterator p,
+                          Iterator last) {
+    if (!dynamic_cast<EndFunc*>(*last)) ++last;
+    while (p != last) {
+        delete *p;
+        p = code.erase(p);
+    }
+    return p;
+}
+
+void RemoveTailRecursion(std::list<Instruction*> &code,
+                         std::list<Instruction*>::iterator begin,
+                         std::list<Instruction*>::iterator end) {
+    const char *name = dynamic_cast<Label*>(*begin)->text();
+    Iterator entry = begin;
+    BeginFunc *beginFunc = dynamic_cast<BeginFunc*>(*++entry);
+    ++entry;
+    List<Location*> *params = beginFunc->GetParams();
+    Iterator loop = end;            // the Label the calls jump to
+    Location *product = NULL;
+    int numCalls = 0;
+
+    Iterator p = entry;
+    while (p != end) {
+        LCall *call = dynamic_cast<LCall*>(*p);
+        Iterator last = p;
+        if (!call || strcmp(call->GetLabel(), name) || ++last == end
+            || !dynamic_cast<PopParams*>(*last)
+            || CountArgs(entry, p) != params->NumElements()) {
+            ++p;
+            continue;
+        }
+        ++last;
+        Location *factor = NULL, *result = call->GetDst();
+        BinaryOp *mul = dynamic_cast<BinaryOp*>(*last);
+        if (result && mul && mul->GetOpCode() == BinaryOp::Mul
+            && mul->GetOp2() && mul->GetOp1() != mul->GetOp2()) {
+            if (mul->GetOp1() == result) factor = mul->GetOp2();
+            if (mul->GetOp2() == result) factor = mul->GetOp1();
+        }
+        bool tail;
+        if (FlowGraph::IsTracked(factor)) {
+            std::vector<Location*> val;
+            if (dynamic_cast<Return*>(*++last)) (*last)->GetSrcs(val);
+            tail = !val.empty() && val[0] == mul->GetDst();
+        } else {
+            factor = NULL;
+            tail = Returns(last, result);
+        }
+        if (!tail) {
+            ++p;
+            continue;
+        }
+
+        if (loop == end)
+            loop = code.insert(entry, new Label(CodeGenerator::NewLabel()));
+        std::vector<Location*> temps;
+        Iterator q = p;
+        for (int i = 0; i < params->NumElements(); i++) {
+            std::vector<Location*> arg;
+            (*--q)->GetSrcs(arg);
+            delete *q;
+            temps.push_back(CodeGenerator::NewTempVar(beginFunc));
+            *q = new Assign(temps.back(), arg[0]);
+        }
+        if (factor) {
+            if (!product) {
+                product = CodeGenerator::NewLocalVar(beginFunc, "product");
+                code.insert(loop, new LoadConstant(product, 1));
+            }
+            code.insert(p, new BinaryOp(BinaryOp::Mul, product, product,
+                                        factor));
+        }
+        for (int i = 0; i < params->NumElements(); i++)
+            code.insert(p, new Assign(params->Nth(i), temps[i]));
+        code.insert(p, new Goto(dynamic_cast<Label*>(*loop)->text()));
+        p = EraseCall(code, p, last);
+        numCalls++;
+    }
+
+    if (product) {
+        for (p = entry; p != end; ++p) {
+            std::vector<Location*> val;
+            if (dynamic_cast<Return*>(*p)) (*p)->GetSrcs(val);
+            if (val.empty()) continue;
+            Location *t = CodeGenerator::NewTempVar(beginFunc);
+            code.insert(p, new BinaryOp(BinaryOp::Mul, t, product, val[0]));
+            (*p)->ReplaceSrc(val[0], t);
+        }
+    }
+    if (numCalls)
+        PrintDebug("tailcall", "%s: %d recursive calls made jumps%s", name,
+                   numCalls, product ? " with a product" : "");
+}
+
+void MarkTailCalls(std::list<Instruction*> &code,
+                   std::list<Instruction*>::iterator begin,
+                   std::list<Instruction*>::iterator end) {
+    Iterator p = begin;
+    BeginFunc *beginFunc = dynamic_cast<BeginFunc*>(*++p);
+    int numParams = beginFunc->GetParams()->NumElements();
+    int numCalls = 0;
+
+    while (p != end) {
+        Iterator last = p;
+        PopParams *pop = NULL;
+        if (FlowGraph::IsCall(*p) && ++last != end)
+            pop = dynamic_cast<PopParams*>(*last);
+        int numArgs = pop ? pop->GetNumBytes() / CodeGenerator::VarSize : 0;
+        if (!pop || numArgs > numParams || !Returns(++last, (*p)->GetDst())) {
+            ++p;
+            continue;
+        }
+        TailCall *tail;
+        if (LCall *call = dynamic_cast<LCall*>(*p)) {
+            tail = new TailCall(call->GetLabel(), NULL, numArgs);
+        } else {
+            std::vector<Location*> fn;
+            (*p)->GetSrcs(fn);
+            tail = new TailCall(NULL, fn[0], numArgs);
+        }
+        p = EraseCall(code, p, last);
+        code.insert(p, tail);
+        numCalls++;
+    }
+    if (numCalls)
+        PrintDebug("tailcall", "%s: %d tail calls",
+                   dynamic_cast<Label*>(*begin)->text(), numCalls);
+}
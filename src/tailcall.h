@@ -0,0 +1,47 @@
+/* File: tailcall.h
+ * ----------------
+ * Calls in tail position: an LCall or ACall followed by its PopParams
+ * and a Return of its result, or the end of a function returning no
+ * value. This is the code Call::Emit and ReturnStmt::Emit generate for
+ * return f(...), or for f(...) as the last statement of a void function.
+ *
+ * RemoveTailRecursion turns the tail calls of a function to itself into
+ * a loop. The arguments are copied into new temps, then into the params
+ * (an argument may read a param assigned before it), and a Goto jumps
+ * back to a new label after the BeginFunc. The loop runs in one frame
+ * and is seen as such by the passes that follow (see licm.h). A call
+ * whose result is multiplied by a local value before being returned, as
+ * in return n * f(n - 1), is handled as well with a product of those
+ * values, set to 1 on entry: the Gotos multiply it by the value, and
+ * the other Returns of the function return it times their value. The
+ * MIPS mul does not trap, so the order of the multiplications does not
+ * matter.
+ *
+ * MarkTailCalls runs late, after the passes that work on the calls, and
+ * turns the tail calls to other functions (or to the method loaded for
+ * an ACall) into TailCall instructions, when they pass no more
+ * arguments than the function was passed: the caller made room for
+ * that many. A TailCall copies the arguments over the params of the
+ * function, pops its frame and jumps to the callee (see
+ * Mips::EmitTailCall), so a chain of tail calls does not grow the stack.
+ */
+
+#ifndef _H_tailcall
+#define _H_tailcall
+
+#include <list>
+#include "tac.h"
+
+// The function pass: turns the self-recursive tail calls of the
+// function [begin, end) into jumps back to its entry
+void RemoveTailRecursion(std::list<Instruction*> &code,
+                         std::list<Instruction*>::iterator begin,
+                         std::list<Instruction*>::iterator end);
+
+// The function pass: makes the other tail calls of the function
+// [begin, end) reuse its frame
+void MarkTailCalls(std::list<Instruction*> &code,
+                   std::list<Instruction*>::iterator begin,
+                   std::list<Instruction*>::iterator end);
+
+#endif
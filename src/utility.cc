@@ -7,10 +7,13 @@
 #include "utility.h"
 #include <stdarg.h>
 #include "list.h"
+#include "passes.h"
 #include <string.h>
 
 static List<const char*> debugKeys;
+static List<const char*> flagsOn, flagsOff;
 static const int BufferSize = 2048;
+static int optimizationLevel = 0;
 
 void Failure(const char *format, ...)
 {
@@ -66,17 +69,85 @@ void PrintDebug(const char *key, const char *format, ...)
 }
 
 
-void ParseCommandLine(int argc, char *argv[])
+void SetOptimizationLevel(int level)
 {
-  if (argc == 1)
-    return;
+  optimizationLevel = level;
+}
+
+int GetOptimizationLevel()
+{
+  return optimizationLevel;
+}
+
+
+static int IndexOf(List<const char*> &list, const char *name)
+{
+  for (int i = 0; i < list.NumElements(); i++)
+    if (!strcmp(list.Nth(i), name)) return i;
+  return -1;
+}
+
+void SetFlag(const char *name, bool value)
+{
+  List<const char*> &add = value ? flagsOn : flagsOff;
+  List<const char*> &remove = value ? flagsOff : flagsOn;
+  int k = IndexOf(remove, name);
+  if (k != -1)
+    remove.RemoveAt(k);
+  if (IndexOf(add, name) == -1)
+    add.Append(name);
+}
+
+bool IsFlagOn(const char *name, bool byDefault)
+{
+  if (IndexOf(flagsOn, name) != -1) return true;
+  if (IndexOf(flagsOff, name) != -1) return false;
+  return byDefault;
+}
+
+
+// The code generation flags other than the names of the passes
+static const char *codegenFlags[] = {"regparams", "peephole", "devirtualize"};
+static const int NumCodegenFlags =
+  sizeof(codegenFlags) / sizeof(codegenFlags[0]);
+
+static bool IsKnownFlag(const char *name)
+{
+  for (int i = 0; i < NumCodegenFlags; i++)
+    if (!strcmp(codegenFlags[i], name)) return true;
+  return PassManager::IsPass(name);
+}
 
-  if (strcmp(argv[1], "-d") != 0) { // first arg is not -d
-    printf("Usage:   -d <debug-key-1> <debug-key-2> ... \n");
-    exit(2);
+static void Usage()
+{
+  printf("Usage:   [-O<level>] [-f<flag> | -fno-<flag> ...] "
+         "[-d <debug-key-1> <debug-key-2> ...] \n");
+  exit(2);
+}
+
+void ParseCommandLine(int argc, char *argv[])
+{
+  int i;
+
+  for (i = 1; i < argc && strcmp(argv[i], "-d") != 0; i++) {
+    if (!strncmp(argv[i], "-O", 2)) { // optimization level, e.g. -O1
+      const char *level = argv[i] + 2;
+      if (*level == '\0' || strspn(level, "0123456789") != strlen(level))
+        Usage();
+      SetOptimizationLevel(atoi(level));
+    } else if (!strncmp(argv[i], "-fno-", 5) && IsKnownFlag(argv[i] + 5)) {
+      SetFlag(argv[i] + 5, false);
+    } else if (!strncmp(argv[i], "-f", 2) && IsKnownFlag(argv[i] + 2)) {
+      SetFlag(argv[i] + 2, true);
+    } else {
+      Usage();
+    }
   }
 
-  for (int i = 2; i < argc; i++)
+  if (i == argc)
+    return;
+
+  for (i++; i < argc; i++)
     SetDebugForKey(argv[i], true);
 }
 
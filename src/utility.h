@@ -72,11 +72,53 @@ bool IsDebugOn(const char *key);
 
 
 
+/* Function: SetOptimizationLevel()
+ * Usage: SetOptimizationLevel(1);
+ * -------------------------------
+ * Set the level of back end optimization. Level 0 (the default) is the
+ * plain load/store translation of each Tac instruction, higher levels
+ * enable more aggressive (and more expensive) code generation.
+ */
+void SetOptimizationLevel(int level);
+
+
+/* Function: GetOptimizationLevel()
+ * Usage: if (GetOptimizationLevel() >= 1) ...
+ * -------------------------------------------
+ * Return the level of back end optimization requested by the user.
+ */
+int GetOptimizationLevel();
+
+
+
+/* Function: SetFlag()
+ * Usage: SetFlag("regparams", true);
+ * ----------------------------------
+ * Explicitly turn a code generation flag on or off. Flags are given on
+ * the command line as -f<name> and -fno-<name>.
+ */
+void SetFlag(const char *name, bool value);
+
+
+/* Function: IsFlagOn()
+ * Usage: if (IsFlagOn("regparams", false)) ...
+ * --------------------------------------------
+ * Return whether the code generation flag is on. A flag that was not
+ * set on the command line has the value byDefault, which lets a flag
+ * be on by default at some optimization levels only.
+ */
+bool IsFlagOn(const char *name, bool byDefault);
+
+
+
 /* Function: ParseCommandLine
  * --------------------------
- * Turn on the debugging flags from the command line.  Verifies that
- * first argument is -d, and then interpret all the arguments that follow
- * as being flags to turn on.
+ * Turn on the debugging flags from the command line. Optional -O<n>
+ * and -f<flag>/-fno-<flag> arguments select the optimization level and
+ * code generation flags, a flag being the name of a pass (see
+ * passes.cc) or of another code generation option. They may be followed
+ * by -d and all the arguments after -d are interpreted as flags to turn
+ * on.
  */
 void ParseCommandLine(int argc, char *argv[]);
 